@@ -4,6 +4,7 @@
 
 #include "db/builder.h"
 
+#include "db/compaction_rules.h"
 #include "db/filename.h"
 #include "db/dbformat.h"
 #include "db/table_cache.h"
@@ -14,15 +15,40 @@
 
 namespace leveldb {
 
-Status BuildTable(const std::string& dbname,
-                  Env* env,
-                  const Options& options,
-                  TableCache* table_cache,
-                  Iterator* iter,
-                  FileMetaData* meta) {
+namespace {
+
+// Return the partition of "files" (sorted and disjoint) that "user_key"
+// falls into: 2*i+1 if it lies inside files[i], 2*i if it lies in the
+// gap before files[i].  Keys must be passed in increasing order; *index
+// remembers where the previous search stopped.
+size_t FindPartition(const Comparator* ucmp,
+                     const std::vector<FileMetaData*>& files,
+                     const Slice& user_key,
+                     size_t* index) {
+  while (*index < files.size() &&
+         ucmp->Compare(user_key, files[*index]->largest.user_key()) > 0) {
+    ++*index;
+  }
+  if (*index < files.size() &&
+      ucmp->Compare(user_key, files[*index]->smallest.user_key()) >= 0) {
+    return 2 * *index + 1;
+  }
+  return 2 * *index;
+}
+
+}  // namespace
+
+Status BuildPartitionedTable(const std::string& dbname,
+                             Env* env,
+                             const Options& options,
+                             TableCache* table_cache,
+                             Iterator* iter,
+                             const std::vector<SequenceNumber>& snapshots,
+                             const std::vector<FileMetaData*>& partition,
+                             uint64_t min_size,
+                             FileMetaData* meta) {
   Status s;
   meta->file_size = 0;
-  iter->SeekToFirst();
 
   std::string fname = TableFileName(dbname, meta->number);
   if (iter->Valid()) {
@@ -32,10 +58,36 @@ Status BuildTable(const std::string& dbname,
       return s;
     }
 
+    // options.comparator is the InternalKeyComparator installed by
+    // SanitizeOptions(), so the user comparator can be recovered from it.
+    const InternalKeyComparator* icmp =
+        reinterpret_cast<const InternalKeyComparator*>(options.comparator);
+    const Comparator* ucmp = icmp->user_comparator();
+    CompactionRules rules(icmp, snapshots);
+    ParsedInternalKey ikey;
+    size_t partition_index = 0;
+    size_t current_partition = 0;
+
     TableBuilder* builder = new TableBuilder(options, file);
     meta->smallest.DecodeFrom(iter->key());
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
+      // Drop the entries that no reader can observe
+      const CompactionRules::Action action = rules.Decide(key, &ikey);
+      if (action == CompactionRules::kDrop) {
+        continue;
+      } else if (action != CompactionRules::kCorrupt) {
+        // End the table when crossing into another partition.  Entries
+        // for one user key always share a partition, so they stay together.
+        const size_t p = FindPartition(ucmp, partition, ikey.user_key,
+                                       &partition_index);
+        if (p != current_partition) {
+          if (builder->NumEntries() > 0 && builder->FileSize() >= min_size) {
+            break;
+          }
+          current_partition = p;
+        }
+      }
       meta->largest.DecodeFrom(key);
       // 这里的key实际上是带上了SequenceNumber和ValueType的
       // key   : | <key> | <SequenceNumber + ValueType> |
@@ -84,4 +136,17 @@ Status BuildTable(const std::string& dbname,
   return s;
 }
 
+Status BuildTable(const std::string& dbname,
+                  Env* env,
+                  const Options& options,
+                  TableCache* table_cache,
+                  Iterator* iter,
+                  const std::vector<SequenceNumber>& snapshots,
+                  FileMetaData* meta) {
+  iter->SeekToFirst();
+  std::vector<FileMetaData*> no_partition;
+  return BuildPartitionedTable(dbname, env, options, table_cache, iter,
+                               snapshots, no_partition, 0, meta);
+}
+
 }  // namespace leveldb
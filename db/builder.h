@@ -5,6 +5,8 @@
 #ifndef STORAGE_LEVELDB_DB_BUILDER_H_
 #define STORAGE_LEVELDB_DB_BUILDER_H_
 
+#include <vector>
+#include "db/dbformat.h"
 #include "leveldb/status.h"
 
 namespace leveldb {
@@ -22,13 +24,38 @@ class VersionEdit;
 // *meta will be filled with metadata about the generated table.
 // If no data is present in *iter, meta->file_size will be set to
 // zero, and no Table file will be produced.
+//
+// "snapshots" holds the sequence numbers of all live snapshots in
+// increasing order.  Entries of *iter that are hidden by a newer entry
+// for the same user key which no live snapshot separates from them are
+// not written, since no reader can observe them.
 extern Status BuildTable(const std::string& dbname,
                          Env* env,
                          const Options& options,
                          TableCache* table_cache,
                          Iterator* iter,
+                         const std::vector<SequenceNumber>& snapshots,
                          FileMetaData* meta);
 
+// Like BuildTable(), but consumes *iter from its current position and
+// may stop early.  The files in "partition" (sorted and disjoint) and
+// the gaps between them cut the key space into partitions; the table
+// ends right before the first entry that falls into a different
+// partition than its predecessor, provided the table already holds at
+// least "min_size" bytes.  On return *iter is positioned at the first
+// entry that was not consumed, or is not Valid() if the input has been
+// exhausted.
+extern Status BuildPartitionedTable(
+    const std::string& dbname,
+    Env* env,
+    const Options& options,
+    TableCache* table_cache,
+    Iterator* iter,
+    const std::vector<SequenceNumber>& snapshots,
+    const std::vector<FileMetaData*>& partition,
+    uint64_t min_size,
+    FileMetaData* meta);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_DB_BUILDER_H_
@@ -15,6 +15,8 @@
 #include "leveldb/options.h"
 #include "leveldb/status.h"
 #include "leveldb/write_batch.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
 
 using leveldb::Cache;
 using leveldb::Comparator;
@@ -215,6 +217,70 @@ char* leveldb_get(
   return result;
 }
 
+namespace {
+struct MultiGetState {
+  char** values;
+  size_t* vallens;
+  char** errs;
+
+  leveldb::port::Mutex mu;
+  leveldb::port::CondVar cv;
+  size_t remaining;             // Protected by mu
+
+  MultiGetState() : cv(&mu) { }
+};
+}  // namespace
+
+static void MultiGetDone(void* arg, int index, const Status& s,
+                         const Slice& value) {
+  MultiGetState* state = reinterpret_cast<MultiGetState*>(arg);
+  if (s.ok()) {
+    state->vallens[index] = value.size();
+    state->values[index] = reinterpret_cast<char*>(malloc(value.size()));
+    memcpy(state->values[index], value.data(), value.size());
+  } else {
+    state->vallens[index] = 0;
+    state->values[index] = NULL;
+    if (!s.IsNotFound()) {
+      SaveError(&state->errs[index], s);
+    }
+  }
+  leveldb::MutexLock l(&state->mu);
+  if (--state->remaining == 0) {
+    state->cv.Signal();
+  }
+}
+
+void leveldb_multiget(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    size_t num_keys,
+    const char* const* keys, const size_t* keylens,
+    char** values, size_t* vallens,
+    char** errs) {
+  if (num_keys == 0) {
+    return;
+  }
+  Slice* k = new Slice[num_keys];
+  for (size_t i = 0; i < num_keys; i++) {
+    k[i] = Slice(keys[i], keylens[i]);
+  }
+  MultiGetState state;
+  state.values = values;
+  state.vallens = vallens;
+  state.errs = errs;
+  state.remaining = num_keys;
+  db->rep->MultiGetAsync(options->rep, static_cast<int>(num_keys), k,
+                         &MultiGetDone, &state);
+  {
+    leveldb::MutexLock l(&state.mu);
+    while (state.remaining > 0) {
+      state.cv.Wait();
+    }
+  }
+  delete[] k;
+}
+
 leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db,
     const leveldb_readoptions_t* options) {
@@ -330,6 +396,12 @@ const char* leveldb_iter_value(const leveldb_iterator_t* iter, size_t* vlen) {
   return s.data();
 }
 
+size_t leveldb_iter_next_batch(leveldb_iterator_t* iter, size_t max_entries,
+                               char* buf, size_t buflen,
+                               size_t* klens, size_t* vlens, size_t* used) {
+  return iter->rep->NextBatch(max_entries, buf, buflen, klens, vlens, used);
+}
+
 void leveldb_iter_get_error(const leveldb_iterator_t* iter, char** errptr) {
   SaveError(errptr, iter->rep->status());
 }
@@ -359,6 +431,25 @@ void leveldb_writebatch_delete(
   b->rep.Delete(Slice(key, klen));
 }
 
+void leveldb_writebatch_put_batch(
+    leveldb_writebatch_t* b,
+    size_t num,
+    const char* const* keys, const size_t* klens,
+    const char* const* vals, const size_t* vlens) {
+  for (size_t i = 0; i < num; i++) {
+    b->rep.Put(Slice(keys[i], klens[i]), Slice(vals[i], vlens[i]));
+  }
+}
+
+void leveldb_writebatch_delete_batch(
+    leveldb_writebatch_t* b,
+    size_t num,
+    const char* const* keys, const size_t* klens) {
+  for (size_t i = 0; i < num; i++) {
+    b->rep.Delete(Slice(keys[i], klens[i]));
+  }
+}
+
 void leveldb_writebatch_iterate(
     leveldb_writebatch_t* b,
     void* state,
@@ -274,6 +274,57 @@ int main(int argc, char** argv) {
     leveldb_iter_destroy(iter);
   }
 
+  StartPhase("batch");
+  {
+    const char* keys[4] = { "box", "m1", "m2", "nope" };
+    size_t keylens[4] = { 3, 2, 2, 4 };
+    const char* vals[2] = { "x", "yy" };
+    size_t putlens[2] = { 1, 2 };
+    size_t vallens[4];
+    char* values[4];
+    char* errs[4] = { NULL, NULL, NULL, NULL };
+    char buf[100];
+    size_t klens[10];
+    size_t vlens[10];
+    size_t used;
+    int i;
+    leveldb_iterator_t* iter;
+    leveldb_writebatch_t* wb = leveldb_writebatch_create();
+    leveldb_writebatch_put_batch(wb, 2, keys + 1, keylens + 1, vals, putlens);
+    leveldb_write(db, woptions, wb, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "m2", "yy");
+
+    leveldb_multiget(db, roptions, 4, keys, keylens, values, vallens, errs);
+    CheckEqual("c", values[0], vallens[0]);
+    CheckEqual("x", values[1], vallens[1]);
+    CheckEqual("yy", values[2], vallens[2]);
+    CheckEqual(NULL, values[3], vallens[3]);
+    for (i = 0; i < 4; i++) {
+      CheckNoError(errs[i]);
+      Free(&values[i]);
+    }
+
+    iter = leveldb_create_iterator(db, roptions);
+    leveldb_iter_seek_to_first(iter);
+    CheckCondition(leveldb_iter_next_batch(iter, 10, buf, 3, klens, vlens,
+                                           &used) == 0);
+    CheckCondition(leveldb_iter_valid(iter));
+    CheckCondition(leveldb_iter_next_batch(iter, 10, buf, sizeof(buf), klens,
+                                           vlens, &used) == 4);
+    CheckCondition(!leveldb_iter_valid(iter));
+    CheckEqual("boxcfoohellom1xm2yy", buf, used);
+    CheckCondition(klens[1] == 3 && vlens[1] == 5);
+    leveldb_iter_destroy(iter);
+
+    leveldb_writebatch_clear(wb);
+    leveldb_writebatch_delete_batch(wb, 2, keys + 1, keylens + 1);
+    leveldb_write(db, woptions, wb, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "m1", NULL);
+    leveldb_writebatch_destroy(wb);
+  }
+
   StartPhase("approximate_sizes");
   {
     int i;
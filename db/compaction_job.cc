@@ -0,0 +1,392 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/compaction_job.h"
+
+#include "db/compaction_rules.h"
+#include "db/filename.h"
+#include "db/table_cache.h"
+#include "leveldb/comparator.h"
+#include "leveldb/compaction_service.h"
+#include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/iterator.h"
+#include "leveldb/table_builder.h"
+#include "table/merger.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+CompactionJob::CompactionJob()
+    : level(0),
+      max_output_file_size(0),
+      max_grandparent_overlap_bytes(0),
+      compression(kNoCompression),
+      block_size(0),
+      block_restart_interval(0),
+      large_value_threshold(0),
+      block_align(false),
+      first_output_number(0),
+      num_output_numbers(0) {
+}
+
+static void PutFiles(std::string* dst, const std::vector<FileMetaData>& files) {
+  PutVarint32(dst, files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    const FileMetaData& f = files[i];
+    PutVarint64(dst, f.number);
+    PutVarint64(dst, f.file_size);
+    PutLengthPrefixedSlice(dst, f.smallest.Encode());
+    PutLengthPrefixedSlice(dst, f.largest.Encode());
+  }
+}
+
+static bool GetFiles(Slice* input, std::vector<FileMetaData>* files) {
+  uint32_t n;
+  if (!GetVarint32(input, &n)) {
+    return false;
+  }
+  files->clear();
+  for (uint32_t i = 0; i < n; i++) {
+    FileMetaData f;
+    Slice smallest, largest;
+    if (!GetVarint64(input, &f.number) ||
+        !GetVarint64(input, &f.file_size) ||
+        !GetLengthPrefixedSlice(input, &smallest) ||
+        !GetLengthPrefixedSlice(input, &largest)) {
+      return false;
+    }
+    f.smallest.DecodeFrom(smallest);
+    f.largest.DecodeFrom(largest);
+    files->push_back(f);
+  }
+  return true;
+}
+
+void CompactionJob::EncodeTo(std::string* dst) const {
+  PutLengthPrefixedSlice(dst, comparator);
+  PutLengthPrefixedSlice(dst, filter_policy);
+  PutVarint32(dst, level);
+  PutVarint32(dst, snapshots.size());
+  for (size_t i = 0; i < snapshots.size(); i++) {
+    PutVarint64(dst, snapshots[i]);
+  }
+  PutVarint64(dst, max_output_file_size);
+  PutVarint64(dst, max_grandparent_overlap_bytes);
+  PutVarint32(dst, compression);
+  PutVarint32(dst, block_size);
+  PutVarint32(dst, block_restart_interval);
+  PutVarint64(dst, large_value_threshold);
+  PutVarint32(dst, block_align ? 1 : 0);
+  PutVarint64(dst, first_output_number);
+  PutVarint64(dst, num_output_numbers);
+  PutFiles(dst, inputs[0]);
+  PutFiles(dst, inputs[1]);
+  for (int lvl = 0; lvl < config::kNumLevels; lvl++) {
+    PutFiles(dst, deeper[lvl]);
+  }
+}
+
+Status CompactionJob::DecodeFrom(const Slice& src) {
+  Slice input = src;
+  Slice str;
+  uint32_t v;
+  uint64_t overlap;
+  const char* msg = NULL;
+
+  if (GetLengthPrefixedSlice(&input, &str)) {
+    comparator = str.ToString();
+  } else {
+    msg = "comparator name";
+  }
+  if (msg == NULL) {
+    if (GetLengthPrefixedSlice(&input, &str)) {
+      filter_policy = str.ToString();
+    } else {
+      msg = "filter policy name";
+    }
+  }
+  if (msg == NULL) {
+    if (GetVarint32(&input, &v) && v + 1 < config::kNumLevels) {
+      level = v;
+    } else {
+      msg = "level";
+    }
+  }
+  if (msg == NULL) {
+    uint32_t num_snapshots;
+    if (GetVarint32(&input, &num_snapshots)) {
+      snapshots.clear();
+      for (uint32_t i = 0; msg == NULL && i < num_snapshots; i++) {
+        SequenceNumber snapshot;
+        if (GetVarint64(&input, &snapshot) &&
+            (snapshots.empty() || snapshots.back() <= snapshot)) {
+          snapshots.push_back(snapshot);
+        } else {
+          msg = "snapshots";
+        }
+      }
+    } else {
+      msg = "snapshots";
+    }
+  }
+  if (msg == NULL) {
+    if (!GetVarint64(&input, &max_output_file_size) ||
+        !GetVarint64(&input, &overlap)) {
+      msg = "compaction limits";
+    } else {
+      max_grandparent_overlap_bytes = static_cast<int64_t>(overlap);
+    }
+  }
+  if (msg == NULL) {
+    if (GetVarint32(&input, &v) && v <= kSnappyCompression) {
+      compression = static_cast<CompressionType>(v);
+    } else {
+      msg = "compression type";
+    }
+  }
+  if (msg == NULL) {
+    uint32_t size, interval, align;
+    if (GetVarint32(&input, &size) && GetVarint32(&input, &interval) &&
+        GetVarint64(&input, &large_value_threshold) &&
+        GetVarint32(&input, &align) &&
+        size > 0 && interval > 0 && align <= 1) {
+      block_size = size;
+      block_restart_interval = interval;
+      block_align = (align == 1);
+    } else {
+      msg = "block format";
+    }
+  }
+  if (msg == NULL) {
+    if (!GetVarint64(&input, &first_output_number) ||
+        !GetVarint64(&input, &num_output_numbers)) {
+      msg = "output file numbers";
+    }
+  }
+  if (msg == NULL) {
+    if (!GetFiles(&input, &inputs[0]) || !GetFiles(&input, &inputs[1])) {
+      msg = "input files";
+    }
+  }
+  for (int lvl = 0; msg == NULL && lvl < config::kNumLevels; lvl++) {
+    if (!GetFiles(&input, &deeper[lvl])) {
+      msg = "deeper level files";
+    }
+  }
+  if (msg == NULL && !input.empty()) {
+    msg = "trailing bytes";
+  }
+
+  Status result;
+  if (msg != NULL) {
+    result = Status::Corruption("CompactionJob", msg);
+  }
+  return result;
+}
+
+void CompactionJobResult::EncodeTo(std::string* dst) const {
+  PutFiles(dst, outputs);
+}
+
+Status CompactionJobResult::DecodeFrom(const Slice& src) {
+  Slice input = src;
+  if (!GetFiles(&input, &outputs) || !input.empty()) {
+    return Status::Corruption("CompactionJobResult", "output files");
+  }
+  return Status::OK();
+}
+
+CompactionService::~CompactionService() { }
+
+namespace {
+
+// Finish the table being built into "file", described by "meta".
+Status FinishOutput(TableCache* table_cache, TableBuilder* builder,
+                    WritableFile* file, FileMetaData* meta) {
+  Status s = builder->Finish();
+  meta->file_size = builder->FileSize();
+  delete builder;
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;
+
+  if (s.ok()) {
+    // Verify that the table is usable
+    Iterator* iter = table_cache->NewIterator(ReadOptions(), meta->number,
+                                              meta->file_size);
+    s = iter->status();
+    delete iter;
+  }
+  return s;
+}
+
+class LocalCompactionService : public CompactionService {
+ public:
+  explicit LocalCompactionService(const Options& options)
+      : options_(options) { }
+
+  virtual Status Compact(const std::string& dbname, const std::string& job,
+                         std::string* result) {
+    return RunCompactionJob(options_, dbname, job, result);
+  }
+
+ private:
+  const Options options_;
+};
+
+}  // namespace
+
+Status RunCompactionJob(const Options& options,
+                        const std::string& dbname,
+                        const std::string& encoded_job,
+                        std::string* result) {
+  CompactionJob job;
+  Status s = job.DecodeFrom(encoded_job);
+  if (!s.ok()) {
+    return s;
+  }
+  if (job.comparator != options.comparator->Name()) {
+    return Status::InvalidArgument(
+        options.comparator->Name(),
+        "does not match job comparator " + job.comparator);
+  }
+  const std::string policy_name =
+      (options.filter_policy != NULL) ? options.filter_policy->Name() : "";
+  if (job.filter_policy != policy_name) {
+    return Status::InvalidArgument(
+        "filter policy does not match job filter policy", job.filter_policy);
+  }
+
+  const InternalKeyComparator icmp(options.comparator);
+  const InternalFilterPolicy ipolicy(options.filter_policy);
+  Options table_options = options;
+  table_options.comparator = &icmp;
+  table_options.filter_policy =
+      (options.filter_policy != NULL) ? &ipolicy : NULL;
+  table_options.compression = job.compression;
+  table_options.block_size = job.block_size;
+  table_options.block_restart_interval = job.block_restart_interval;
+  table_options.large_value_threshold =
+      static_cast<size_t>(job.large_value_threshold);
+  table_options.block_align = job.block_align;
+  Env* env = options.env;
+
+  const int num_inputs = job.inputs[0].size() + job.inputs[1].size();
+  TableCache table_cache(dbname, &table_options, num_inputs + 10);
+
+  ReadOptions read_options;
+  read_options.verify_checksums = options.paranoid_checks;
+  read_options.fill_cache = false;
+  std::vector<Iterator*> list;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < job.inputs[which].size(); i++) {
+      const FileMetaData& f = job.inputs[which][i];
+      list.push_back(table_cache.NewIterator(read_options, f.number,
+                                             f.file_size));
+    }
+  }
+  Iterator* input = NewMergingIterator(&icmp, &list[0], list.size());
+
+  // The same rules as DBImpl::DoCompactionWork(), with the file lists of
+  // the job
+  std::vector<FileMetaData*> deeper[config::kNumLevels];
+  CompactionRules rules(&icmp, job.snapshots, job.level + 1,
+                        job.max_grandparent_overlap_bytes);
+  for (int lvl = job.level + 2; lvl < config::kNumLevels; lvl++) {
+    for (size_t i = 0; i < job.deeper[lvl].size(); i++) {
+      deeper[lvl].push_back(&job.deeper[lvl][i]);
+    }
+    rules.AddDeeperLevel(lvl, &deeper[lvl]);
+  }
+
+  CompactionJobResult output;
+  WritableFile* file = NULL;
+  TableBuilder* builder = NULL;
+  uint64_t next_number = job.first_output_number;
+  ParsedInternalKey ikey;
+  std::string rewritten_key;
+  for (input->SeekToFirst(); input->Valid(); input->Next()) {
+    Slice key = input->key();
+    if (rules.ShouldStopBefore(key) && builder != NULL) {
+      s = FinishOutput(&table_cache, builder, file, &output.outputs.back());
+      builder = NULL;
+      file = NULL;
+      if (!s.ok()) {
+        break;
+      }
+    }
+
+    const CompactionRules::Action action = rules.Decide(key, &ikey);
+    if (action == CompactionRules::kDrop) {
+      continue;
+    }
+    if (action == CompactionRules::kZeroSequence) {
+      rewritten_key.clear();
+      AppendInternalKey(&rewritten_key,
+                        ParsedInternalKey(ikey.user_key, 0, ikey.type));
+      key = rewritten_key;
+    }
+
+    if (builder == NULL) {
+      if (next_number - job.first_output_number >= job.num_output_numbers) {
+        s = Status::IOError("compaction job ran out of output file numbers");
+        break;
+      }
+      FileMetaData meta;
+      meta.number = next_number++;
+      s = env->NewWritableFile(TableFileName(dbname, meta.number), &file);
+      if (!s.ok()) {
+        break;
+      }
+      builder = new TableBuilder(table_options, file);
+      output.outputs.push_back(meta);
+    }
+    FileMetaData* meta = &output.outputs.back();
+    if (builder->NumEntries() == 0) {
+      meta->smallest.DecodeFrom(key);
+    }
+    meta->largest.DecodeFrom(key);
+    builder->Add(key, input->value());
+
+    if (builder->FileSize() >= job.max_output_file_size) {
+      s = FinishOutput(&table_cache, builder, file, meta);
+      builder = NULL;
+      file = NULL;
+      if (!s.ok()) {
+        break;
+      }
+    }
+  }
+
+  if (s.ok()) {
+    s = input->status();
+  }
+  if (builder != NULL) {
+    if (s.ok()) {
+      s = FinishOutput(&table_cache, builder, file, &output.outputs.back());
+    } else {
+      builder->Abandon();
+      delete builder;
+      delete file;
+    }
+  }
+  delete input;
+
+  if (s.ok()) {
+    result->clear();
+    output.EncodeTo(result);
+  }
+  return s;
+}
+
+CompactionService* NewLocalCompactionService(const Options& options) {
+  return new LocalCompactionService(options);
+}
+
+}  // namespace leveldb
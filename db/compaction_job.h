@@ -0,0 +1,62 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_COMPACTION_JOB_H_
+#define STORAGE_LEVELDB_DB_COMPACTION_JOB_H_
+
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+#include "db/version_edit.h"
+#include "leveldb/options.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+// Everything needed to run one compaction without access to the DB's
+// in-memory state.  Encoded jobs are handed to a CompactionService.
+struct CompactionJob {
+  std::string comparator;       // Name of the user comparator
+  std::string filter_policy;    // Name of the filter policy, or empty
+  int level;                    // Inputs come from level and level+1
+  std::vector<SequenceNumber> snapshots;  // Live snapshots, oldest first
+  uint64_t max_output_file_size;
+  int64_t max_grandparent_overlap_bytes;
+
+  // Table format of the outputs
+  CompressionType compression;
+  int block_size;
+  int block_restart_interval;
+  uint64_t large_value_threshold;
+  bool block_align;
+
+  // Outputs are numbered first_output_number, first_output_number+1, ...
+  // and may use at most num_output_numbers numbers.
+  uint64_t first_output_number;
+  uint64_t num_output_numbers;
+
+  // inputs[0] holds files from "level", inputs[1] from "level+1"
+  std::vector<FileMetaData> inputs[2];
+
+  // Files in levels >= level+2 that overlap the key range of the inputs,
+  // sorted by key within each level.
+  std::vector<FileMetaData> deeper[config::kNumLevels];
+
+  CompactionJob();
+
+  void EncodeTo(std::string* dst) const;
+  Status DecodeFrom(const Slice& src);
+};
+
+// Tables written by a CompactionJob, in key order.
+struct CompactionJobResult {
+  std::vector<FileMetaData> outputs;
+
+  void EncodeTo(std::string* dst) const;
+  Status DecodeFrom(const Slice& src);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_COMPACTION_JOB_H_
@@ -0,0 +1,167 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/compaction_rules.h"
+
+#include <assert.h>
+#include <algorithm>
+#include "db/version_edit.h"
+#include "leveldb/comparator.h"
+
+namespace leveldb {
+
+CompactionRules::CompactionRules(const InternalKeyComparator* icmp,
+                                 const std::vector<SequenceNumber>& snapshots)
+    : icmp_(icmp),
+      snapshots_(snapshots),
+      compaction_(false),
+      output_level_(0),
+      max_grandparent_overlap_bytes_(0),
+      has_current_user_key_(false),
+      last_stripe_for_key_(0),
+      grandparent_index_(0),
+      seen_key_(false),
+      overlapped_bytes_(0) {
+  for (int lvl = 0; lvl < config::kNumLevels; lvl++) {
+    deeper_[lvl] = NULL;
+    level_ptrs_[lvl] = 0;
+  }
+}
+
+CompactionRules::CompactionRules(const InternalKeyComparator* icmp,
+                                 const std::vector<SequenceNumber>& snapshots,
+                                 int output_level,
+                                 int64_t max_grandparent_overlap_bytes)
+    : icmp_(icmp),
+      snapshots_(snapshots),
+      compaction_(true),
+      output_level_(output_level),
+      max_grandparent_overlap_bytes_(max_grandparent_overlap_bytes),
+      has_current_user_key_(false),
+      last_stripe_for_key_(0),
+      grandparent_index_(0),
+      seen_key_(false),
+      overlapped_bytes_(0) {
+  for (int lvl = 0; lvl < config::kNumLevels; lvl++) {
+    deeper_[lvl] = NULL;
+    level_ptrs_[lvl] = 0;
+  }
+}
+
+void CompactionRules::AddDeeperLevel(int level,
+                                     const std::vector<FileMetaData*>* files) {
+  assert(compaction_);
+  assert(level > output_level_ && level < config::kNumLevels);
+  deeper_[level] = files;
+}
+
+CompactionRules::Action CompactionRules::Decide(const Slice& internal_key,
+                                                ParsedInternalKey* ikey) {
+  if (!ParseInternalKey(internal_key, ikey)) {
+    // Do not hide error keys
+    current_user_key_.clear();
+    has_current_user_key_ = false;
+    return kCorrupt;
+  }
+
+  // Entries for a user key arrive newest first.  Only the newest entry in
+  // each snapshot stripe (the range of sequence numbers between two
+  // adjacent live snapshots) can ever be read, so the rest are dropped.
+  const size_t stripe =
+      std::lower_bound(snapshots_.begin(), snapshots_.end(),
+                       ikey->sequence) - snapshots_.begin();
+  if (!has_current_user_key_ ||
+      icmp_->user_comparator()->Compare(ikey->user_key,
+                                        Slice(current_user_key_)) != 0) {
+    // First occurrence of this user key
+    current_user_key_.assign(ikey->user_key.data(), ikey->user_key.size());
+    has_current_user_key_ = true;
+  } else if (stripe == last_stripe_for_key_) {
+    // Hidden by a newer entry for same user key
+    return kDrop;
+  }
+  last_stripe_for_key_ = stripe;
+
+  // Entries of the oldest stripe are seen by every live snapshot
+  if (compaction_ && stripe == 0 && IsBaseLevelForKey(ikey->user_key)) {
+    if (ikey->type == kTypeDeletion) {
+      // 当前记录带有删除标记
+      // 并且当前记录的sequence，小于快照的序号
+      // 最重要的一点是当前的user_key，在[output_level_ + 1， kNumLevels]层
+      // 没有user_key对应的记录(compact的输出在第output_level_层)
+      //
+      // For this user key:
+      // (1) there is no data in higher levels
+      // (2) data in lower levels will have larger sequence numbers
+      // (3) data in layers that are being compacted here and have
+      //     smaller sequence numbers will be dropped in the next
+      //     few iterations of this loop (they share the stripe).
+      // Therefore this deletion marker is obsolete and can be dropped.
+      return kDrop;
+    } else if (ikey->sequence != 0) {
+      // For this user key no data exists in higher levels, every live
+      // snapshot can see this entry and all older entries for it are
+      // dropped.  The sequence number carries no information any more,
+      // so store it as zero: the repeated tag compresses far better
+      // than a unique one.
+      return kZeroSequence;
+    }
+  }
+  return kKeep;
+}
+
+// 判断给定的user_key是否可能出现在[output_level_ + 1， kNumLevels]的sst文件当中
+// 如果可能返回false, 如果不可能，返回true
+bool CompactionRules::IsBaseLevelForKey(const Slice& user_key) {
+  // Maybe use binary search to find right entry instead of linear search?
+  const Comparator* user_cmp = icmp_->user_comparator();
+  for (int lvl = output_level_ + 1; lvl < config::kNumLevels; lvl++) {
+    const std::vector<FileMetaData*>* files = deeper_[lvl];
+    if (files == NULL) {
+      continue;
+    }
+    for (; level_ptrs_[lvl] < files->size(); ) {
+      const FileMetaData* f = (*files)[level_ptrs_[lvl]];
+      if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
+        // We've advanced far enough
+        if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
+          // Key falls in this file's range, so definitely not base level
+          return false;
+        }
+        break;
+      }
+      level_ptrs_[lvl]++;
+    }
+  }
+  return true;
+}
+
+bool CompactionRules::ShouldStopBefore(const Slice& internal_key) {
+  if (!compaction_ || output_level_ + 1 >= config::kNumLevels ||
+      deeper_[output_level_ + 1] == NULL) {
+    return false;
+  }
+  // Scan to find earliest grandparent file that contains key.
+  const std::vector<FileMetaData*>& grandparents =
+      *deeper_[output_level_ + 1];
+  while (grandparent_index_ < grandparents.size() &&
+      icmp_->Compare(internal_key,
+                     grandparents[grandparent_index_]->largest.Encode()) > 0) {
+    if (seen_key_) {
+      overlapped_bytes_ += grandparents[grandparent_index_]->file_size;
+    }
+    grandparent_index_++;
+  }
+  seen_key_ = true;
+
+  if (overlapped_bytes_ > max_grandparent_overlap_bytes_) {
+    // Too much overlap for current output; start new output
+    overlapped_bytes_ = 0;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,97 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_COMPACTION_RULES_H_
+#define STORAGE_LEVELDB_DB_COMPACTION_RULES_H_
+
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+struct FileMetaData;
+
+// The rules that decide which entries a memtable flush or a compaction
+// writes, and where a compaction cuts its output files.  They are shared
+// by BuildTable(), DBImpl::DoCompactionWork() and RunCompactionJob(), so
+// that all three drop exactly the same entries.
+//
+// Entries must be passed in the order of the internal key comparator.
+class CompactionRules {
+ public:
+  enum Action {
+    kKeep,          // Write the entry
+    kDrop,          // No reader can observe the entry
+    kZeroSequence,  // Write the entry with sequence number zero
+    kCorrupt        // The key does not parse; write it so that the
+                    // error is not hidden
+  };
+
+  // Rules for a memtable flush.  "snapshots" holds the sequence numbers
+  // of all live snapshots in increasing order.  The levels below the
+  // output are unknown, so deletion markers are kept and sequence
+  // numbers are never zeroed.
+  CompactionRules(const InternalKeyComparator* icmp,
+                  const std::vector<SequenceNumber>& snapshots);
+
+  // Rules for a compaction whose outputs go to "output_level".  The
+  // files of each level below it must be passed to AddDeeperLevel().
+  CompactionRules(const InternalKeyComparator* icmp,
+                  const std::vector<SequenceNumber>& snapshots,
+                  int output_level,
+                  int64_t max_grandparent_overlap_bytes);
+
+  // Record the files of "level" (> output_level), sorted by key and
+  // disjoint.  Only files that overlap the inputs need to be included.
+  // *files must outlive *this.
+  void AddDeeperLevel(int level, const std::vector<FileMetaData*>* files);
+
+  // Return what to do with the next entry, whose key is "internal_key".
+  // Unless kCorrupt is returned, *ikey holds the parsed key.
+  Action Decide(const Slice& internal_key, ParsedInternalKey* ikey);
+
+  // Returns true iff the current output should end before the entry
+  // "internal_key", because it already overlaps too much of the level
+  // below output_level.  Must be called for every entry, including
+  // dropped ones.
+  bool ShouldStopBefore(const Slice& internal_key);
+
+ private:
+  // Returns true if no file below output_level may hold "user_key".
+  // Keys must be passed in increasing order.
+  bool IsBaseLevelForKey(const Slice& user_key);
+
+  const InternalKeyComparator* const icmp_;
+  const std::vector<SequenceNumber> snapshots_;
+
+  // Whether the levels below the output are known
+  const bool compaction_;
+  const int output_level_;
+  const int64_t max_grandparent_overlap_bytes_;
+  const std::vector<FileMetaData*>* deeper_[config::kNumLevels];
+
+  // State for implementing Decide()
+  std::string current_user_key_;
+  bool has_current_user_key_;
+  size_t last_stripe_for_key_;
+
+  // State for implementing IsBaseLevelForKey(): level_ptrs_[lvl] is the
+  // first file of level lvl that the last key did not sort after
+  size_t level_ptrs_[config::kNumLevels];
+
+  // State for implementing ShouldStopBefore()
+  size_t grandparent_index_;  // Index in deeper_[output_level_ + 1]
+  bool seen_key_;             // Some output key has been seen
+  int64_t overlapped_bytes_;  // Bytes of overlap between current output
+                              // and grandparent files
+
+  // No copying allowed
+  CompactionRules(const CompactionRules&);
+  void operator=(const CompactionRules&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_COMPACTION_RULES_H_
@@ -10,6 +10,7 @@
 #include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/table_factory.h"
 #include "leveldb/write_batch.h"
 #include "port/port.h"
 #include "util/crc32c.h"
@@ -30,6 +31,8 @@
 //      readseq       -- read N times sequentially
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
+//      readrandombatch -- read N times in random order, 16 keys per
+//                       DB::MultiGetAsync() call
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
@@ -111,6 +114,14 @@ static bool FLAGS_use_existing_db = false;
 // If true, reuse existing log/MANIFEST files when re-opening a database.
 static bool FLAGS_reuse_logs = false;
 
+// If true, write compaction output on a separate thread.
+static bool FLAGS_pipelined_compaction = false;
+
+// Format of the tables written: "block" (the default), "plain" or
+// "cuckoo".  To compare formats, run the same benchmarks with each, e.g.
+//    --benchmarks=fillrandom,compact,readrandom,readmissing
+static const char* FLAGS_table_format = "block";
+
 // Use the db with the following name.
 static const char* FLAGS_db = NULL;
 
@@ -318,6 +329,7 @@ class Benchmark {
  private:
   Cache* cache_;
   const FilterPolicy* filter_policy_;
+  TableFactory* table_factory_;
   DB* db_;
   int num_;
   int value_size_;
@@ -334,6 +346,7 @@ class Benchmark {
             FLAGS_value_size,
             static_cast<int>(FLAGS_value_size * FLAGS_compression_ratio + 0.5));
     fprintf(stdout, "Entries:    %d\n", num_);
+    fprintf(stdout, "Tables:     %s format\n", FLAGS_table_format);
     fprintf(stdout, "RawSize:    %.1f MB (estimated)\n",
             ((static_cast<int64_t>(kKeySize + FLAGS_value_size) * num_)
              / 1048576.0));
@@ -406,6 +419,7 @@ class Benchmark {
     filter_policy_(FLAGS_bloom_bits >= 0
                    ? NewBloomFilterPolicy(FLAGS_bloom_bits)
                    : NULL),
+    table_factory_(NULL),
     db_(NULL),
     num_(FLAGS_num),
     value_size_(FLAGS_value_size),
@@ -422,12 +436,18 @@ class Benchmark {
     if (!FLAGS_use_existing_db) {
       DestroyDB(FLAGS_db, Options());
     }
+    if (strcmp(FLAGS_table_format, "plain") == 0) {
+      table_factory_ = NewPlainTableFactory(16);
+    } else if (strcmp(FLAGS_table_format, "cuckoo") == 0) {
+      table_factory_ = NewCuckooTableFactory();
+    }
   }
 
   ~Benchmark() {
     delete db_;
     delete cache_;
     delete filter_policy_;
+    delete table_factory_;
   }
 
   void Run() {
@@ -490,6 +510,8 @@ class Benchmark {
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("readrandombatch")) {
+        method = &Benchmark::ReadRandomBatch;
       } else if (name == Slice("readmissing")) {
         method = &Benchmark::ReadMissing;
       } else if (name == Slice("seekrandom")) {
@@ -717,7 +739,9 @@ class Benchmark {
     options.block_size = FLAGS_block_size;
     options.max_open_files = FLAGS_open_files;
     options.filter_policy = filter_policy_;
+    options.table_factory = table_factory_;
     options.reuse_logs = FLAGS_reuse_logs;
+    options.pipelined_compaction = FLAGS_pipelined_compaction;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -815,6 +839,57 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  // Collects the results of one MultiGetAsync() call
+  struct BatchState {
+    port::Mutex mu;
+    port::CondVar cv;
+    int pending;
+    int found;
+    BatchState() : cv(&mu), pending(0), found(0) { }
+  };
+
+  static void BatchReadDone(void* arg, int index, const Status& s,
+                            const Slice& value) {
+    BatchState* state = reinterpret_cast<BatchState*>(arg);
+    MutexLock l(&state->mu);
+    if (s.ok()) {
+      state->found++;
+    }
+    state->pending--;
+    state->cv.Signal();
+  }
+
+  void ReadRandomBatch(ThreadState* thread) {
+    static const int kBatchSize = 16;
+    ReadOptions options;
+    char keys[kBatchSize][100];
+    Slice key_slices[kBatchSize];
+    BatchState state;
+    for (int i = 0; i < reads_; i += kBatchSize) {
+      const int n = (reads_ - i < kBatchSize) ? reads_ - i : kBatchSize;
+      for (int j = 0; j < n; j++) {
+        const int k = thread->rand.Next() % FLAGS_num;
+        snprintf(keys[j], sizeof(keys[j]), "%016d", k);
+        key_slices[j] = keys[j];
+      }
+      state.mu.Lock();
+      state.pending = n;
+      state.mu.Unlock();
+      db_->MultiGetAsync(options, n, key_slices, &BatchReadDone, &state);
+      state.mu.Lock();
+      while (state.pending > 0) {
+        state.cv.Wait();
+      }
+      state.mu.Unlock();
+      for (int j = 0; j < n; j++) {
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", state.found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -977,6 +1052,9 @@ int main(int argc, char** argv) {
     } else if (sscanf(argv[i], "--reuse_logs=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_reuse_logs = n;
+    } else if (sscanf(argv[i], "--pipelined_compaction=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_pipelined_compaction = n;
     } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
       FLAGS_num = n;
     } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
@@ -997,6 +1075,11 @@ int main(int argc, char** argv) {
       FLAGS_bloom_bits = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (strncmp(argv[i], "--table_format=", 15) == 0 &&
+               (strcmp(argv[i] + 15, "block") == 0 ||
+                strcmp(argv[i] + 15, "plain") == 0 ||
+                strcmp(argv[i] + 15, "cuckoo") == 0)) {
+      FLAGS_table_format = argv[i] + 15;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
@@ -11,7 +11,10 @@
 #include <stdio.h>
 #include <vector>
 #include "db/builder.h"
+#include "db/compaction_job.h"
+#include "db/compaction_rules.h"
 #include "db/db_iter.h"
+#include "db/delete_scheduler.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
 #include "db/log_reader.h"
@@ -20,8 +23,10 @@
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/compaction_service.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/memory_allocator.h"
 #include "leveldb/status.h"
 #include "leveldb/table.h"
 #include "leveldb/table_builder.h"
@@ -29,9 +34,11 @@
 #include "table/block.h"
 #include "table/merger.h"
 #include "table/two_level_iterator.h"
+#include "util/arena.h"
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/thread_pool.h"
 
 namespace leveldb {
 
@@ -43,19 +50,39 @@ struct DBImpl::Writer {
   WriteBatch* batch;  // 本次写入对应的WriteBatch
   bool sync;          // 本次写入数据对应的log是否立即刷盘
   bool done;          // 本次写入数据是否已经完成
+  bool waiting;       // Blocked on cv rather than spinning
   port::CondVar cv;   // 条件变量, 如果在此之前有其他Write正在写入，则等待
 
-  explicit Writer(port::Mutex* mu) : cv(mu) { }
+  // Read by the writer while it spins without holding the mutex.  Once
+  // "finished" is non-NULL the writer may return, so a thread that sets
+  // it must not touch the Writer afterwards.  "leader" is set when the
+  // writer reaches the front of the queue.
+  port::AtomicPointer finished;
+  port::AtomicPointer leader;
+
+  explicit Writer(port::Mutex* mu)
+      : waiting(false), cv(mu), finished(NULL), leader(NULL) { }
 };
 
+// Bounds for the write group size limit, and how long a group's log write
+// may take before the limit is lowered.
+static const size_t kMinGroupBytes = 128 << 10;
+static const size_t kMaxGroupBytes = 4 << 20;
+static const uint64_t kTargetGroupLogMicros = 1000;
+
+// How long a queued writer spins before blocking, and the bounds of the
+// score that decides whether it spins at all.
+static const uint64_t kWriterSpinMicros = 50;
+static const int kMaxWriterSpinScore = 16;
+static const uint32_t kWriterSpinProbeInterval = 64;
+
 struct DBImpl::CompactionState {
   Compaction* const compaction;
 
-  // Sequence numbers < smallest_snapshot are not significant since we
-  // will never have to service a snapshot below smallest_snapshot.
-  // Therefore if we have seen a sequence number S <= smallest_snapshot,
-  // we can drop all entries for the same key with sequence numbers < S.
-  SequenceNumber smallest_snapshot;
+  // Sequence numbers of the snapshots that were live when the compaction
+  // started, oldest first.  Snapshots taken later see the newest entry of
+  // every key in the inputs.  See CompactionRules.
+  std::vector<SequenceNumber> snapshots;
 
   // Files produced by compaction
   struct Output {
@@ -71,13 +98,20 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // Backing store for an output key whose sequence number was zeroed
+  std::string rewritten_key;
+
+  // Set for a manual compaction that may be cancelled
+  CompactionHandle* handle;
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        handle(NULL) {
   }
 };
 
@@ -98,6 +132,7 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.async_read_threads, 1,                          64);
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -127,12 +162,22 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       shutting_down_(NULL),
       bg_cv_(&mutex_),
       mem_(NULL),
+      mem_copy_(NULL),
       imm_(NULL),
       logfile_(NULL),
       logfile_number_(0),
       log_(NULL),
       seed_(0),
       tmp_batch_(new WriteBatch),
+      max_group_bytes_(1 << 20),
+      writer_spin_score_(kMaxWriterSpinScore),
+      writers_since_spin_(0),
+      delete_scheduler_(NULL),
+      read_pool_(NULL),
+      next_logfile_(NULL),
+      next_logfile_number_(0),
+      next_mem_(NULL),
+      prepare_scheduled_(false),
       bg_compaction_scheduled_(false),
       manual_compaction_(NULL) {
   has_imm_.Release_Store(NULL);
@@ -146,17 +191,40 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
 
   versions_ = new VersionSet(dbname_, &options_, table_cache_,
                              &internal_comparator_);
+
+  if (options_.delete_rate_bytes_per_sec > 0) {
+    delete_scheduler_ = new DeleteScheduler(env_, options_.info_log,
+                                            options_.delete_rate_bytes_per_sec,
+                                            options_.delete_truncate_step);
+  }
+  read_pool_ = new ThreadPool(env_, options_.async_read_threads);
 }
 
 DBImpl::~DBImpl() {
+  // Finish outstanding asynchronous lookups
+  delete read_pool_;
+
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_) {
+  while (bg_compaction_scheduled_ || prepare_scheduled_) {
     bg_cv_.Wait();
   }
   mutex_.Unlock();
 
+  for (size_t i = 0; i < logs_to_close_.size(); i++) {
+    delete logs_to_close_[i];
+  }
+  if (next_mem_ != NULL) {
+    // The prepared log file was never used
+    next_mem_->Unref();
+    delete next_logfile_;
+    env_->DeleteFile(LogFileName(dbname_, next_logfile_number_));
+  }
+
+  // Finish queued deletions while we still hold the lock
+  delete delete_scheduler_;
+
   if (db_lock_ != NULL) {
     env_->UnlockFile(db_lock_);
   }
@@ -225,10 +293,15 @@ void DBImpl::MaybeIgnoreError(Status* s) const {
   }
 }
 
-void DBImpl::DeleteObsoleteFiles() {
+void DBImpl::DeleteObsoleteFiles(bool full_scan) {
+  mutex_.AssertHeld();
   if (!bg_error_.ok()) {
     // After a background error, we don't know whether a new version may
     // or may not have been committed, so we cannot safely garbage collect.
+    // Drop the candidates instead of letting them pile up; the full scan
+    // done when the DB is opened again finds the files.
+    versions_->GetObsoleteFiles(&obsolete_tables_);
+    obsolete_tables_.clear();
     return;
   }
 
@@ -236,8 +309,46 @@ void DBImpl::DeleteObsoleteFiles() {
   std::set<uint64_t> live = pending_outputs_;
   versions_->AddLiveFiles(&live);
 
+  // Only files that may have become obsolete since the last call are
+  // examined: tables dropped from every version or never installed, and
+  // logs.  A full scan lists the whole directory instead, which also
+  // finds files left behind by earlier incarnations.
   std::vector<std::string> filenames;
-  env_->GetChildren(dbname_, &filenames); // Ignoring errors on purpose
+  if (full_scan) {
+    env_->GetChildren(dbname_, &filenames); // Ignoring errors on purpose
+  } else {
+    versions_->GetObsoleteFiles(&obsolete_tables_);
+    std::vector<uint64_t> candidates;
+    for (size_t i = 0; i < obsolete_tables_.size(); i++) {
+      if (live.find(obsolete_tables_[i]) == live.end()) {
+        candidates.push_back(obsolete_tables_[i]);
+      }
+    }
+    obsolete_tables_.clear();
+
+    // A table that is not live now never becomes live again, so whether
+    // its file exists can be checked without holding the mutex.
+    if (!candidates.empty()) {
+      mutex_.Unlock();
+      for (size_t i = 0; i < candidates.size(); i++) {
+        std::string fname = TableFileName(dbname_, candidates[i]);
+        if (!env_->FileExists(fname)) {
+          fname = SSTTableFileName(dbname_, candidates[i]);
+          if (!env_->FileExists(fname)) {
+            continue;
+          }
+        }
+        filenames.push_back(fname.substr(dbname_.size() + 1));
+      }
+      mutex_.Lock();
+    }
+    for (std::set<uint64_t>::const_iterator it = log_numbers_.begin();
+         it != log_numbers_.end(); ++it) {
+      filenames.push_back(LogFileName(dbname_, *it).substr(dbname_.size() + 1));
+    }
+  }
+
+  std::vector<std::string> files_to_delete;
   uint64_t number;
   FileType type;
   for (size_t i = 0; i < filenames.size(); i++) {
@@ -247,6 +358,11 @@ void DBImpl::DeleteObsoleteFiles() {
         case kLogFile:
           keep = ((number >= versions_->LogNumber()) ||
                   (number == versions_->PrevLogNumber()));
+          if (keep) {
+            log_numbers_.insert(number);
+          } else {
+            log_numbers_.erase(number);
+          }
           break;
         case kDescriptorFile:
           // Keep my manifest file, and any newer incarnations'
@@ -275,10 +391,26 @@ void DBImpl::DeleteObsoleteFiles() {
         Log(options_.info_log, "Delete type=%d #%lld\n",
             int(type),
             static_cast<unsigned long long>(number));
-        env_->DeleteFile(dbname_ + "/" + filenames[i]);
+        files_to_delete.push_back(dbname_ + "/" + filenames[i]);
       }
     }
   }
+
+  if (delete_scheduler_ != NULL) {
+    for (size_t i = 0; i < files_to_delete.size(); i++) {
+      delete_scheduler_->Schedule(files_to_delete[i]);
+    }
+  } else if (!files_to_delete.empty()) {
+    // While deleting all files unblock other threads. All files being
+    // deleted have unique names which will not collide with newly
+    // created files and are therefore safe to delete without holding
+    // the mutex.
+    mutex_.Unlock();
+    for (size_t i = 0; i < files_to_delete.size(); i++) {
+      env_->DeleteFile(files_to_delete[i]);
+    }
+    mutex_.Lock();
+  }
 }
 
 // 校验db目录下的文件是否完整，以及如果有.log文件的话，将其恢复到
@@ -498,6 +630,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
         mem_ = new MemTable(internal_comparator_);
         mem_->Ref();
       }
+      mem_copy_.Release_Store(mem_);
     }
   }
 
@@ -516,52 +649,83 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
                                 Version* base) {
   mutex_.AssertHeld();
-  const uint64_t start_micros = env_->NowMicros();
-  FileMetaData meta;
-  meta.number = versions_->NewFileNumber();
-  pending_outputs_.insert(meta.number);
   Iterator* iter = mem->NewIterator();
-  Log(options_.info_log, "Level-0 table #%llu: started",
-      (unsigned long long) meta.number);
-
-  Status s;
-  {
-    mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
-    mutex_.Lock();
+  iter->SeekToFirst();
+
+  // Versions of a key that are overwritten inside the memtable and are
+  // not needed by any live snapshot are dropped while building the table.
+  // Snapshots taken after this point see only the newest versions.
+  std::vector<SequenceNumber> snapshots;
+  snapshots_.GetAll(&snapshots);
+
+  // If requested, cut the output at the file boundaries of the first
+  // non-empty level below level-0.  base is referenced by the caller, so
+  // its files stay alive while the mutex is released.
+  std::vector<FileMetaData*> partition;
+  uint64_t min_size = 0;
+  if (base != NULL && options_.partition_memtable_output) {
+    for (int level = 1; level <= config::kMaxMemCompactLevel; level++) {
+      if (base->NumFiles(level) > 0) {
+        partition = base->LevelFiles(level);
+        break;
+      }
+    }
+    min_size = options_.max_file_size / 2;
   }
 
-  Log(options_.info_log, "Level-0 table #%llu: %lld bytes %s",
-      (unsigned long long) meta.number,
-      (unsigned long long) meta.file_size,
-      s.ToString().c_str());
-  delete iter;
-  pending_outputs_.erase(meta.number);
+  Status s;
+  std::vector<uint64_t> outputs;
+  do {
+    const uint64_t start_micros = env_->NowMicros();
+    FileMetaData meta;
+    meta.number = versions_->NewFileNumber();
+    pending_outputs_.insert(meta.number);
+    outputs.push_back(meta.number);
+    Log(options_.info_log, "Level-0 table #%llu: started",
+        (unsigned long long) meta.number);
 
+    {
+      mutex_.Unlock();
+      s = BuildPartitionedTable(dbname_, env_, options_, table_cache_, iter,
+                                snapshots, partition, min_size, &meta);
+      mutex_.Lock();
+    }
 
-  // Note that if file_size is zero, the file has been deleted and
-  // should not be added to the manifest.
-  int level = 0;
-  if (s.ok() && meta.file_size > 0) {
-    const Slice min_user_key = meta.smallest.user_key();
-    const Slice max_user_key = meta.largest.user_key();
-    if (base != NULL) {
-      // 我们选择把刚生成的sst文件放到更加高的level中(如果符合条件的话，如果
-      // 新生成的sst文件和level 1层的sst文件有overlap的话，那么就只能将其
-      // 放在level 0层了
-      level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+    Log(options_.info_log, "Level-0 table #%llu: %lld bytes %s",
+        (unsigned long long) meta.number,
+        (unsigned long long) meta.file_size,
+        s.ToString().c_str());
+
+    // Note that if file_size is zero, the file has been deleted and
+    // should not be added to the manifest.
+    int level = 0;
+    if (s.ok() && meta.file_size > 0) {
+      const Slice min_user_key = meta.smallest.user_key();
+      const Slice max_user_key = meta.largest.user_key();
+      if (base != NULL) {
+        // 我们选择把刚生成的sst文件放到更加高的level中(如果符合条件的话，如果
+        // 新生成的sst文件和level 1层的sst文件有overlap的话，那么就只能将其
+        // 放在level 0层了
+        level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+      }
+      // 通过PickLevelFromMemTableOutput方法我们可以确定将当前新生成的sst文件
+      // 应该插入到哪一个level当中，这时候我们将level信息以及该文件的一些meta
+      // 信息记录到edit当中, 方便后续同步到version set当中
+      edit->AddFile(level, meta.number, meta.file_size,
+                    meta.smallest, meta.largest);
     }
-    // 通过PickLevelFromMemTableOutput方法我们可以确定将当前新生成的sst文件
-    // 应该插入到哪一个level当中，这时候我们将level信息以及该文件的一些meta
-    // 信息记录到edit当中, 方便后续同步到version set当中
-    edit->AddFile(level, meta.number, meta.file_size,
-                  meta.smallest, meta.largest);
-  }
 
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros;
-  stats.bytes_written = meta.file_size;
-  stats_[level].Add(stats);
+    CompactionStats stats;
+    stats.micros = env_->NowMicros() - start_micros;
+    stats.bytes_written = meta.file_size;
+    stats_[level].Add(stats);
+  } while (s.ok() && iter->Valid());
+
+  delete iter;
+  for (size_t i = 0; i < outputs.size(); i++) {
+    pending_outputs_.erase(outputs[i]);
+    obsolete_tables_.push_back(outputs[i]);  // In case it was not installed
+  }
   return s;
 }
 
@@ -592,6 +756,18 @@ void DBImpl::CompactMemTable() {
     imm_->Unref();
     imm_ = NULL;
     has_imm_.Release_Store(NULL);
+
+    // Close the logs that held the flushed data; closing flushes their
+    // buffers, which is why MakeRoomForWrite() leaves it to us.
+    if (!logs_to_close_.empty()) {
+      std::vector<WritableFile*> to_close;
+      to_close.swap(logs_to_close_);
+      mutex_.Unlock();
+      for (size_t i = 0; i < to_close.size(); i++) {
+        delete to_close[i];
+      }
+      mutex_.Lock();
+    }
     DeleteObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -599,6 +775,11 @@ void DBImpl::CompactMemTable() {
 }
 
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
+  CompactRange(begin, end, NULL);
+}
+
+Status DBImpl::CompactRange(const Slice* begin, const Slice* end,
+                            CompactionHandle* handle) {
   int max_level_with_files = 1;
   {
     MutexLock l(&mutex_);
@@ -610,13 +791,22 @@ void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
       }
     }
   }
-  TEST_CompactMemTable(); // TODO(sanjay): Skip if memtable does not overlap
-  for (int level = 0; level < max_level_with_files; level++) {
-    TEST_CompactRange(level, begin, end);
+  if (handle != NULL && handle->IsCancelled()) {
+    return Status::Incomplete("manual compaction cancelled");
   }
+  Status s = TEST_CompactMemTable(); // TODO(sanjay): Skip if memtable does not overlap
+  for (int level = 0; s.ok() && level < max_level_with_files; level++) {
+    s = ManualCompact(level, begin, end, handle);
+  }
+  return s;
 }
 
 void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
+  ManualCompact(level, begin, end, NULL);
+}
+
+Status DBImpl::ManualCompact(int level, const Slice* begin, const Slice* end,
+                             CompactionHandle* handle) {
   assert(level >= 0);
   assert(level + 1 < config::kNumLevels);
 
@@ -625,6 +815,7 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   ManualCompaction manual;
   manual.level = level;
   manual.done = false;
+  manual.handle = handle;
   if (begin == NULL) {
     manual.begin = NULL;
   } else {
@@ -648,6 +839,10 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   MutexLock l(&mutex_);
   while (!manual.done && !shutting_down_.Acquire_Load() && bg_error_.ok()) {
     if (manual_compaction_ == NULL) {  // Idle
+      if (handle != NULL && handle->IsCancelled()) {
+        manual.status = Status::Incomplete("manual compaction cancelled");
+        break;
+      }
       manual_compaction_ = &manual;
       MaybeScheduleCompaction();
     } else {  // Running either my compaction or another compaction.
@@ -658,6 +853,10 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
     // Cancel my manual compaction since we aborted early for some reason.
     manual_compaction_ = NULL;
   }
+  if (manual.status.ok() && !bg_error_.ok()) {
+    manual.status = bg_error_;
+  }
+  return manual.status;
 }
 
 Status DBImpl::TEST_CompactMemTable() {
@@ -703,6 +902,65 @@ void DBImpl::MaybeScheduleCompaction() {
   }
 }
 
+void DBImpl::MaybeSchedulePrepare() {
+  mutex_.AssertHeld();
+  if (!prepare_scheduled_ &&
+      next_mem_ == NULL &&
+      !shutting_down_.Acquire_Load() &&
+      bg_error_.ok()) {
+    // Runs on its own thread so that a long compaction cannot delay it
+    prepare_scheduled_ = true;
+    env_->StartThread(&DBImpl::BGPrepareWork, this);
+  }
+}
+
+void DBImpl::BGPrepareWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->PrepareNextMemTable();
+}
+
+void DBImpl::PrepareNextMemTable() {
+  MutexLock l(&mutex_);
+  assert(prepare_scheduled_);
+  const bool prepare = (next_mem_ == NULL &&
+                        !shutting_down_.Acquire_Load() &&
+                        bg_error_.ok());
+  const uint64_t number = prepare ? versions_->NewFileNumber() : 0;
+
+  mutex_.Unlock();
+  Status s;
+  WritableFile* lfile = NULL;
+  MemTable* mem = NULL;
+  if (prepare) {
+    s = env_->NewWritableFile(LogFileName(dbname_, number), &lfile);
+    if (s.ok()) {
+      mem = new MemTable(internal_comparator_);
+      mem->Ref();
+    }
+  }
+  mutex_.Lock();
+
+  if (prepare) {
+    if (s.ok() && number < logfile_number_) {
+      // MakeRoomForWrite() switched to a log of its own meanwhile; ours
+      // would be older than the current one and cannot be used.
+      mem->Unref();
+      delete lfile;
+      env_->DeleteFile(LogFileName(dbname_, number));
+    } else if (s.ok()) {
+      next_logfile_ = lfile;
+      next_logfile_number_ = number;
+      next_mem_ = mem;
+      log_numbers_.insert(number);
+    } else {
+      // MakeRoomForWrite() will try again and report the error
+      Log(options_.info_log, "Preparing log file failed: %s",
+          s.ToString().c_str());
+    }
+  }
+  prepare_scheduled_ = false;
+  bg_cv_.SignalAll();
+}
+
 void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
@@ -783,8 +1041,11 @@ void DBImpl::BackgroundCompaction() {
         versions_->LevelSummary(&tmp));
   } else {
     CompactionState* compact = new CompactionState(c);
+    if (is_manual) {
+      compact->handle = manual_compaction_->handle;
+    }
     status = DoCompactionWork(compact);
-    if (!status.ok()) {
+    if (!status.ok() && !status.IsIncomplete()) {
       RecordBackgroundError(status);
     }
     CleanupCompaction(compact);
@@ -797,6 +1058,8 @@ void DBImpl::BackgroundCompaction() {
     // Done
   } else if (shutting_down_.Acquire_Load()) {
     // Ignore compaction errors found during shutting down
+  } else if (status.IsIncomplete()) {
+    Log(options_.info_log, "Manual compaction cancelled");
   } else {
     Log(options_.info_log,
         "Compaction error: %s", status.ToString().c_str());
@@ -806,6 +1069,7 @@ void DBImpl::BackgroundCompaction() {
     ManualCompaction* m = manual_compaction_;
     if (!status.ok()) {
       m->done = true;
+      m->status = status;
     }
     if (!m->done) {
       // We only compacted part of the requested range.  Update *m
@@ -830,6 +1094,7 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
     pending_outputs_.erase(out.number);
+    obsolete_tables_.push_back(out.number);  // In case it was not installed
   }
   delete compact;
 }
@@ -860,7 +1125,7 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
 }
 
 Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
-                                          Iterator* input) {
+                                          const Status& input_status) {
   assert(compact != NULL);
   assert(compact->outfile != NULL);
   assert(compact->builder != NULL);
@@ -869,7 +1134,7 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   assert(output_number != 0);
 
   // Check for iterator errors
-  Status s = input->status();
+  Status s = input_status;
   const uint64_t current_entries = compact->builder->NumEntries();
   if (s.ok()) {
     s = compact->builder->Finish();
@@ -911,6 +1176,160 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   return s;
 }
 
+Status DBImpl::AddCompactionOutput(CompactionState* compact,
+                                   const Slice& key, const Slice& value,
+                                   bool stop_before) {
+  Status s;
+  if (stop_before && compact->builder != NULL) {
+    s = FinishCompactionOutputFile(compact, Status::OK());
+    if (!s.ok()) {
+      return s;
+    }
+  }
+
+  // Open output file if necessary
+  // 两种情况builder为NULL
+  // 1. 这次compact还没有创建过Builder
+  // 2. 这次compact已经完成了前一个sst文件, 这时候会把之前的
+  // builder给delete掉，并且令其为NULL
+  if (compact->builder == NULL) {
+    s = OpenCompactionOutputFile(compact);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  // NumEntries为0表示之前没有往这个builder里面添加过key/value
+  // 所以第一个添加的key/value值是最小的
+  if (compact->builder->NumEntries() == 0) {
+    compact->current_output()->smallest.DecodeFrom(key);
+  }
+  compact->current_output()->largest.DecodeFrom(key);
+  compact->builder->Add(key, value);
+
+  // Close output file if it is big enough
+  // 如果当前TableBuilder里面的内容已经大于等于MaxOutputFileSize(),
+  // 则为当前的sst文件末尾添加index block和footer等信息
+  // 在Leveldb中好像每一层的sst文件大小都是一样的？而在Rocksdb中sst
+  // 文件的大小是根据target_file_size_base和target_file_size_multipier
+  // 进行确认的
+  if (compact->builder->FileSize() >=
+      compact->compaction->MaxOutputFileSize()) {
+    s = FinishCompactionOutputFile(compact, Status::OK());
+  }
+  return s;
+}
+
+// Entries kept by DoCompactionWork() are handed to a separate output
+// thread in batches when options_.pipelined_compaction is set, so that
+// reading and merging the inputs overlaps with building, compressing
+// and writing the output tables.  Each batch holds a sequence of
+//    stop_before: char (1 if the output should be cut before this entry)
+//    key: length-prefixed internal key
+//    value: length-prefixed value
+// At most kMaxQueuedBatches batches are queued, which bounds the memory
+// held by the pipeline.
+struct DBImpl::CompactionPipeline {
+  static const size_t kBatchSize = 256 << 10;
+  static const size_t kMaxQueuedBatches = 4;
+
+  DBImpl* const db;
+  CompactionState* const compact;
+
+  port::Mutex mu;
+  port::CondVar cv;                 // Signalled on every state change
+  std::deque<std::string*> batches;
+  bool input_done;                  // No more batches will be added
+  bool output_done;                 // Output thread has exited
+  Status status;                    // First error hit by the output thread
+
+  CompactionPipeline(DBImpl* d, CompactionState* c)
+      : db(d), compact(c), cv(&mu), input_done(false), output_done(false) { }
+
+  // Queue *batch for the output thread, waiting while the queue is full.
+  // Takes ownership of batch.  Returns the output thread's error, if any.
+  Status Push(std::string* batch) {
+    MutexLock l(&mu);
+    while (status.ok() && batches.size() >= kMaxQueuedBatches) {
+      cv.Wait();
+    }
+    if (status.ok()) {
+      batches.push_back(batch);
+      cv.SignalAll();
+    } else {
+      delete batch;
+    }
+    return status;
+  }
+
+  // Tell the output thread that no more batches follow and wait for it to
+  // write everything queued so far.
+  Status Finish() {
+    MutexLock l(&mu);
+    input_done = true;
+    cv.SignalAll();
+    while (!output_done) {
+      cv.Wait();
+    }
+    return status;
+  }
+};
+
+void DBImpl::CompactionOutputWork(void* arg) {
+  CompactionPipeline* pipe = reinterpret_cast<CompactionPipeline*>(arg);
+  pipe->db->RunCompactionOutput(pipe);
+}
+
+void DBImpl::RunCompactionOutput(CompactionPipeline* pipe) {
+  Status s;
+  while (true) {
+    std::string* batch = NULL;
+    {
+      MutexLock l(&pipe->mu);
+      while (pipe->batches.empty() && !pipe->input_done) {
+        pipe->cv.Wait();
+      }
+      if (pipe->batches.empty()) {
+        break;
+      }
+      batch = pipe->batches.front();
+      pipe->batches.pop_front();
+      pipe->cv.SignalAll();
+    }
+
+    Slice input(*batch);
+    Slice key, value;
+    while (s.ok() && !input.empty()) {
+      const bool stop_before = (input[0] != 0);
+      input.remove_prefix(1);
+      if (!GetLengthPrefixedSlice(&input, &key) ||
+          !GetLengthPrefixedSlice(&input, &value)) {
+        s = Status::Corruption("bad compaction batch");
+        break;
+      }
+      s = AddCompactionOutput(pipe->compact, key, value, stop_before);
+    }
+    delete batch;
+
+    if (!s.ok()) {
+      // Discard queued work and make the compaction thread stop.
+      MutexLock l(&pipe->mu);
+      pipe->status = s;
+      while (!pipe->batches.empty()) {
+        delete pipe->batches.front();
+        pipe->batches.pop_front();
+      }
+      while (!pipe->input_done) {
+        pipe->cv.SignalAll();
+        pipe->cv.Wait();
+      }
+      break;
+    }
+  }
+
+  MutexLock l(&pipe->mu);
+  pipe->output_done = true;
+  pipe->cv.SignalAll();
+}
 
 Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   mutex_.AssertHeld();
@@ -935,6 +1354,149 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
 }
 
+namespace {
+// A call to a CompactionService made on a separate thread, so that the
+// background thread stays free to compact memtables in the meantime.
+struct ServiceCall {
+  CompactionService* service;
+  std::string dbname;
+  std::string job;
+  std::string result;
+  Status status;
+  port::Mutex* mu;
+  port::CondVar* cv;
+  bool done;            // Protected by *mu
+};
+
+static void RunServiceCall(void* arg) {
+  ServiceCall* call = reinterpret_cast<ServiceCall*>(arg);
+  call->status = call->service->Compact(call->dbname, call->job,
+                                        &call->result);
+  MutexLock l(call->mu);
+  call->done = true;
+  call->cv->SignalAll();
+}
+}  // namespace
+
+Status DBImpl::RunCompactionService(CompactionState* compact,
+                                    int64_t* imm_micros) {
+  mutex_.AssertHeld();
+  Compaction* const c = compact->compaction;
+  const int level = c->level();
+  CompactionJob job;
+  job.comparator = user_comparator()->Name();
+  if (options_.filter_policy != NULL) {
+    job.filter_policy = options_.filter_policy->Name();
+  }
+  job.level = level;
+  job.snapshots = compact->snapshots;
+  job.max_output_file_size = c->MaxOutputFileSize();
+  job.max_grandparent_overlap_bytes = c->MaxGrandParentOverlap();
+  job.compression = options_.compression;
+  job.block_size = options_.block_size;
+  job.block_restart_interval = options_.block_restart_interval;
+  job.large_value_threshold = options_.large_value_threshold;
+  job.block_align = options_.block_align;
+
+  InternalKey smallest, largest;
+  uint64_t input_bytes = 0;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < c->num_input_files(which); i++) {
+      const FileMetaData* f = c->input(which, i);
+      job.inputs[which].push_back(*f);
+      input_bytes += f->file_size;
+      if (which == 0 && i == 0) {
+        smallest = f->smallest;
+        largest = f->largest;
+      } else {
+        if (internal_comparator_.Compare(f->smallest, smallest) < 0) {
+          smallest = f->smallest;
+        }
+        if (internal_comparator_.Compare(f->largest, largest) > 0) {
+          largest = f->largest;
+        }
+      }
+    }
+  }
+  std::vector<FileMetaData*> overlaps;
+  for (int lvl = level + 2; lvl < config::kNumLevels; lvl++) {
+    c->input_version()->GetOverlappingInputs(lvl, &smallest, &largest,
+                                             &overlaps);
+    for (size_t i = 0; i < overlaps.size(); i++) {
+      job.deeper[lvl].push_back(*overlaps[i]);
+    }
+  }
+
+  // Reserve file numbers for the outputs.  Outputs are cut when they
+  // reach the size limit or, at most once per grandparent file, when
+  // they overlap too much of the grandparent level; leave ample slack
+  // since a job that runs out of numbers fails.
+  job.num_output_numbers = 2 * (input_bytes / job.max_output_file_size + 1);
+  if (level + 2 < config::kNumLevels) {
+    job.num_output_numbers += job.deeper[level + 2].size();
+  }
+  for (uint64_t i = 0; i < job.num_output_numbers; i++) {
+    const uint64_t number = versions_->NewFileNumber();
+    if (i == 0) {
+      job.first_output_number = number;
+    }
+    pending_outputs_.insert(number);
+  }
+
+  ServiceCall call;
+  call.service = options_.compaction_service;
+  call.dbname = dbname_;
+  job.EncodeTo(&call.job);
+  call.mu = &mutex_;
+  call.cv = &bg_cv_;
+  call.done = false;
+  env_->StartThread(&RunServiceCall, &call);
+  while (!call.done) {
+    // Keep compacting memtables while the service runs
+    if (imm_ != NULL && bg_error_.ok()) {
+      const uint64_t imm_start = env_->NowMicros();
+      CompactMemTable();
+      bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+      *imm_micros += (env_->NowMicros() - imm_start);
+    } else {
+      bg_cv_.Wait();
+    }
+  }
+
+  Status s = call.status;
+  CompactionJobResult result;
+  if (s.ok()) {
+    s = result.DecodeFrom(call.result);
+  }
+  for (size_t i = 0; s.ok() && i < result.outputs.size(); i++) {
+    const uint64_t number = result.outputs[i].number;
+    if (number < job.first_output_number ||
+        number - job.first_output_number >= job.num_output_numbers) {
+      s = Status::Corruption("compaction service produced unexpected file");
+    }
+  }
+
+  // Unused numbers are released here, outputs by CleanupCompaction()
+  for (uint64_t i = 0; i < job.num_output_numbers; i++) {
+    pending_outputs_.erase(job.first_output_number + i);
+    obsolete_tables_.push_back(job.first_output_number + i);
+  }
+  if (s.ok()) {
+    for (size_t i = 0; i < result.outputs.size(); i++) {
+      const FileMetaData& f = result.outputs[i];
+      CompactionState::Output out;
+      out.number = f.number;
+      out.file_size = f.file_size;
+      out.smallest = f.smallest;
+      out.largest = f.largest;
+      compact->outputs.push_back(out);
+      compact->total_bytes += f.file_size;
+      pending_outputs_.insert(f.number);
+    }
+  }
+  return s;
+}
+
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
   int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
@@ -948,23 +1510,47 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
   assert(compact->builder == NULL);
   assert(compact->outfile == NULL);
-  if (snapshots_.empty()) {
-    compact->smallest_snapshot = versions_->LastSequence();
-  } else {
-    compact->smallest_snapshot = snapshots_.oldest()->number_;
+  snapshots_.GetAll(&compact->snapshots);
+
+  // Outputs of a compaction run by the service are installed below like
+  // local ones; if the service fails, compact locally instead.
+  bool by_service = false;
+  if (options_.compaction_service != NULL) {
+    Status s = RunCompactionService(compact, &imm_micros);
+    if (s.ok()) {
+      by_service = true;
+    } else {
+      Log(options_.info_log, "Compaction service failed: %s",
+          s.ToString().c_str());
+    }
   }
 
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
+  Iterator* input = by_service ? NewEmptyIterator() :
+      versions_->MakeInputIterator(compact->compaction);
   input->SeekToFirst();
   Status status;
   ParsedInternalKey ikey;
-  std::string current_user_key;
-  bool has_current_user_key = false;
-  SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  CompactionRules rules(&internal_comparator_, compact->snapshots,
+                        compact->compaction->level() + 1,
+                        compact->compaction->MaxGrandParentOverlap());
+  compact->compaction->AddDeeperLevels(&rules);
+  bool stop_before = false;
+  CompactionPipeline* pipe = NULL;
+  std::string* batch = NULL;
+  if (options_.pipelined_compaction && !by_service) {
+    pipe = new CompactionPipeline(this, compact);
+    env_->StartThread(&DBImpl::CompactionOutputWork, pipe);
+  }
+  bool cancelled = false;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
+    if (compact->handle != NULL && compact->handle->IsCancelled()) {
+      cancelled = true;
+      break;
+    }
+
     // Prioritize immutable compaction work
     if (has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = env_->NowMicros();
@@ -978,107 +1564,77 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     }
 
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
-        compact->builder != NULL) {
-      status = FinishCompactionOutputFile(compact, input);
-      if (!status.ok()) {
-        break;
-      }
+    if (rules.ShouldStopBefore(key)) {
+      // Cut the output before the next entry that is kept
+      stop_before = true;
     }
 
     // Handle key/value, add to state, etc.
-    bool drop = false;
-    if (!ParseInternalKey(key, &ikey)) {
-      // Do not hide error keys
-      current_user_key.clear();
-      has_current_user_key = false;
-      last_sequence_for_key = kMaxSequenceNumber;
-    } else {
-      if (!has_current_user_key ||
-          user_comparator()->Compare(ikey.user_key,
-                                     Slice(current_user_key)) != 0) {
-        // First occurrence of this user key
-        current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
-        has_current_user_key = true;
-        last_sequence_for_key = kMaxSequenceNumber;
-      }
-
-      if (last_sequence_for_key <= compact->smallest_snapshot) {
-        // Hidden by an newer entry for same user key
-        drop = true;    // (A)
-      } else if (ikey.type == kTypeDeletion &&
-                 ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
-        // 当前记录带有删除标记
-        // 并且当前记录的sequence，小于快照的序号
-        // 最重要的一点是当前的user_key，在[level_ + 2， kNumLevels]层没有
-        // user_key对应的记录(当前参加compact的是第level和level + 1层)
-        //
-        // For this user key:
-        // (1) there is no data in higher levels
-        // (2) data in lower levels will have larger sequence numbers
-        // (3) data in layers that are being compacted here and have
-        //     smaller sequence numbers will be dropped in the next
-        //     few iterations of this loop (by rule (A) above).
-        // Therefore this deletion marker is obsolete and can be dropped.
-        drop = true;
-      }
-
-      last_sequence_for_key = ikey.sequence;
-    }
+    const CompactionRules::Action action = rules.Decide(key, &ikey);
 #if 0
     Log(options_.info_log,
-        "  Compact: %s, seq %d, type: %d %d, drop: %d, is_base: %d, "
-        "%d smallest_snapshot: %d",
+        "  Compact: %s, seq %d, type: %d %d, action: %d",
         ikey.user_key.ToString().c_str(),
-        (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
-        (int)last_sequence_for_key, (int)compact->smallest_snapshot);
+        (int)ikey.sequence, ikey.type, kTypeValue, action);
 #endif
 
-    if (!drop) {
-      // Open output file if necessary
-      // 两种情况builder为NULL
-      // 1. 这次compact还没有创建过Builder
-      // 2. 这次compact已经完成了前一个sst文件, 这时候会把之前的
-      // builder给delete掉，并且令其为NULL
-      if (compact->builder == NULL) {
-        status = OpenCompactionOutputFile(compact);
-        if (!status.ok()) {
-          break;
-        }
+    if (action != CompactionRules::kDrop) {
+      if (action == CompactionRules::kZeroSequence) {
+        compact->rewritten_key.clear();
+        AppendInternalKey(&compact->rewritten_key,
+                          ParsedInternalKey(ikey.user_key, 0, ikey.type));
+        key = compact->rewritten_key;
       }
-      // NumEntries为0表示之前没有往这个builder里面添加过key/value
-      // 所以第一个添加的key/value值是最小的
-      if (compact->builder->NumEntries() == 0) {
-        compact->current_output()->smallest.DecodeFrom(key);
-      }
-      compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
-
-      // Close output file if it is big enough
-      // 如果当前TableBuilder里面的内容已经大于等于MaxOutputFileSize(),
-      // 则为当前的sst文件末尾添加index block和footer等信息
-      // 在Leveldb中好像每一层的sst文件大小都是一样的？而在Rocksdb中sst
-      // 文件的大小是根据target_file_size_base和target_file_size_multipier
-      // 进行确认的
-      if (compact->builder->FileSize() >=
-          compact->compaction->MaxOutputFileSize()) {
-        status = FinishCompactionOutputFile(compact, input);
-        if (!status.ok()) {
-          break;
+      if (pipe != NULL) {
+        if (batch == NULL) {
+          batch = new std::string;
+        }
+        batch->push_back(stop_before ? 1 : 0);
+        PutLengthPrefixedSlice(batch, key);
+        PutLengthPrefixedSlice(batch, input->value());
+        if (batch->size() >= CompactionPipeline::kBatchSize) {
+          status = pipe->Push(batch);
+          batch = NULL;
         }
+      } else {
+        status = AddCompactionOutput(compact, key, input->value(),
+                                     stop_before);
+      }
+      stop_before = false;
+      if (!status.ok()) {
+        break;
       }
     }
 
     input->Next();
   }
 
+  if (pipe != NULL) {
+    // Drain the pipeline; the output thread is gone once Finish() returns.
+    if (batch != NULL) {
+      if (status.ok()) {
+        status = pipe->Push(batch);
+      } else {
+        delete batch;
+      }
+      batch = NULL;
+    }
+    Status output_status = pipe->Finish();
+    if (status.ok()) {
+      status = output_status;
+    }
+    delete pipe;
+    pipe = NULL;
+  }
+
   if (status.ok() && shutting_down_.Acquire_Load()) {
     status = Status::IOError("Deleting DB during compaction");
   }
+  if (status.ok() && cancelled) {
+    status = Status::Incomplete("manual compaction cancelled");
+  }
   if (status.ok() && compact->builder != NULL) {
-    status = FinishCompactionOutputFile(compact, input);
+    status = FinishCompactionOutputFile(compact, input->status());
   }
   if (status.ok()) {
     status = input->status();
@@ -1103,7 +1659,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (status.ok()) {
     status = InstallCompactionResults(compact);
   }
-  if (!status.ok()) {
+  if (!status.ok() && !cancelled) {
     RecordBackgroundError(status);
   }
   VersionSet::LevelSummaryStorage tmp;
@@ -1120,6 +1676,7 @@ struct IterState {
   MemTable* imm;
 };
 
+// arg2 is non-NULL if the state was placed in an Arena
 static void CleanupIteratorState(void* arg1, void* arg2) {
   IterState* state = reinterpret_cast<IterState*>(arg1);
   state->mu->Lock();
@@ -1127,14 +1684,25 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
   if (state->imm != NULL) state->imm->Unref();
   state->version->Unref();
   state->mu->Unlock();
-  delete state;
+  if (arg2 == NULL) {
+    delete state;
+  }
 }
 }  // namespace
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
-                                      uint32_t* seed) {
-  IterState* cleanup = new IterState;
+                                      uint32_t* seed,
+                                      Arena* arena,
+                                      const MemTable** mem,
+                                      const Version** version) {
+  IterState* cleanup;
+  if (arena != NULL) {
+    cleanup = reinterpret_cast<IterState*>(
+        arena->AllocateAligned(sizeof(IterState)));
+  } else {
+    cleanup = new IterState;
+  }
   mutex_.Lock();
   // 创建迭代器的时候会获取到LastSequence,
   // 然后在迭代的过程中会对遍历的record进行解析,
@@ -1152,28 +1720,39 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
   // 一个Iterator,
   // 其他Level每层各一个Iterator
   std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
+  list.push_back(mem_->NewIterator(arena));
   mem_->Ref();
   if (imm_ != NULL) {
-    list.push_back(imm_->NewIterator());
+    list.push_back(imm_->NewIterator(arena));
     imm_->Ref();
   }
-  versions_->current()->AddIterators(options, &list);
+  versions_->current()->AddIterators(options, &list, arena);
   Iterator* internal_iter =
-      NewMergingIterator(&internal_comparator_, &list[0], list.size());
+      NewMergingIterator(&internal_comparator_, &list[0], list.size(), arena);
   versions_->current()->Ref();
 
   cleanup->mu = &mutex_;
   cleanup->mem = mem_;
   cleanup->imm = imm_;
   cleanup->version = versions_->current();
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
+  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, arena);
+  if (mem != NULL) *mem = mem_;
+  if (version != NULL) *version = versions_->current();
 
   *seed = ++seed_;
   mutex_.Unlock();
   return internal_iter;
 }
 
+SequenceNumber DBImpl::LatestSequence() const {
+  return versions_->AcquireLastSequence();
+}
+
+bool DBImpl::IsCurrent(const MemTable* mem, const Version* version) const {
+  return mem_copy_.Acquire_Load() == mem &&
+         (version == NULL || versions_->AcquireCurrent() == version);
+}
+
 Iterator* DBImpl::TEST_NewInternalIterator() {
   SequenceNumber ignored;
   uint32_t ignored_seed;
@@ -1185,9 +1764,47 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+void DBImpl::TEST_WaitForDeletions() {
+  if (delete_scheduler_ != NULL) {
+    delete_scheduler_->WaitForEmpty();
+  }
+}
+
+uint64_t DBImpl::TEST_PreparedLogNumber() {
+  MutexLock l(&mutex_);
+  while (prepare_scheduled_) {
+    bg_cv_.Wait();
+  }
+  return (next_mem_ != NULL) ? next_logfile_number_ : 0;
+}
+
 Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
+  return GetImpl(options, key, 0, ~static_cast<uint64_t>(0), value);
+}
+
+Status DBImpl::GetRange(const ReadOptions& options, const Slice& key,
+                        uint64_t offset, uint64_t length,
+                        std::string* value) {
+  return GetImpl(options, key, offset, length, value);
+}
+
+// Replaces *value with its bytes [offset, offset+length)
+static void TrimToRange(uint64_t offset, uint64_t length, std::string* value) {
+  if (offset >= value->size()) {
+    value->clear();
+  } else {
+    value->erase(0, offset);
+    if (length < value->size()) {
+      value->resize(length);
+    }
+  }
+}
+
+Status DBImpl::GetImpl(const ReadOptions& options, const Slice& key,
+                       uint64_t offset, uint64_t length,
+                       std::string* value) {
   Status s;
   MutexLock l(&mutex_);
   SequenceNumber snapshot;
@@ -1215,12 +1832,13 @@ Status DBImpl::Get(const ReadOptions& options,
     // 都找不到， 最后到sst文件中去找, 由于memtable和immutable memtable都是
     // 用skiplist实现的，所以查找过程完全一样
     LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, &s)) {
-      // Done
+    if (mem->Get(lkey, value, &s) ||
+        (imm != NULL && imm->Get(lkey, value, &s))) {
+      if (s.ok()) {
+        TrimToRange(offset, length, value);
+      }
     } else {
-      s = current->Get(options, lkey, value, &stats);
+      s = current->Get(options, lkey, offset, length, value, &stats);
       have_stat_update = true;
     }
     mutex_.Lock();
@@ -1235,6 +1853,246 @@ Status DBImpl::Get(const ReadOptions& options,
   return s;
 }
 
+void DBImpl::GetFromMemTables(const ReadOptions& options,
+                              int n, const Slice* keys,
+                              std::string* values, Status* s, bool* found,
+                              SequenceNumber* sequence) {
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+  *sequence = snapshot;
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+
+  {
+    mutex_.Unlock();
+    std::vector<LookupKey*> lkeys(n);
+    for (int i = 0; i < n; i++) {
+      lkeys[i] = new LookupKey(keys[i], snapshot);
+    }
+    mem->GetBatch(n, &lkeys[0], values, s, found);
+
+    if (imm != NULL) {
+      // Look up the remaining keys in the immutable memtable
+      std::vector<int> missing;
+      for (int i = 0; i < n; i++) {
+        if (!found[i]) missing.push_back(i);
+      }
+      const int m = missing.size();
+      if (m > 0) {
+        std::vector<LookupKey*> imm_keys(m);
+        std::vector<std::string> imm_values(m);
+        std::vector<Status> imm_s(m);
+        bool* imm_found = new bool[m];
+        for (int j = 0; j < m; j++) {
+          imm_keys[j] = lkeys[missing[j]];
+        }
+        imm->GetBatch(m, &imm_keys[0], &imm_values[0], &imm_s[0], imm_found);
+        for (int j = 0; j < m; j++) {
+          if (imm_found[j]) {
+            const int i = missing[j];
+            found[i] = true;
+            values[i].swap(imm_values[j]);
+            s[i] = imm_s[j];
+          }
+        }
+        delete[] imm_found;
+      }
+    }
+
+    for (int i = 0; i < n; i++) {
+      delete lkeys[i];
+    }
+    mutex_.Lock();
+  }
+
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+}
+
+namespace {
+
+// The snapshot taken by a GetAsync() or MultiGetAsync() call that was
+// given none, so that all of its lookups read at one sequence number.
+// Shared by the call and its AsyncReads; the last of them to finish
+// releases it.
+struct ImplicitSnapshot {
+  DB* db;
+  const Snapshot* snapshot;
+  port::Mutex mu;
+  int refs;
+};
+
+// If options->snapshot is NULL, point it to a new implicit snapshot
+// holding one reference and return that; otherwise return NULL.
+static ImplicitSnapshot* PinSnapshot(DB* db, ReadOptions* options) {
+  if (options->snapshot != NULL) {
+    return NULL;
+  }
+  ImplicitSnapshot* pin = new ImplicitSnapshot;
+  pin->db = db;
+  pin->snapshot = db->GetSnapshot();
+  pin->refs = 1;
+  options->snapshot = pin->snapshot;
+  return pin;
+}
+
+static void RefSnapshot(ImplicitSnapshot* pin) {
+  if (pin != NULL) {
+    MutexLock l(&pin->mu);
+    pin->refs++;
+  }
+}
+
+static void UnrefSnapshot(ImplicitSnapshot* pin) {
+  if (pin == NULL) {
+    return;
+  }
+  pin->mu.Lock();
+  const bool last = (--pin->refs == 0);
+  pin->mu.Unlock();
+  if (last) {
+    pin->db->ReleaseSnapshot(pin->snapshot);
+    delete pin;
+  }
+}
+
+// A lookup handed to DBImpl::read_pool_
+struct AsyncRead {
+  DB* db;
+  ReadOptions options;
+  ImplicitSnapshot* pin;  // Reference to options.snapshot, or NULL
+  std::string key;
+  DB::GetCallback get_callback;            // Set for GetAsync()
+  DB::MultiGetCallback multiget_callback;  // Set for MultiGetAsync()
+  int index;
+  void* arg;
+};
+
+static void RunAsyncRead(void* arg) {
+  AsyncRead* read = reinterpret_cast<AsyncRead*>(arg);
+  std::string value;
+  Status s = read->db->Get(read->options, read->key, &value);
+  // Released before the callback, which may be the last one and let the
+  // caller delete the DB
+  UnrefSnapshot(read->pin);
+  if (read->get_callback != NULL) {
+    (*read->get_callback)(read->arg, s, value);
+  } else {
+    (*read->multiget_callback)(read->arg, read->index, s, value);
+  }
+  delete read;
+}
+
+}  // namespace
+
+bool DBImpl::GetFromBlockCache(const ReadOptions& options,
+                               SequenceNumber sequence, const Slice& key,
+                               std::string* value, Status* s) {
+  mutex_.Lock();
+  Version* current = versions_->current();
+  current->Ref();
+  mutex_.Unlock();
+
+  // The memtables have been searched already.  Data flushed from them
+  // since then is found in the tables of "current".
+  ReadOptions cache_only = options;
+  cache_only.read_tier = kBlockCacheTier;
+  LookupKey lkey(key, sequence);
+  Version::GetStats stats;
+  *s = current->Get(cache_only, lkey, 0, ~static_cast<uint64_t>(0), value,
+                    &stats);
+
+  mutex_.Lock();
+  if (current->UpdateStats(stats)) {
+    MaybeScheduleCompaction();
+  }
+  current->Unref();
+  mutex_.Unlock();
+  return !s->IsIncomplete() || options.read_tier == kBlockCacheTier;
+}
+
+void DBImpl::GetAsync(const ReadOptions& options, const Slice& key,
+                      GetCallback callback, void* arg) {
+  ReadOptions pinned = options;
+  ImplicitSnapshot* pin = PinSnapshot(this, &pinned);
+  std::string value;
+  Status s;
+  bool found;
+  SequenceNumber sequence;
+  GetFromMemTables(pinned, 1, &key, &value, &s, &found, &sequence);
+  if (!found) {
+    found = GetFromBlockCache(pinned, sequence, key, &value, &s);
+  }
+  if (found) {
+    UnrefSnapshot(pin);
+    (*callback)(arg, s, value);
+    return;
+  }
+  AsyncRead* read = new AsyncRead;
+  read->db = this;
+  read->options = pinned;
+  read->pin = pin;  // Hands over the reference of this call
+  read->key = key.ToString();
+  read->get_callback = callback;
+  read->multiget_callback = NULL;
+  read->index = 0;
+  read->arg = arg;
+  read_pool_->Schedule(&RunAsyncRead, read);
+}
+
+void DBImpl::MultiGetAsync(const ReadOptions& options,
+                           int n, const Slice* keys,
+                           MultiGetCallback callback, void* arg) {
+  // All keys are looked up at one sequence number
+  ReadOptions pinned = options;
+  ImplicitSnapshot* pin = PinSnapshot(this, &pinned);
+
+  // The memtables are searched for all keys at once
+  std::vector<std::string> values(n);
+  std::vector<Status> s(n);
+  bool* found = new bool[n];
+  SequenceNumber sequence = 0;
+  if (n > 0) {
+    GetFromMemTables(pinned, n, keys, &values[0], &s[0], found, &sequence);
+  }
+  for (int i = 0; i < n; i++) {
+    if (found[i] ||
+        GetFromBlockCache(pinned, sequence, keys[i], &values[i], &s[i])) {
+      found[i] = true;
+      continue;
+    }
+    AsyncRead* read = new AsyncRead;
+    read->db = this;
+    read->options = pinned;
+    read->pin = pin;
+    RefSnapshot(pin);
+    read->key = keys[i].ToString();
+    read->get_callback = NULL;
+    read->multiget_callback = callback;
+    read->index = i;
+    read->arg = arg;
+    read_pool_->Schedule(&RunAsyncRead, read);
+  }
+
+  // Drop the reference of this call before invoking any callback, so
+  // that the snapshot is gone by the time the last one fires
+  UnrefSnapshot(pin);
+  for (int i = 0; i < n; i++) {
+    if (found[i]) {
+      (*callback)(arg, i, s[i], values[i]);
+    }
+  }
+  delete[] found;
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1242,14 +2100,21 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   // MergingIterator(内部维护一个迭代器集合, 指向memtable的，指向
   // immutable memtable的，还有指向level0层各个sst文件的，还有指向
   // 其他level的...), 然后外层还有一个DBIter持有了Mergingiterator
-  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed);
+  //
+  // The whole tree lives in one arena owned by the DBIter, so that short
+  // scans do not pay for a heap allocation per child iterator.
+  Arena* arena = new Arena;
+  const MemTable* mem;
+  const Version* version;
+  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed,
+                                       arena, &mem, &version);
   // 在这里可以看到，实际上我们创建迭代器的时候可以传入一个snapshot, 这个
   // snapshot的本质就是一个sequence_number, 如果我们没有传入snapshot, 在
   // 构造这个迭代器的时候会从调用versions_->LastSequence(), 来获取最大的
   // Sequence
   return NewDBIterator(
-      this, user_comparator(), iter,
-      (options.snapshot != NULL
+      this, user_comparator(), options, iter, arena, mem, version,
+      (options.snapshot != NULL && !options.tailing
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
        : latest_snapshot),
       seed);
@@ -1263,12 +2128,10 @@ void DBImpl::RecordReadSample(Slice key) {
 }
 
 const Snapshot* DBImpl::GetSnapshot() {
-  MutexLock l(&mutex_);
-  return snapshots_.New(versions_->LastSequence());
+  return snapshots_.New(versions_);
 }
 
 void DBImpl::ReleaseSnapshot(const Snapshot* s) {
-  MutexLock l(&mutex_);
   snapshots_.Delete(reinterpret_cast<const SnapshotImpl*>(s));
 }
 
@@ -1289,16 +2152,33 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
 
   // 在这里首先会抢占锁，所以在很多线程进行写入的时候这里会进行互斥，
   // 保证每个Writer能够安全的放入writers_队列当中
-  MutexLock l(&mutex_);
+  mutex_.Lock();
   writers_.push_back(&w);
+  if (&w != writers_.front() &&
+      (writer_spin_score_ > 0 ||
+       ++writers_since_spin_ % kWriterSpinProbeInterval == 0)) {
+    // The leader is usually done with its group long before a thread
+    // could be woken from cv, so watch for it without the mutex first.
+    mutex_.Unlock();
+    if (SpinForWriter(&w)) {
+      return w.status;
+    }
+    mutex_.Lock();
+    if (!w.done && &w != writers_.front()) {
+      // Gave up; the spinning was wasted
+      writer_spin_score_ = std::max(writer_spin_score_ - 2, 0);
+    }
+  }
   // 当前这个Writer并没有完成并且当前这个Writer并不是writers_
   // 队列的第一个(这说明之前还有Writer需要比它先完成)，则等待
   while (!w.done && &w != writers_.front()) {
+    w.waiting = true;
     w.cv.Wait();
   }
   // 被唤醒之后发现自己已经被前面的WriteBatch打包一起完成了，
   // 则直接返回结果
   if (w.done) {
+    mutex_.Unlock();
     return w.status;
   }
 
@@ -1324,7 +2204,9 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     // into mem_.
     {
       mutex_.Unlock();
+      const uint64_t log_start = env_->NowMicros();
       status = log_->AddRecord(WriteBatchInternal::Contents(updates));
+      const uint64_t log_micros = env_->NowMicros() - log_start;
       bool sync_error = false;
       if (status.ok() && options.sync) {
         status = logfile_->Sync();
@@ -1343,6 +2225,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         // So we force the DB into a mode where all future writes fail.
         RecordBackgroundError(status);
       }
+      AdjustGroupLimit(WriteBatchInternal::ByteSize(updates), log_micros);
     }
     if (updates == tmp_batch_) tmp_batch_->Clear();
 
@@ -1360,13 +2243,23 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   // 这时候我们需要将其status和done进行赋值并且pop掉，并且调用条件变
   // 量的Signal将其唤醒(第1219行), 唤醒之后发现其done成员变量为ture了
   // 这时候就会返回其对应的status了;
+  // A writer that is still spinning returns as soon as it sees
+  // "finished", without taking the mutex, so it is not signalled and
+  // must not be touched once "finished" is set.
   while (true) {
     Writer* ready = writers_.front();
     writers_.pop_front();
     if (ready != &w) {
       ready->status = status;
       ready->done = true;
-      ready->cv.Signal();
+      if (ready->waiting) {
+        ready->finished.Release_Store(ready);
+        ready->cv.Signal();
+      } else {
+        writer_spin_score_ = std::min(writer_spin_score_ + 1,
+                                      kMaxWriterSpinScore);
+        ready->finished.Release_Store(ready);
+      }
     }
     // last_writer是本队列中被消费的最后一个条目，也就是上图中的writer3
     if (ready == last_writer) break;
@@ -1379,12 +2272,55 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   // 如果队列不为空，调用唤醒对头元素, 也就是writer4
   // Notify new head of write queue
   if (!writers_.empty()) {
+    // The new head cannot proceed before we release the mutex, so it is
+    // safe to signal it after setting "leader"
+    writers_.front()->leader.Release_Store(writers_.front());
     writers_.front()->cv.Signal();
   }
 
+  mutex_.Unlock();
   return status;
 }
 
+// Wait for *w to be finished by a leader or to reach the front of the
+// writer queue, without holding the mutex.  Returns true if *w was
+// finished, in which case w->status holds the result.  Returns false if
+// *w is now the leader or the wait timed out; the caller must then check
+// again under the mutex.
+// REQUIRES: mutex_ is not held
+bool DBImpl::SpinForWriter(Writer* w) {
+  const uint64_t start = env_->NowMicros();
+  for (int i = 1; ; i++) {
+    if (w->finished.Acquire_Load() != NULL) {
+      return true;
+    }
+    if (w->leader.Acquire_Load() != NULL) {
+      return false;
+    }
+    if (i % 64 == 0 && env_->NowMicros() - start > kWriterSpinMicros) {
+      return false;
+    }
+  }
+}
+
+// Raise the group size limit while groups of about that size are logged
+// quickly, and lower it when a large group keeps its followers waiting
+// for longer than kTargetGroupLogMicros.
+void DBImpl::AdjustGroupLimit(size_t group_bytes, uint64_t log_micros) {
+  mutex_.AssertHeld();
+  if (log_micros > kTargetGroupLogMicros) {
+    if (group_bytes > max_group_bytes_ / 2 &&
+        max_group_bytes_ > kMinGroupBytes) {
+      max_group_bytes_ /= 2;
+    }
+  } else if (log_micros < kTargetGroupLogMicros / 2) {
+    if (group_bytes > max_group_bytes_ / 2 &&
+        max_group_bytes_ < kMaxGroupBytes) {
+      max_group_bytes_ *= 2;
+    }
+  }
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1398,9 +2334,9 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   // Allow the group to grow up to a maximum size, but if the
   // original write is small, limit the growth so we do not slow
   // down the small write too much.
-  size_t max_size = 1 << 20;
-  if (size <= (128<<10)) {
-    max_size = size + (128<<10);
+  size_t max_size = max_group_bytes_;
+  if (size <= max_group_bytes_ / 8) {
+    max_size = size + max_group_bytes_ / 8;
   }
 
   *last_writer = first;
@@ -1467,6 +2403,11 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // There is room in current memtable
       // 如果当前是写入操作， 并且memtable的内存使用量小于write_buffer_size
       // 直接break
+      if (next_mem_ == NULL &&
+          mem_->ApproximateMemoryUsage() > options_.write_buffer_size / 2) {
+        // Get the next log file and memtable ready before they are needed
+        MaybeSchedulePrepare();
+      }
       break;
     } else if (imm_ != NULL) {
       // We have filled up the current memtable, but the previous
@@ -1485,16 +2426,31 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       assert(versions_->PrevLogNumber() == 0);
       // 在执行compact之前先生成一个新的log文件, 如果还没有执行compact成功
       // 就把db关闭，那么下次启动db的时候，可以从旧的log文件中恢复数据
-      uint64_t new_log_number = versions_->NewFileNumber();
+      uint64_t new_log_number;
       WritableFile* lfile = NULL;
-      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
-      if (!s.ok()) {
-        // Avoid chewing through file number space in a tight loop.
-        versions_->ReuseFileNumber(new_log_number);
-        break;
+      MemTable* new_mem;
+      if (next_mem_ != NULL) {
+        // Use the log file and memtable prepared in the background
+        new_log_number = next_logfile_number_;
+        lfile = next_logfile_;
+        new_mem = next_mem_;
+        next_logfile_ = NULL;
+        next_mem_ = NULL;
+      } else {
+        new_log_number = versions_->NewFileNumber();
+        s = env_->NewWritableFile(LogFileName(dbname_, new_log_number),
+                                  &lfile);
+        if (!s.ok()) {
+          // Avoid chewing through file number space in a tight loop.
+          versions_->ReuseFileNumber(new_log_number);
+          break;
+        }
+        log_numbers_.insert(new_log_number);
+        new_mem = new MemTable(internal_comparator_);
+        new_mem->Ref();
       }
       delete log_;
-      delete logfile_;
+      logs_to_close_.push_back(logfile_);
       logfile_ = lfile;
       logfile_number_ = new_log_number;
       log_ = new log::Writer(lfile);
@@ -1502,9 +2458,10 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // 使用的这个immutable memtable), 并且重新创建memtable
       imm_ = mem_;
       has_imm_.Release_Store(imm_);
-      mem_ = new MemTable(internal_comparator_);
-      mem_->Ref();
+      mem_ = new_mem;
+      mem_copy_.Release_Store(mem_);
       force = false;   // Do not force another compaction if have room
+      bg_cv_.SignalAll();  // Wake a compaction waiting on its service
       MaybeScheduleCompaction();
     }
   }
@@ -1573,6 +2530,31 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
              static_cast<unsigned long long>(total_usage));
     value->append(buf);
     return true;
+  } else if (in == "memory-allocator-stats") {
+    MemoryAllocatorStats stats;
+    if (options_.memory_allocator == NULL ||
+        !options_.memory_allocator->GetStats(&stats)) {
+      return false;
+    }
+    // Share of the reserved memory that holds no requested bytes
+    const double fragmentation =
+        (stats.reserved > 0)
+        ? 100.0 * (stats.reserved - stats.requested) / stats.reserved
+        : 0.0;
+    char buf[300];
+    snprintf(buf, sizeof(buf),
+             "Allocator: %s\n"
+             "Requested(MB) Allocated(MB) Free(MB) Reserved(MB) "
+             "Fragmentation\n"
+             "%13.1f %13.1f %8.1f %12.1f %12.1f%%\n",
+             options_.memory_allocator->Name(),
+             stats.requested / 1048576.0,
+             stats.allocated / 1048576.0,
+             stats.free / 1048576.0,
+             stats.reserved / 1048576.0,
+             fragmentation);
+    value->append(buf);
+    return true;
   }
 
   return false;
@@ -1604,6 +2586,138 @@ void DBImpl::GetApproximateSizes(
   }
 }
 
+namespace {
+
+// Key samples per requested partition in GetPartitionBoundaries()
+static const int kSamplesPerPartition = 32;
+
+struct SampleOrder {
+  const Comparator* ucmp;
+  bool operator()(const std::pair<std::string, uint64_t>& a,
+                  const std::pair<std::string, uint64_t>& b) const {
+    return ucmp->Compare(a.first, b.first) < 0;
+  }
+};
+
+struct ScanPartition {
+  Iterator* iter;
+  const Comparator* ucmp;
+  const Slice* start;           // NULL means before all keys
+  const Slice* limit;           // NULL means after all keys
+  int index;
+  DB::ScanCallback callback;
+  void* arg;
+  Status status;
+};
+
+static void RunScanPartition(void* arg) {
+  ScanPartition* p = reinterpret_cast<ScanPartition*>(arg);
+  Iterator* iter = p->iter;
+  if (p->start != NULL) {
+    iter->Seek(*p->start);
+  } else {
+    iter->SeekToFirst();
+  }
+  for (; iter->Valid(); iter->Next()) {
+    if (p->limit != NULL && p->ucmp->Compare(iter->key(), *p->limit) >= 0) {
+      break;
+    }
+    if (!(*p->callback)(p->arg, p->index, iter->key(), iter->value())) {
+      break;
+    }
+  }
+  p->status = iter->status();
+}
+
+}  // namespace
+
+void DBImpl::GetPartitionBoundaries(const Slice* begin, const Slice* end,
+                                    int n,
+                                    std::vector<std::string>* boundaries) {
+  boundaries->clear();
+  if (n <= 1) {
+    return;
+  }
+
+  Version* v;
+  {
+    MutexLock l(&mutex_);
+    versions_->current()->Ref();
+    v = versions_->current();
+  }
+  std::vector<std::pair<std::string, uint64_t> > samples;
+  v->SampleKeys(begin, end, n * kSamplesPerPartition, &samples);
+  {
+    MutexLock l(&mutex_);
+    v->Unref();
+  }
+
+  const Comparator* ucmp = user_comparator();
+  SampleOrder order;
+  order.ucmp = ucmp;
+  std::sort(samples.begin(), samples.end(), order);
+  uint64_t total = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    total += samples[i].second;
+  }
+
+  // Cut after the sample that completes each 1/n of the data
+  uint64_t sum = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    sum += samples[i].second;
+    const uint64_t cuts = boundaries->size() + 1;
+    if (cuts >= static_cast<uint64_t>(n) || sum * n < total * cuts) {
+      continue;
+    }
+    const std::string& key = samples[i].first;
+    if ((begin == NULL || ucmp->Compare(key, *begin) > 0) &&
+        (end == NULL || ucmp->Compare(key, *end) < 0) &&
+        (boundaries->empty() || ucmp->Compare(key, boundaries->back()) > 0)) {
+      boundaries->push_back(key);
+    }
+  }
+}
+
+Status DBImpl::ParallelScan(const ReadOptions& options,
+                            const Slice* begin, const Slice* end, int n,
+                            ScanCallback callback, void* arg) {
+  std::vector<std::string> boundaries;
+  GetPartitionBoundaries(begin, end, n, &boundaries);
+  const int parts = boundaries.size() + 1;
+  std::vector<Slice> bounds(boundaries.begin(), boundaries.end());
+  std::vector<Iterator*> iters(parts);
+  NewIterators(options, parts, &iters[0]);
+
+  std::vector<ScanPartition> partitions(parts);
+  for (int i = 0; i < parts; i++) {
+    ScanPartition* p = &partitions[i];
+    p->iter = iters[i];
+    p->ucmp = user_comparator();
+    p->start = (i == 0) ? begin : &bounds[i - 1];
+    p->limit = (i == parts - 1) ? end : &bounds[i];
+    p->index = i;
+    p->callback = callback;
+    p->arg = arg;
+  }
+
+  // The calling thread scans the first partition itself
+  ThreadPool* pool = (parts > 1) ? new ThreadPool(env_, parts - 1) : NULL;
+  for (int i = 1; i < parts; i++) {
+    pool->Schedule(&RunScanPartition, &partitions[i]);
+  }
+  RunScanPartition(&partitions[0]);
+  delete pool;  // Waits for the other partitions
+
+  Status s;
+  for (int i = 0; i < parts; i++) {
+    if (s.ok()) {
+      s = partitions[i].status;
+    }
+    delete iters[i];
+  }
+  return s;
+}
+
 // Default implementations of convenience methods that subclasses of DB
 // can call if they wish
 Status DB::Put(const WriteOptions& opt, const Slice& key, const Slice& value) {
@@ -1618,6 +2732,102 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::GetRange(const ReadOptions& options, const Slice& key,
+                    uint64_t offset, uint64_t length, std::string* value) {
+  std::string full;
+  Status s = Get(options, key, &full);
+  if (s.ok()) {
+    if (offset >= full.size()) {
+      value->clear();
+    } else {
+      value->assign(full, offset, length);
+    }
+  }
+  return s;
+}
+
+void DB::GetAsync(const ReadOptions& options, const Slice& key,
+                  GetCallback callback, void* arg) {
+  std::string value;
+  Status s = Get(options, key, &value);
+  (*callback)(arg, s, value);
+}
+
+void DB::MultiGetAsync(const ReadOptions& options, int n, const Slice* keys,
+                       MultiGetCallback callback, void* arg) {
+  ReadOptions opt = options;
+  const Snapshot* snapshot = NULL;
+  if (opt.snapshot == NULL) {
+    snapshot = GetSnapshot();
+    opt.snapshot = snapshot;
+  }
+  std::vector<std::string> values(n);
+  std::vector<Status> s(n);
+  for (int i = 0; i < n; i++) {
+    s[i] = Get(opt, keys[i], &values[i]);
+  }
+  if (snapshot != NULL) {
+    ReleaseSnapshot(snapshot);
+  }
+  for (int i = 0; i < n; i++) {
+    (*callback)(arg, i, s[i], values[i]);
+  }
+}
+
+void DB::NewIterators(const ReadOptions& options, int n,
+                      Iterator** iterators) {
+  ReadOptions opt = options;
+  const Snapshot* snapshot = NULL;
+  if (opt.snapshot == NULL) {
+    snapshot = GetSnapshot();
+    opt.snapshot = snapshot;
+  }
+  for (int i = 0; i < n; i++) {
+    iterators[i] = NewIterator(opt);
+  }
+  if (snapshot != NULL) {
+    // The iterators keep reading the state they were created with
+    ReleaseSnapshot(snapshot);
+  }
+}
+
+void DB::GetPartitionBoundaries(const Slice* begin, const Slice* end, int n,
+                                std::vector<std::string>* boundaries) {
+  boundaries->clear();
+}
+
+Status DB::ParallelScan(const ReadOptions& options,
+                        const Slice* begin, const Slice* end, int n,
+                        ScanCallback callback, void* arg) {
+  return Status::NotSupported("ParallelScan");
+}
+
+Status DB::CompactRange(const Slice* begin, const Slice* end,
+                        CompactionHandle* handle) {
+  CompactRange(begin, end);
+  return Status::OK();
+}
+
+struct CompactionHandle::Rep {
+  port::AtomicPointer cancelled;  // Non-NULL once Cancel() is called
+
+  Rep() : cancelled(NULL) { }
+};
+
+CompactionHandle::CompactionHandle() : rep_(new Rep) { }
+
+CompactionHandle::~CompactionHandle() {
+  delete rep_;
+}
+
+void CompactionHandle::Cancel() {
+  rep_->cancelled.Release_Store(rep_);
+}
+
+bool CompactionHandle::IsCancelled() const {
+  return rep_->cancelled.Acquire_Load() != NULL;
+}
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -1643,6 +2853,7 @@ Status DB::Open(const Options& options, const std::string& dbname,
       impl->log_ = new log::Writer(lfile);
       impl->mem_ = new MemTable(impl->internal_comparator_);
       impl->mem_->Ref();
+      impl->mem_copy_.Release_Store(impl->mem_);
     }
   }
   if (s.ok() && save_manifest) {
@@ -1651,7 +2862,7 @@ Status DB::Open(const Options& options, const std::string& dbname,
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
-    impl->DeleteObsoleteFiles();
+    impl->DeleteObsoleteFiles(true);
     impl->MaybeScheduleCompaction();
   }
   impl->mutex_.Unlock();
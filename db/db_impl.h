@@ -7,6 +7,7 @@
 
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
@@ -17,8 +18,11 @@
 
 namespace leveldb {
 
+class Arena;
+class DeleteScheduler;
 class MemTable;
 class TableCache;
+class ThreadPool;
 class Version;
 class VersionEdit;
 class VersionSet;
@@ -35,12 +39,28 @@ class DBImpl : public DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual Status GetRange(const ReadOptions& options, const Slice& key,
+                          uint64_t offset, uint64_t length,
+                          std::string* value);
+  virtual void GetAsync(const ReadOptions& options, const Slice& key,
+                        GetCallback callback, void* arg);
+  virtual void MultiGetAsync(const ReadOptions& options,
+                             int n, const Slice* keys,
+                             MultiGetCallback callback, void* arg);
   virtual Iterator* NewIterator(const ReadOptions&);
+  virtual void GetPartitionBoundaries(const Slice* begin, const Slice* end,
+                                      int n,
+                                      std::vector<std::string>* boundaries);
+  virtual Status ParallelScan(const ReadOptions& options,
+                              const Slice* begin, const Slice* end, int n,
+                              ScanCallback callback, void* arg);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
   virtual bool GetProperty(const Slice& property, std::string* value);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual Status CompactRange(const Slice* begin, const Slice* end,
+                              CompactionHandle* handle);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -59,20 +79,45 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Wait until files queued for rate-limited deletion have been deleted.
+  void TEST_WaitForDeletions();
+
+  // Wait for a pending PrepareNextMemTable() to finish.  Returns the number
+  // of the log file prepared for the next memtable switch, or 0 if none.
+  uint64_t TEST_PreparedLogNumber();
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
   void RecordReadSample(Slice key);
 
+  // Return an internal iterator over the current state of the database
+  // and set *latest_snapshot to the last sequence number it contains.
+  // If "arena" is non-NULL the whole iterator tree is placed in *arena
+  // and must be released with iter->~Iterator() instead of delete.
+  // If "mem" and "version" are non-NULL they are set to the memtable and
+  // version the iterator reads, for use with IsCurrent().
+  Iterator* NewInternalIterator(const ReadOptions&,
+                                SequenceNumber* latest_snapshot,
+                                uint32_t* seed,
+                                Arena* arena = NULL,
+                                const MemTable** mem = NULL,
+                                const Version** version = NULL);
+
+  // Return the last sequence number.  Does not acquire mutex_.
+  SequenceNumber LatestSequence() const;
+
+  // Return true if "mem" is still the memtable that receives writes and,
+  // if "version" is non-NULL, "version" is still the current version.
+  // Does not acquire mutex_.
+  bool IsCurrent(const MemTable* mem, const Version* version) const;
+
  private:
   friend class DB;
   struct CompactionState;
+  struct CompactionPipeline;
   struct Writer;
 
-  Iterator* NewInternalIterator(const ReadOptions&,
-                                SequenceNumber* latest_snapshot,
-                                uint32_t* seed);
-
   Status NewDB();
 
   // Recover the descriptor from persistent storage.  May do a significant
@@ -83,8 +128,11 @@ class DBImpl : public DB {
 
   void MaybeIgnoreError(Status* s) const;
 
-  // Delete any unneeded files and stale in-memory entries.
-  void DeleteObsoleteFiles();
+  // Delete any unneeded files and stale in-memory entries.  Unless
+  // full_scan is set, only files that may have become unneeded since the
+  // last call are examined.  May release and re-acquire mutex_.
+  void DeleteObsoleteFiles(bool full_scan = false)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // Compact the in-memory write buffer to disk.  Switches to a new
   // log-file/memtable and writes a new descriptor iff successful.
@@ -101,9 +149,43 @@ class DBImpl : public DB {
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
+  bool SpinForWriter(Writer* w);
+  void AdjustGroupLimit(size_t group_bytes, uint64_t log_micros)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   void RecordBackgroundError(const Status& s);
 
+  // Get() and GetRange() share this.  Stores the bytes
+  // [offset, offset+length) of the value of "key" in *value.
+  Status GetImpl(const ReadOptions& options, const Slice& key,
+                 uint64_t offset, uint64_t length, std::string* value);
+
+  // Look up keys[0,n-1] in the memtables only.  found[i] is set to
+  // whether keys[i] was found there, and if so, the result of its lookup
+  // is stored in values[i] and s[i].  *sequence is set to the sequence
+  // number the lookups read at.
+  void GetFromMemTables(const ReadOptions& options, int n, const Slice* keys,
+                        std::string* values, Status* s, bool* found,
+                        SequenceNumber* sequence);
+
+  // Look up "key" at "sequence" in the table files of the current
+  // version, without file I/O.  The memtables must have been searched
+  // already.  Returns true and stores the result of the lookup in *value
+  // and *s if that was possible.
+  bool GetFromBlockCache(const ReadOptions& options, SequenceNumber sequence,
+                         const Slice& key, std::string* value, Status* s);
+
+  // Create the next log file and memtable on a separate thread, if that
+  // is not done already.
+  void MaybeSchedulePrepare() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGPrepareWork(void* db);
+  void PrepareNextMemTable();
+
+  // Compact the files in "level" that overlap [*begin,*end] into
+  // level+1, stopping early if handle->Cancel() is called.
+  Status ManualCompact(int level, const Slice* begin, const Slice* end,
+                       CompactionHandle* handle);
+
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
   void BackgroundCall();
@@ -112,9 +194,17 @@ class DBImpl : public DB {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status RunCompactionService(CompactionState* compact, int64_t* imm_micros)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
-  Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
+  Status FinishCompactionOutputFile(CompactionState* compact,
+                                    const Status& input_status);
+  Status AddCompactionOutput(CompactionState* compact,
+                             const Slice& key, const Slice& value,
+                             bool stop_before);
+  static void CompactionOutputWork(void* arg);
+  void RunCompactionOutput(CompactionPipeline* pipe);
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
@@ -138,6 +228,7 @@ class DBImpl : public DB {
   port::AtomicPointer shutting_down_;
   port::CondVar bg_cv_;          // Signalled when background work finishes
   MemTable* mem_;
+  port::AtomicPointer mem_copy_; // == mem_, for IsCurrent()
   MemTable* imm_;                // Memtable being compacted
   port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
   WritableFile* logfile_;
@@ -149,12 +240,49 @@ class DBImpl : public DB {
   std::deque<Writer*> writers_;
   WriteBatch* tmp_batch_;
 
+  // Largest write group BuildBatchGroup() may form.  Tuned from how long
+  // the log writes of earlier groups took.
+  size_t max_group_bytes_;
+
+  // Writers that are not at the front of the queue spin for a while
+  // before blocking.  The score goes up when a spinning writer is
+  // finished in time and down when one gives up; spinning stops while it
+  // is zero, apart from an occasional probe.
+  int writer_spin_score_;
+  uint32_t writers_since_spin_;
+
   SnapshotList snapshots_;
 
   // Set of table files to protect from deletion because they are
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
+  // Table files that may no longer be needed, and log files that may
+  // still exist.  Examined by DeleteObsoleteFiles().
+  std::vector<uint64_t> obsolete_tables_;
+  std::set<uint64_t> log_numbers_;
+
+  // Deletes obsolete files at a limited rate; NULL if deletion is
+  // immediate.
+  DeleteScheduler* delete_scheduler_;
+
+  // Finishes asynchronous lookups that need to read from disk
+  ThreadPool* read_pool_;
+
+  // Log file and memtable prepared in the background for the next
+  // memtable switch, so that MakeRoomForWrite() only has to swap them in.
+  // next_mem_ is NULL if nothing has been prepared.
+  WritableFile* next_logfile_;
+  uint64_t next_logfile_number_;
+  MemTable* next_mem_;
+
+  // Log files replaced by a memtable switch.  Closed by CompactMemTable()
+  // once their contents are flushed.
+  std::vector<WritableFile*> logs_to_close_;
+
+  // Has a PrepareNextMemTable() been scheduled or is running?
+  bool prepare_scheduled_;
+
   // Has a background compaction been scheduled or is running?
   bool bg_compaction_scheduled_;
 
@@ -165,6 +293,8 @@ class DBImpl : public DB {
     const InternalKey* begin;   // NULL means beginning of key range
     const InternalKey* end;     // NULL means end of key range
     InternalKey tmp_storage;    // Used to keep track of compaction progress
+    CompactionHandle* handle;   // NULL if the compaction cannot be cancelled
+    Status status;              // Error that ended the compaction
   };
   ManualCompaction* manual_compaction_;
 
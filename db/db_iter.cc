@@ -10,6 +10,7 @@
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "port/port.h"
+#include "util/arena.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "util/random.h"
@@ -48,19 +49,30 @@ class DBIter: public Iterator {
     kReverse
   };
 
-  DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+  DBIter(DBImpl* db, const Comparator* cmp, const ReadOptions& options,
+         Iterator* iter, Arena* arena, const MemTable* mem,
+         const Version* version, SequenceNumber s, uint32_t seed)
       : db_(db),
         user_comparator_(cmp),
+        options_(options),
+        tailing_(options.tailing),
+        limited_reads_(options.read_tier == kBlockCacheTier ||
+                       options.deadline != 0),
+        pin_data_(options.pin_data),
         iter_(iter),
+        arena_(arena),
+        mem_(mem),
+        version_(version),
         sequence_(s),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
         bytes_counter_(RandomPeriod()) {
+    options_.snapshot = NULL;  // Refresh() reads the latest state
   }
   virtual ~DBIter() {
-    delete iter_;
+    iter_->~Iterator();
+    delete arena_;
   }
   virtual bool Valid() const { return valid_; }
   // 从InternalKey中获取出user_key进行返回
@@ -79,29 +91,70 @@ class DBIter: public Iterator {
       return status_;
     }
   }
+  virtual bool IsKeyPinned() const {
+    assert(valid_);
+    if (!pin_data_) {
+      return false;
+    }
+    return (direction_ == kForward) ? iter_->IsKeyPinned()
+                                    : saved_key_.data() != key_buf_.data();
+  }
 
   virtual void Next();
   virtual void Prev();
   virtual void Seek(const Slice& target);
   virtual void SeekToFirst();
   virtual void SeekToLast();
+  virtual Status Refresh();
 
  private:
-  void FindNextUserEntry(bool skipping, std::string* skip);
+  void FindNextUserEntry(bool skipping);
+  void FollowTail();
+
+  // With kBlockCacheTier or a deadline, a child of iter_ stops at a block
+  // it may not read, and the entries of the other children may then be
+  // shadowed by the ones it did not read.  So stop as soon as that happens.
+  void StopIfBlockSkipped() {
+    if (limited_reads_ && !iter_->status().ok()) {
+      valid_ = false;
+    }
+  }
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
 
-  inline void SaveKey(const Slice& k, std::string* dst) {
-    dst->assign(k.data(), k.size());
+  // Store "k", which must come from iter_->key(), in saved_key_.  It is
+  // only copied if iter_ may overwrite it.
+  inline void SaveKey(const Slice& k) {
+    if (pin_data_ && iter_->IsKeyPinned()) {
+      saved_key_ = k;
+    } else {
+      key_buf_.assign(k.data(), k.size());
+      saved_key_ = key_buf_;
+    }
+  }
+
+  // Store "v", which must come from iter_->value(), in saved_value_.
+  inline void SaveValue(const Slice& v) {
+    if (pin_data_) {
+      saved_value_ = v;
+    } else {
+      if (value_buf_.capacity() > v.size() + 1048576) {
+        std::string empty;
+        swap(empty, value_buf_);
+      }
+      value_buf_.assign(v.data(), v.size());
+      saved_value_ = value_buf_;
+    }
   }
 
   inline void ClearSavedValue() {
-    if (saved_value_.capacity() > 1048576) {
+    if (value_buf_.capacity() > 1048576) {
       std::string empty;
-      swap(empty, saved_value_);
+      swap(empty, value_buf_);
     } else {
-      saved_value_.clear();
+      value_buf_.clear();
     }
+    saved_value_.clear();
   }
 
   // Pick next gap with average value of config::kReadBytesPeriod.
@@ -111,12 +164,21 @@ class DBIter: public Iterator {
 
   DBImpl* db_;
   const Comparator* const user_comparator_;
-  Iterator* const iter_;
-  SequenceNumber const sequence_;
+  ReadOptions options_;       // For rebuilding iter_
+  const bool tailing_;
+  const bool limited_reads_;
+  const bool pin_data_;       // Blocks read by iter_ stay in memory
+  Iterator* iter_;
+  Arena* const arena_;        // Holds *iter_
+  const MemTable* mem_;       // Memtable read by iter_
+  const Version* version_;    // Version read by iter_
+  SequenceNumber sequence_;
 
   Status status_;
-  std::string saved_key_;     // == current key when direction_==kReverse
-  std::string saved_value_;   // == current raw value when direction_==kReverse
+  Slice saved_key_;           // == current key when direction_==kReverse
+  Slice saved_value_;         // == current raw value when direction_==kReverse
+  std::string key_buf_;       // Holds saved_key_ unless it is pinned
+  std::string value_buf_;     // Holds saved_value_ unless it is pinned
   Direction direction_;
   bool valid_;
 
@@ -146,6 +208,9 @@ inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
 
 void DBIter::Next() {
   assert(valid_);
+  if (tailing_) {
+    FollowTail();
+  }
 
   if (direction_ == kReverse) {  // Switch directions?
     direction_ = kForward;
@@ -170,10 +235,10 @@ void DBIter::Next() {
     // 相同的key, 因为最新的数据我们已经遍历到了(user_key相同
     // sequence number大的表示最新的数据)
     // Store in saved_key_ the current key so we skip it below.
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    SaveKey(ExtractUserKey(iter_->key()));
   }
 
-  FindNextUserEntry(true, &saved_key_);
+  FindNextUserEntry(true);
 }
 
 /*
@@ -198,7 +263,7 @@ void DBIter::Next() {
  *
  */
 
-void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
+void DBIter::FindNextUserEntry(bool skipping) {
   // Loop until we hit an acceptable entry to yield
   assert(iter_->Valid());
   assert(direction_ == kForward);
@@ -211,16 +276,17 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
           // they are hidden by this deletion.
-          SaveKey(ikey.user_key, skip);
+          SaveKey(ikey.user_key);
           skipping = true;
           break;
         case kTypeValue:
           if (skipping &&
-              user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
+              user_comparator_->Compare(ikey.user_key, saved_key_) <= 0) {
             // Entry hidden
           } else {
             valid_ = true;
             saved_key_.clear();
+            StopIfBlockSkipped();
             return;
           }
           break;
@@ -239,7 +305,7 @@ void DBIter::Prev() {
     // iter_ is pointing at the current entry.  Scan backwards until
     // the key changes so we can use the normal reverse scanning code.
     assert(iter_->Valid());  // Otherwise valid_ would have been false
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    SaveKey(ExtractUserKey(iter_->key()));
     while (true) {
       iter_->Prev();
       if (!iter_->Valid()) {
@@ -325,13 +391,8 @@ void DBIter::FindPrevUserEntry() {
           saved_key_.clear();
           ClearSavedValue();
         } else {
-          Slice raw_value = iter_->value();
-          if (saved_value_.capacity() > raw_value.size() + 1048576) {
-            std::string empty;
-            swap(empty, saved_value_);
-          }
-          SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
-          saved_value_.assign(raw_value.data(), raw_value.size());
+          SaveKey(ExtractUserKey(iter_->key()));
+          SaveValue(iter_->value());
         }
       }
       iter_->Prev();
@@ -346,50 +407,102 @@ void DBIter::FindPrevUserEntry() {
     direction_ = kForward;
   } else {
     valid_ = true;
+    StopIfBlockSkipped();
   }
 }
 
 void DBIter::Seek(const Slice& target) {
+  std::string copy;
+  Slice t = target;
+  if (tailing_) {
+    // Refresh() may free the memory that "target" points into
+    copy.assign(target.data(), target.size());
+    t = copy;
+    Refresh();
+  }
   direction_ = kForward;
   ClearSavedValue();
   saved_key_.clear();
+  key_buf_.clear();
   AppendInternalKey(
-      &saved_key_, ParsedInternalKey(target, sequence_, kValueTypeForSeek));
-  iter_->Seek(saved_key_);
+      &key_buf_, ParsedInternalKey(t, sequence_, kValueTypeForSeek));
+  iter_->Seek(key_buf_);
   if (iter_->Valid()) {
-    FindNextUserEntry(false, &saved_key_ /* temporary storage */);
+    FindNextUserEntry(false);
   } else {
     valid_ = false;
   }
 }
 
 void DBIter::SeekToFirst() {
+  if (tailing_) {
+    Refresh();
+  }
   direction_ = kForward;
   ClearSavedValue();
   iter_->SeekToFirst();
   if (iter_->Valid()) {
-    FindNextUserEntry(false, &saved_key_ /* temporary storage */);
+    FindNextUserEntry(false);
   } else {
     valid_ = false;
   }
 }
 
 void DBIter::SeekToLast() {
+  if (tailing_) {
+    Refresh();
+  }
   direction_ = kReverse;
   ClearSavedValue();
   iter_->SeekToLast();
   FindPrevUserEntry();
 }
 
+Status DBIter::Refresh() {
+  valid_ = false;
+  direction_ = kForward;
+  status_ = Status::OK();
+  saved_key_.clear();
+  ClearSavedValue();
+
+  // Read the sequence number before checking that iter_ is current: each
+  // write up to it went into mem_ or into data that iter_ already reads.
+  const SequenceNumber latest = db_->LatestSequence();
+  if (iter_->status().ok() && db_->IsCurrent(mem_, version_)) {
+    sequence_ = latest;
+  } else {
+    iter_->~Iterator();
+    arena_->Reset();
+    uint32_t ignored_seed;
+    iter_ = db_->NewInternalIterator(options_, &sequence_, &ignored_seed,
+                                     arena_, &mem_, &version_);
+  }
+  return Status::OK();
+}
+
+void DBIter::FollowTail() {
+  // Writes to a newer memtable are not visible through iter_, so keep
+  // sequence_ until the next Seek() rebuilds it.
+  const SequenceNumber latest = db_->LatestSequence();
+  if (db_->IsCurrent(mem_, NULL)) {
+    sequence_ = latest;
+  }
+}
+
 }  // anonymous namespace
 
 Iterator* NewDBIterator(
     DBImpl* db,
     const Comparator* user_key_comparator,
+    const ReadOptions& options,
     Iterator* internal_iter,
+    Arena* arena,
+    const MemTable* mem,
+    const Version* version,
     SequenceNumber sequence,
     uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+  return new DBIter(db, user_key_comparator, options, internal_iter, arena,
+                    mem, version, sequence, seed);
 }
 
 }  // namespace leveldb
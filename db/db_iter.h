@@ -11,15 +11,27 @@
 
 namespace leveldb {
 
+class Arena;
 class DBImpl;
+class MemTable;
+class Version;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
 // into appropriate user keys.
+//
+// "*internal_iter" must have been built by db->NewInternalIterator()
+// with the given options, placed in "*arena" and reading "mem" and
+// "version".  The result takes ownership of the arena, and reuses it
+// when Refresh() rebuilds the internal iterator.
 extern Iterator* NewDBIterator(
     DBImpl* db,
     const Comparator* user_key_comparator,
+    const ReadOptions& options,
     Iterator* internal_iter,
+    Arena* arena,
+    const MemTable* mem,
+    const Version* version,
     SequenceNumber sequence,
     uint32_t seed);
 
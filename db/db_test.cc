@@ -6,17 +6,28 @@
 #include "leveldb/filter_policy.h"
 #include "db/db_impl.h"
 #include "db/filename.h"
+#include "db/log_reader.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/cache.h"
+#include "leveldb/compaction_service.h"
 #include "leveldb/env.h"
+#include "leveldb/memory_allocator.h"
 #include "leveldb/table.h"
+#include "leveldb/table_factory.h"
+#include "table/format.h"
+#include "util/coding.h"
 #include "util/hash.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
 
+// The Makefile builds leveldbutil before db_test and passes its path
+#ifndef LEVELDBUTIL_PATH
+#define LEVELDBUTIL_PATH "out-static/leveldbutil"
+#endif
+
 namespace leveldb {
 
 static std::string RandomString(Random* rnd, int len) {
@@ -115,14 +126,41 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // Random-access reads fill the caller's scratch buffer (as they would
+  // without mmap) and are counted in read_bytes_counter_.
+  bool copy_random_reads_;
+  AtomicCounter read_bytes_counter_;
+
+  // SleepForMicroseconds() returns at once while this pointer is non-NULL,
+  // adding the requested time to sleep_micros_counter_.
+  port::AtomicPointer fake_sleeps_;
+  AtomicCounter sleep_micros_counter_;
+
+  // Fake sleeps are blocked while this pointer is non-NULL.
+  port::AtomicPointer hold_sleeps_;
+
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_data_sync_.Release_Store(NULL);
     data_sync_error_.Release_Store(NULL);
     no_space_.Release_Store(NULL);
     non_writable_.Release_Store(NULL);
     count_random_reads_ = false;
+    copy_random_reads_ = false;
     manifest_sync_error_.Release_Store(NULL);
     manifest_write_error_.Release_Store(NULL);
+    fake_sleeps_.Release_Store(NULL);
+    hold_sleeps_.Release_Store(NULL);
+  }
+
+  virtual void SleepForMicroseconds(int micros) {
+    if (fake_sleeps_.Acquire_Load() == NULL) {
+      target()->SleepForMicroseconds(micros);
+      return;
+    }
+    sleep_micros_counter_.IncrementBy(micros);
+    while (hold_sleeps_.Acquire_Load() != NULL) {
+      DelayMilliseconds(10);
+    }
   }
 
   Status NewWritableFile(const std::string& f, WritableFile** r) {
@@ -215,10 +253,34 @@ class SpecialEnv : public EnvWrapper {
       }
     };
 
+    class CopyingFile : public RandomAccessFile {
+     private:
+      RandomAccessFile* target_;
+      AtomicCounter* counter_;
+     public:
+      CopyingFile(RandomAccessFile* target, AtomicCounter* counter)
+          : target_(target), counter_(counter) {
+      }
+      virtual ~CopyingFile() { delete target_; }
+      virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                          char* scratch) const {
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && result->data() != scratch) {
+          memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        counter_->IncrementBy(static_cast<int>(result->size()));
+        return s;
+      }
+    };
+
     Status s = target()->NewRandomAccessFile(f, r);
     if (s.ok() && count_random_reads_) {
       *r = new CountingFile(*r, &random_read_counter_);
     }
+    if (s.ok() && copy_random_reads_) {
+      *r = new CopyingFile(*r, &read_bytes_counter_);
+    }
     return s;
   }
 };
@@ -226,6 +288,8 @@ class SpecialEnv : public EnvWrapper {
 class DBTest {
  private:
   const FilterPolicy* filter_policy_;
+  TableFactory* plain_table_factory_;
+  TableFactory* cuckoo_table_factory_;
 
   // Sequence of option configurations to try
   enum OptionConfig {
@@ -233,6 +297,9 @@ class DBTest {
     kReuse,
     kFilter,
     kUncompressed,
+    kPipelined,
+    kPlainTable,
+    kCuckooTable,
     kEnd
   };
   int option_config_;
@@ -247,6 +314,8 @@ class DBTest {
   DBTest() : option_config_(kDefault),
              env_(new SpecialEnv(Env::Default())) {
     filter_policy_ = NewBloomFilterPolicy(10);
+    plain_table_factory_ = NewPlainTableFactory(16);
+    cuckoo_table_factory_ = NewCuckooTableFactory();
     dbname_ = test::TmpDir() + "/db_test";
     DestroyDB(dbname_, Options());
     db_ = NULL;
@@ -258,6 +327,8 @@ class DBTest {
     DestroyDB(dbname_, Options());
     delete env_;
     delete filter_policy_;
+    delete plain_table_factory_;
+    delete cuckoo_table_factory_;
   }
 
   // Switch to a fresh database with the next option configuration to
@@ -286,6 +357,15 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kPipelined:
+        options.pipelined_compaction = true;
+        break;
+      case kPlainTable:
+        options.table_factory = plain_table_factory_;
+        break;
+      case kCuckooTable:
+        options.table_factory = cuckoo_table_factory_;
+        break;
       default:
         break;
     }
@@ -545,6 +625,31 @@ class DBTest {
   }
 };
 
+// Makes the DB opened with "options" read table files through t's
+// SpecialEnv while in scope.  With "copy" set, every random-access read is
+// copied into the caller's buffer, as reads without mmap are, and the end
+// of the scope checks that table data was really read that way.
+class TableReadMode {
+ public:
+  TableReadMode(DBTest* t, Options* options, bool copy)
+      : env_(t->env_), copy_(copy) {
+    options->env = env_;
+    env_->copy_random_reads_ = copy;
+    env_->read_bytes_counter_.Reset();
+  }
+
+  ~TableReadMode() {
+    if (copy_) {
+      ASSERT_GT(env_->read_bytes_counter_.Read(), 0);
+    }
+    env_->copy_random_reads_ = false;
+  }
+
+ private:
+  SpecialEnv* env_;
+  const bool copy_;
+};
+
 TEST(DBTest, Empty) {
   do {
     ASSERT_TRUE(db_ != NULL);
@@ -600,6 +705,53 @@ TEST(DBTest, GetFromVersions) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, GetRange) {
+  Options options = CurrentOptions();
+  options.large_value_threshold = 10000;
+  TableReadMode reads(this, &options, true);
+  Reopen(&options);
+
+  Random rnd(301);
+  const std::string big = RandomString(&rnd, 100000);
+  ASSERT_OK(Put("a", "small"));
+  ASSERT_OK(Put("big", big));
+  ASSERT_OK(Put("z", "small"));
+
+  std::string value;
+  ASSERT_OK(db_->GetRange(ReadOptions(), "big", 1000, 10, &value));
+  ASSERT_EQ(big.substr(1000, 10), value);
+
+  // Reopen so that the block written to the table is not cached, and
+  // open the table through a key in another block.  The partial read
+  // then fetches only the key and the requested bytes of the value.
+  dbfull()->TEST_CompactMemTable();
+  Reopen(&options);
+  ASSERT_EQ("small", Get("a"));
+  env_->read_bytes_counter_.Reset();
+  ASSERT_OK(db_->GetRange(ReadOptions(), "big", 50000, 100, &value));
+  ASSERT_EQ(big.substr(50000, 100), value);
+  ASSERT_GT(env_->read_bytes_counter_.Read(), 0);
+  ASSERT_LT(env_->read_bytes_counter_.Read(), 1000);
+
+  ASSERT_OK(db_->GetRange(ReadOptions(), "big", 99990, 100, &value));
+  ASSERT_EQ(big.substr(99990), value);
+  ASSERT_OK(db_->GetRange(ReadOptions(), "big", 200000, 10, &value));
+  ASSERT_EQ("", value);
+  ASSERT_OK(db_->GetRange(ReadOptions(), "a", 1, 3, &value));
+  ASSERT_EQ("mal", value);
+  ASSERT_TRUE(db_->GetRange(ReadOptions(), "b", 0, 10, &value).IsNotFound());
+
+  // Checksum verification needs the whole block
+  ReadOptions verify;
+  verify.verify_checksums = true;
+  env_->read_bytes_counter_.Reset();
+  ASSERT_OK(db_->GetRange(verify, "big", 50000, 100, &value));
+  ASSERT_EQ(big.substr(50000, 100), value);
+  ASSERT_GT(env_->read_bytes_counter_.Read(), 100000);
+  ASSERT_EQ(big, Get("big"));
+  ASSERT_EQ("small", Get("z"));
+}
+
 TEST(DBTest, GetMemUsage) {
   do {
     ASSERT_OK(Put("foo", "v1"));
@@ -629,6 +781,223 @@ TEST(DBTest, GetSnapshot) {
   } while (ChangeOptions());
 }
 
+namespace {
+
+// Collects the results of asynchronous lookups
+struct AsyncResults {
+  port::Mutex mu;
+  port::CondVar cv;
+  int pending;
+  std::map<int, std::string> results;  // Value or "NOT_FOUND", by index
+
+  explicit AsyncResults(int n) : cv(&mu), pending(n) { }
+
+  void Add(int index, const Status& s, const Slice& value) {
+    MutexLock l(&mu);
+    results[index] = s.ok() ? value.ToString() :
+        (s.IsNotFound() ? "NOT_FOUND" : s.ToString());
+    pending--;
+    cv.SignalAll();
+  }
+
+  void Wait() {
+    MutexLock l(&mu);
+    while (pending > 0) {
+      cv.Wait();
+    }
+  }
+};
+
+static void AsyncGetDone(void* arg, const Status& s, const Slice& value) {
+  reinterpret_cast<AsyncResults*>(arg)->Add(0, s, value);
+}
+
+static void AsyncMultiGetDone(void* arg, int index, const Status& s,
+                              const Slice& value) {
+  reinterpret_cast<AsyncResults*>(arg)->Add(index, s, value);
+}
+
+}  // namespace
+
+TEST(DBTest, GetAsync) {
+  do {
+    ASSERT_OK(Put("disk", "v1"));
+    ASSERT_OK(Put("gone", "v1"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("mem", "v2"));
+    ASSERT_OK(Delete("gone"));
+
+    const char* keys[] = { "disk", "mem", "gone", "missing" };
+    const char* expected[] = { "v1", "v2", "NOT_FOUND", "NOT_FOUND" };
+    for (int i = 0; i < 4; i++) {
+      AsyncResults r(1);
+      db_->GetAsync(ReadOptions(), keys[i], &AsyncGetDone, &r);
+      r.Wait();
+      ASSERT_EQ(expected[i], r.results[0]);
+    }
+
+    Slice key_slices[4];
+    for (int i = 0; i < 4; i++) {
+      key_slices[i] = keys[i];
+    }
+    AsyncResults r(4);
+    db_->MultiGetAsync(ReadOptions(), 4, key_slices, &AsyncMultiGetDone, &r);
+    r.Wait();
+    for (int i = 0; i < 4; i++) {
+      ASSERT_EQ(expected[i], r.results[i]);
+    }
+  } while (ChangeOptions());
+}
+
+namespace {
+
+// Keeps a thread of the read pool busy until released
+struct AsyncBlocker {
+  port::Mutex mu;
+  port::CondVar cv;
+  bool entered;
+  bool released;
+
+  AsyncBlocker() : cv(&mu), entered(false), released(false) { }
+
+  void WaitForEntry() {
+    MutexLock l(&mu);
+    while (!entered) {
+      cv.Wait();
+    }
+  }
+
+  void Release() {
+    MutexLock l(&mu);
+    released = true;
+    cv.SignalAll();
+  }
+};
+
+static void AsyncBlock(void* arg, const Status& s, const Slice& value) {
+  AsyncBlocker* blocker = reinterpret_cast<AsyncBlocker*>(arg);
+  MutexLock l(&blocker->mu);
+  blocker->entered = true;
+  blocker->cv.SignalAll();
+  while (!blocker->released) {
+    blocker->cv.Wait();
+  }
+}
+
+}  // namespace
+
+TEST(DBTest, AsyncReadsKeepTheirState) {
+  Options options = CurrentOptions();
+  options.async_read_threads = 1;
+  Reopen(&options);
+  ASSERT_OK(Put("z", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("b", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  Reopen(&options);  // Empties the table and block caches
+
+  // The lookups below wait in the queue of the only reader thread
+  AsyncBlocker blocker;
+  db_->GetAsync(ReadOptions(), "z", &AsyncBlock, &blocker);
+  blocker.WaitForEntry();
+  AsyncResults single(1);
+  db_->GetAsync(ReadOptions(), "a", &AsyncGetDone, &single);
+  Slice keys[2] = { "a", "b" };
+  AsyncResults multi(2);
+  db_->MultiGetAsync(ReadOptions(), 2, keys, &AsyncMultiGetDone, &multi);
+
+  ASSERT_OK(Put("a", "v2"));
+  ASSERT_OK(Put("b", "v2"));
+  dbfull()->TEST_CompactMemTable();
+  blocker.Release();
+  single.Wait();
+  multi.Wait();
+  ASSERT_EQ("v1", single.results[0]);
+  ASSERT_EQ("v1", multi.results[0]);
+  ASSERT_EQ("v1", multi.results[1]);
+  ASSERT_EQ("v2", Get("a"));
+}
+
+TEST(DBTest, BlockCacheTier) {
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("b", "vb"));
+  dbfull()->TEST_CompactMemTable();
+  Reopen();  // Empties the table and block caches
+  ASSERT_OK(Put("m", "vm"));
+
+  ReadOptions cache_only;
+  cache_only.read_tier = kBlockCacheTier;
+  std::string value;
+  ASSERT_TRUE(db_->Get(cache_only, "a", &value).IsIncomplete());
+  ASSERT_OK(db_->Get(cache_only, "m", &value));
+  ASSERT_EQ("vm", value);
+
+  Iterator* iter = db_->NewIterator(cache_only);
+  iter->SeekToFirst();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(iter->status().IsIncomplete());
+  delete iter;
+
+  // Reading the block through the normal tier caches it
+  ASSERT_EQ("va", Get("a"));
+  ASSERT_OK(db_->Get(cache_only, "b", &value));
+  ASSERT_EQ("vb", value);
+  iter = db_->NewIterator(cache_only);
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "m->vm");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  ASSERT_OK(iter->status());
+  delete iter;
+
+  // Once the table is open, a data block that is not cached still needs
+  // a read from the file.  Copying reads keep the table from being
+  // treated as memory-resident.
+  env_->copy_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_size = 1024;  // One value per block
+  Reopen(&options);
+  ASSERT_OK(Put("x1", std::string(2000, '1')));
+  ASSERT_OK(Put("x2", std::string(2000, '2')));
+  dbfull()->TEST_CompactMemTable();
+  Reopen(&options);
+  ASSERT_EQ(std::string(2000, '1'), Get("x1"));
+  ASSERT_OK(db_->Get(cache_only, "x1", &value));
+  ASSERT_EQ(std::string(2000, '1'), value);
+  ASSERT_TRUE(db_->Get(cache_only, "x2", &value).IsIncomplete());
+}
+
+TEST(DBTest, ReadDeadline) {
+  ASSERT_OK(Put("a", "va"));
+  dbfull()->TEST_CompactMemTable();
+  Reopen();  // Empties the table cache
+  ASSERT_OK(Put("m", "vm"));
+
+  ReadOptions expired;
+  expired.deadline = 1;
+  std::string value;
+  ASSERT_TRUE(db_->Get(expired, "a", &value).IsTimedOut());
+  ASSERT_OK(db_->Get(expired, "m", &value));
+  ASSERT_EQ("vm", value);
+
+  Iterator* iter = db_->NewIterator(expired);
+  iter->SeekToFirst();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(iter->status().IsTimedOut());
+  delete iter;
+
+  ReadOptions in_time;
+  in_time.deadline = env_->NowMicros() + 60 * 1000000;
+  ASSERT_OK(db_->Get(in_time, "a", &value));
+  ASSERT_EQ("va", value);
+}
+
 TEST(DBTest, GetLevel0Ordering) {
   do {
     // Check that we process level-0 files in correct order.  The code
@@ -901,6 +1270,101 @@ TEST(DBTest, IterMultiWithDelete) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, IterManyFiles) {
+  // Builds an iterator tree with a child per level-0 file and per level,
+  // and keeps it alive across a compaction that replaces those files.
+  ASSERT_OK(Put("a", "v0"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  for (int i = 0; i < 8; i++) {
+    char key[10];
+    snprintf(key, sizeof(key), "k%d", i);
+    ASSERT_OK(Put(key, "v1"));
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_OK(Put("z", "v2"));
+
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  ASSERT_OK(iter->status());
+  ASSERT_EQ(10, count);
+  iter->Seek("k3");
+  ASSERT_EQ(IterStatus(iter), "k3->v1");
+  iter->SeekToLast();
+  ASSERT_EQ(IterStatus(iter), "z->v2");
+  delete iter;
+}
+
+TEST(DBTest, IterRefresh) {
+  ASSERT_OK(Put("a", "va"));
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ReadOptions options;
+  options.snapshot = snapshot;
+  Iterator* iter = db_->NewIterator(options);
+  ASSERT_OK(Put("b", "vb"));
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+  // Same memtable and version: only the sequence number moves
+  ASSERT_OK(iter->Refresh());
+  ASSERT_TRUE(!iter->Valid());
+  iter->SeekToLast();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  db_->ReleaseSnapshot(snapshot);
+
+  // New memtable and version: the iterator tree is rebuilt
+  ASSERT_OK(Delete("a"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("c", "vc"));
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  ASSERT_OK(iter->Refresh());
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "c->vc");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  delete iter;
+}
+
+TEST(DBTest, TailingIterator) {
+  ReadOptions options;
+  options.tailing = true;
+  Iterator* iter = db_->NewIterator(options);
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+  ASSERT_OK(Put("k1", "v1"));
+  ASSERT_OK(Put("k2", "v2"));
+  iter->Seek("k1");
+  ASSERT_EQ(IterStatus(iter), "k1->v1");
+
+  // Appended while positioned
+  ASSERT_OK(Put("k3", "v3"));
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "k2->v2");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "k3->v3");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+  // Written to a new memtable
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("k4", "v4"));
+  iter->Seek("k3");
+  ASSERT_EQ(IterStatus(iter), "k3->v3");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "k4->v4");
+  delete iter;
+}
+
 TEST(DBTest, Recover) {
   do {
     ASSERT_OK(Put("foo", "v1"));
@@ -964,67 +1428,385 @@ static std::string Key(int i) {
   return std::string(buf);
 }
 
-TEST(DBTest, MinorCompactionsHappen) {
+TEST(DBTest, PinnedIteration) {
   Options options = CurrentOptions();
-  options.write_buffer_size = 10000;
+  options.block_size = 256;             // Many data blocks
+  options.block_restart_interval = 1;   // No prefix compression
   Reopen(&options);
-
-  const int N = 500;
-
-  int starting_num_tables = TotalTableFiles();
-  for (int i = 0; i < N; i++) {
-    ASSERT_OK(Put(Key(i), Key(i) + std::string(1000, 'v')));
+  for (int i = 0; i < 200; i++) {
+    ASSERT_OK(Put(Key(i), Key(i) + "_value"));
   }
-  int ending_num_tables = TotalTableFiles();
-  ASSERT_GT(ending_num_tables, starting_num_tables);
-
-  for (int i = 0; i < N; i++) {
-    ASSERT_EQ(Key(i) + std::string(1000, 'v'), Get(Key(i)));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put(Key(200), Key(200) + "_value"));
+
+  ReadOptions pinned;
+  pinned.pin_data = true;
+  std::vector<Slice> keys, values;
+  Iterator* iter = db_->NewIterator(pinned);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_TRUE(iter->IsKeyPinned());
+    keys.push_back(iter->key());
+    values.push_back(iter->value());
+  }
+  ASSERT_OK(iter->status());
+  ASSERT_EQ(201, static_cast<int>(keys.size()));
+  for (int i = 0; i < 201; i++) {
+    ASSERT_EQ(Key(i), keys[i].ToString());
+    ASSERT_EQ(Key(i) + "_value", values[i].ToString());
+  }
+
+  keys.clear();
+  values.clear();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    ASSERT_TRUE(iter->IsKeyPinned());
+    keys.push_back(iter->key());
+    values.push_back(iter->value());
+  }
+  ASSERT_EQ(201, static_cast<int>(keys.size()));
+  for (int i = 0; i < 201; i++) {
+    ASSERT_EQ(Key(200 - i), keys[i].ToString());
+    ASSERT_EQ(Key(200 - i) + "_value", values[i].ToString());
   }
+  delete iter;
 
-  Reopen();
-
-  for (int i = 0; i < N; i++) {
-    ASSERT_EQ(Key(i) + std::string(1000, 'v'), Get(Key(i)));
-  }
+  iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_TRUE(!iter->IsKeyPinned());
+  delete iter;
 }
 
-TEST(DBTest, RecoverWithLargeLog) {
-  {
+TEST(DBTest, MemoryAllocator) {
+  MemoryAllocator* allocator = NewSizeClassAllocator(false);
+  for (int copy = 0; copy < 2; copy++) {
+    // Use both mmapped reads and reads into caller memory
     Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.memory_allocator = allocator;
+    options.filter_policy = NewBloomFilterPolicy(10);
+    TableReadMode reads(this, &options, copy == 1);
+    DestroyAndReopen(&options);
+    Random rnd(301);
+    std::vector<std::string> values;
+    for (int i = 0; i < 1000; i++) {
+      values.push_back(RandomString(&rnd, 100));
+      ASSERT_OK(Put(Key(i), values[i]));
+    }
+    dbfull()->TEST_CompactMemTable();
     Reopen(&options);
-    ASSERT_OK(Put("big1", std::string(200000, '1')));
-    ASSERT_OK(Put("big2", std::string(200000, '2')));
-    ASSERT_OK(Put("small3", std::string(10, '3')));
-    ASSERT_OK(Put("small4", std::string(10, '4')));
-    ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_EQ(values[i], Get(Key(i)));
+    }
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      ASSERT_EQ(values[count], iter->value().ToString());
+      count++;
+    }
+    ASSERT_EQ(1000, count);
+    delete iter;
+    std::string stats;
+    ASSERT_TRUE(db_->GetProperty("leveldb.memory-allocator-stats", &stats));
+    ASSERT_NE(std::string::npos, stats.find("Fragmentation"));
+    Close();
+    delete options.filter_policy;
   }
+  delete allocator;
 
-  // Make sure that if we re-open with a small write buffer size that
-  // we flush table files in the middle of a large log file.
-  Options options = CurrentOptions();
-  options.write_buffer_size = 100000;
-  Reopen(&options);
-  ASSERT_EQ(NumTableFilesAtLevel(0), 3);
-  ASSERT_EQ(std::string(200000, '1'), Get("big1"));
-  ASSERT_EQ(std::string(200000, '2'), Get("big2"));
-  ASSERT_EQ(std::string(10, '3'), Get("small3"));
-  ASSERT_EQ(std::string(10, '4'), Get("small4"));
-  ASSERT_GT(NumTableFilesAtLevel(0), 1);
+  Reopen();
+  std::string stats;
+  ASSERT_TRUE(!db_->GetProperty("leveldb.memory-allocator-stats", &stats));
 }
 
-TEST(DBTest, CompactionsGenerateMultipleFiles) {
-  Options options = CurrentOptions();
-  options.write_buffer_size = 100000000;        // Large write buffer
-  Reopen(&options);
-
-  Random rnd(301);
+// Check reads of a DB whose tables are written by "factory", which
+// ends them with "magic"
+static void CheckTableFormat(DBTest* t, TableFactory* factory,
+                             uint64_t magic) {
+  for (int copy = 0; copy < 2; copy++) {
+    // Use both mmapped tables and tables copied into memory
+    Options options = t->CurrentOptions();
+    options.create_if_missing = true;
+    options.table_factory = factory;
+    TableReadMode reads(t, &options, copy == 1);
+    t->DestroyAndReopen(&options);
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_OK(t->Put(Key(i), "v1." + Key(i)));
+    }
+    const Snapshot* snapshot = t->db_->GetSnapshot();
+    for (int i = 0; i < 1000; i += 2) {
+      ASSERT_OK(t->Put(Key(i), "v2." + Key(i)));
+    }
+    for (int i = 0; i < 1000; i += 3) {
+      ASSERT_OK(t->Delete(Key(i)));
+    }
+    t->dbfull()->TEST_CompactMemTable();
 
-  // Write 8MB (80 values, each 100K)
-  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
-  std::vector<std::string> values;
-  for (int i = 0; i < 80; i++) {
-    values.push_back(RandomString(&rnd, 100000));
+    // Check the format of the table
+    std::vector<std::string> filenames;
+    ASSERT_OK(t->env_->GetChildren(t->dbname_, &filenames));
+    uint64_t number;
+    FileType type;
+    int tables = 0;
+    for (size_t i = 0; i < filenames.size(); i++) {
+      if (ParseFileName(filenames[i], &number, &type) && type == kTableFile) {
+        std::string contents;
+        ASSERT_OK(ReadFileToString(
+            t->env_, TableFileName(t->dbname_, number), &contents));
+        ASSERT_GE(contents.size(), 8u);
+        ASSERT_EQ(magic,
+                  DecodeFixed64(contents.data() + contents.size() - 8));
+        tables++;
+      }
+    }
+    ASSERT_EQ(1, tables);
+
+    ReadOptions snapshot_options;
+    snapshot_options.snapshot = snapshot;
+    for (int i = 0; i < 1000; i++) {
+      if (i % 3 == 0) {
+        ASSERT_EQ("NOT_FOUND", t->Get(Key(i)));
+      } else if (i % 2 == 0) {
+        ASSERT_EQ("v2." + Key(i), t->Get(Key(i)));
+      } else {
+        ASSERT_EQ("v1." + Key(i), t->Get(Key(i)));
+      }
+      std::string value;
+      ASSERT_OK(t->db_->Get(snapshot_options, Key(i), &value));
+      ASSERT_EQ("v1." + Key(i), value);
+    }
+    ASSERT_EQ("NOT_FOUND", t->Get("missing"));
+    t->db_->ReleaseSnapshot(snapshot);
+
+    // Compaction drops the overwritten entries
+    t->db_->CompactRange(NULL, NULL);
+    Iterator* iter = t->db_->NewIterator(ReadOptions());
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      count++;
+    }
+    ASSERT_EQ(666, count);
+    iter->Seek(Key(500));
+    ASSERT_EQ(Key(500), iter->key().ToString());
+    iter->Prev();
+    ASSERT_EQ(Key(499), iter->key().ToString());
+    iter->Prev();
+    ASSERT_EQ(Key(497), iter->key().ToString());
+    delete iter;
+    ASSERT_EQ("v2." + Key(998), t->Get(Key(998)));
+    ASSERT_EQ("NOT_FOUND", t->Get(Key(999)));
+    t->Close();
+  }
+}
+
+TEST(DBTest, PlainTable) {
+  TableFactory* factory = NewPlainTableFactory(16);
+  CheckTableFormat(this, factory, kPlainTableMagicNumber);
+  delete factory;
+}
+
+TEST(DBTest, CuckooTable) {
+  TableFactory* factory = NewCuckooTableFactory();
+  CheckTableFormat(this, factory, kCuckooTableMagicNumber);
+
+  // Enough keys that placing them takes many evictions
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.table_factory = factory;
+  options.write_buffer_size = 10 << 20;
+  DestroyAndReopen(&options);
+  for (int i = 0; i < 50000; i++) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 0; i < 50000; i++) {
+    ASSERT_EQ(Key(i), Get(Key(i)));
+    ASSERT_EQ("NOT_FOUND", Get(Key(i) + "x"));
+  }
+  Close();
+  delete factory;
+}
+
+// Collects the entries seen by ParallelScan(), by partition
+struct ScanResults {
+  port::Mutex mu;
+  std::map<int, std::vector<std::string> > keys;
+};
+
+static bool ScanCollect(void* arg, int partition, const Slice& key,
+                        const Slice& value) {
+  ScanResults* results = reinterpret_cast<ScanResults*>(arg);
+  MutexLock l(&results->mu);
+  results->keys[partition].push_back(key.ToString());
+  return true;
+}
+
+TEST(DBTest, ParallelScan) {
+  const int kNum = 1000;
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_OK(Put(Key(i), std::string(1000, 'v')));
+    if (i % 250 == 249) {
+      dbfull()->TEST_CompactMemTable();
+    }
+  }
+
+  std::vector<std::string> boundaries;
+  db_->GetPartitionBoundaries(NULL, NULL, 4, &boundaries);
+  ASSERT_EQ(3, boundaries.size());
+  for (size_t i = 1; i < boundaries.size(); i++) {
+    ASSERT_LT(boundaries[i - 1], boundaries[i]);
+  }
+  db_->GetPartitionBoundaries(NULL, NULL, 1, &boundaries);
+  ASSERT_TRUE(boundaries.empty());
+
+  const std::string begin_key = Key(100);
+  const std::string end_key = Key(900);
+  const Slice begin = begin_key;
+  const Slice end = end_key;
+  ScanResults results;
+  ASSERT_OK(db_->ParallelScan(ReadOptions(), &begin, &end, 4,
+                              &ScanCollect, &results));
+  ASSERT_EQ(4, results.keys.size());
+  int count = 0;
+  std::string last = begin_key;
+  for (int p = 0; p < 4; p++) {
+    const std::vector<std::string>& keys = results.keys[p];
+    // Each partition holds about a quarter of the range
+    ASSERT_GT(keys.size(), 100);
+    ASSERT_LT(keys.size(), 300);
+    ASSERT_LE(last, keys.front());
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(Key(100 + count), keys[i]);
+      count++;
+    }
+    last = keys.back();
+  }
+  ASSERT_EQ(800, count);
+}
+
+TEST(DBTest, NewIteratorsShareState) {
+  ASSERT_OK(Put("a", "v1"));
+  Iterator* iters[3];
+  db_->NewIterators(ReadOptions(), 3, iters);
+  ASSERT_OK(Put("a", "v2"));
+  ASSERT_OK(Put("b", "v2"));
+  for (int i = 0; i < 3; i++) {
+    iters[i]->SeekToFirst();
+    ASSERT_EQ(IterStatus(iters[i]), "a->v1");
+    iters[i]->Next();
+    ASSERT_EQ(IterStatus(iters[i]), "(invalid)");
+    delete iters[i];
+  }
+}
+
+TEST(DBTest, MinorCompactionsHappen) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 10000;
+  Reopen(&options);
+
+  const int N = 500;
+
+  int starting_num_tables = TotalTableFiles();
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), Key(i) + std::string(1000, 'v')));
+  }
+  int ending_num_tables = TotalTableFiles();
+  ASSERT_GT(ending_num_tables, starting_num_tables);
+
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i) + std::string(1000, 'v'), Get(Key(i)));
+  }
+
+  Reopen();
+
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i) + std::string(1000, 'v'), Get(Key(i)));
+  }
+}
+
+TEST(DBTest, PreparedMemTableSwitch) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 10000;
+  Reopen(&options);
+
+  // A prepared log file is only given up by a memtable switch, so seeing
+  // several distinct ones means the switches used them.
+  const int N = 500;
+  std::set<uint64_t> prepared;
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), Key(i) + std::string(1000, 'v')));
+    const uint64_t number = dbfull()->TEST_PreparedLogNumber();
+    if (number != 0) {
+      ASSERT_TRUE(env_->FileExists(LogFileName(dbname_, number)));
+      prepared.insert(number);
+    }
+  }
+  ASSERT_GE(prepared.size(), 3u);
+
+  // Fill the current memtable past the point where the next log file is
+  // prepared, but not far enough to switch to it.
+  uint64_t pending = 0;
+  int overwritten = 0;
+  while (pending == 0 && overwritten < N) {
+    ASSERT_OK(Put(Key(overwritten), Key(overwritten) + std::string(1000, 'w')));
+    overwritten++;
+    pending = dbfull()->TEST_PreparedLogNumber();
+  }
+  ASSERT_NE(pending, 0u);
+  const std::string pending_log = LogFileName(dbname_, pending);
+  ASSERT_TRUE(env_->FileExists(pending_log));
+
+  // Closing removes the unused log file
+  Close();
+  ASSERT_TRUE(!env_->FileExists(pending_log));
+
+  // A crash would have left it behind, empty; recovery must replay the
+  // logs around it and then delete it.
+  ASSERT_OK(WriteStringToFile(env_, "", pending_log));
+  Reopen(&options);
+  ASSERT_TRUE(!env_->FileExists(pending_log));
+  for (int i = 0; i < N; i++) {
+    const char c = (i < overwritten) ? 'w' : 'v';
+    ASSERT_EQ(Key(i) + std::string(1000, c), Get(Key(i)));
+  }
+}
+
+TEST(DBTest, RecoverWithLargeLog) {
+  {
+    Options options = CurrentOptions();
+    Reopen(&options);
+    ASSERT_OK(Put("big1", std::string(200000, '1')));
+    ASSERT_OK(Put("big2", std::string(200000, '2')));
+    ASSERT_OK(Put("small3", std::string(10, '3')));
+    ASSERT_OK(Put("small4", std::string(10, '4')));
+    ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  }
+
+  // Make sure that if we re-open with a small write buffer size that
+  // we flush table files in the middle of a large log file.
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;
+  Reopen(&options);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 3);
+  ASSERT_EQ(std::string(200000, '1'), Get("big1"));
+  ASSERT_EQ(std::string(200000, '2'), Get("big2"));
+  ASSERT_EQ(std::string(10, '3'), Get("small3"));
+  ASSERT_EQ(std::string(10, '4'), Get("small4"));
+  ASSERT_GT(NumTableFilesAtLevel(0), 1);
+}
+
+TEST(DBTest, CompactionsGenerateMultipleFiles) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000000;        // Large write buffer
+  Reopen(&options);
+
+  Random rnd(301);
+
+  // Write 8MB (80 values, each 100K)
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  std::vector<std::string> values;
+  for (int i = 0; i < 80; i++) {
+    values.push_back(RandomString(&rnd, 100000));
     ASSERT_OK(Put(Key(i), values[i]));
   }
 
@@ -1265,6 +2047,12 @@ TEST(DBTest, HiddenValuesAreRemoved) {
   do {
     Random rnd(301);
     FillLevels("a", "z");
+    // FillLevels() leaves enough files in level 0 to trigger a background
+    // compaction.  Finish it now: if it is still running when "foo" has
+    // been flushed, it may compact that file while the snapshot below is
+    // live, keeping the hidden value in level 1 out of reach of the
+    // compaction of level 0 that follows.
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
 
     std::string big = RandomString(&rnd, 50000);
     Put("foo", big);
@@ -1292,6 +2080,409 @@ TEST(DBTest, HiddenValuesAreRemoved) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, HiddenValuesDroppedByMemTableFlush) {
+  do {
+    Put("foo", "v1");
+    Put("foo", "v2");
+    const Snapshot* snapshot = db_->GetSnapshot();
+    Put("foo", "v3");
+    Put("foo", "v4");
+    Delete("bar");
+    Put("bar", "v5");
+    ASSERT_EQ(AllEntriesFor("foo"), "[ v4, v3, v2, v1 ]");
+
+    // v1 and v3 are hidden from every live reader, v2 is pinned by snapshot
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_EQ(AllEntriesFor("foo"), "[ v4, v2 ]");
+    ASSERT_EQ(AllEntriesFor("bar"), "[ v5 ]");
+    ASSERT_EQ("v2", Get("foo", snapshot));
+    ASSERT_EQ("v4", Get("foo"));
+    db_->ReleaseSnapshot(snapshot);
+
+    Put("foo", "v6");
+    Put("foo", "v7");
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_EQ(AllEntriesFor("foo"), "[ v7, v4, v2 ]");
+    ASSERT_EQ("v7", Get("foo"));
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, HiddenValuesDroppedByCompaction) {
+  do {
+    Put("foo", "v1");
+    const Snapshot* s1 = db_->GetSnapshot();
+    Put("foo", "v2");
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    Put("foo", "v3");
+    const Snapshot* s2 = db_->GetSnapshot();
+    Put("foo", "v4");
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_EQ(AllEntriesFor("foo"), "[ v4, v3, v2, v1 ]");
+
+    // v2 and v3 lie between the same two snapshots, so v2 is hidden
+    // from every live reader
+    db_->CompactRange(NULL, NULL);
+    ASSERT_EQ(AllEntriesFor("foo"), "[ v4, v3, v1 ]");
+    ASSERT_EQ("v1", Get("foo", s1));
+    ASSERT_EQ("v3", Get("foo", s2));
+    ASSERT_EQ("v4", Get("foo"));
+    db_->ReleaseSnapshot(s1);
+    db_->ReleaseSnapshot(s2);
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, OverwrittenValuesKeptForSnapshots) {
+  Put("foo", "v1");
+  const Snapshot* s1 = db_->GetSnapshot();
+  Put("foo", "v2");
+  const Snapshot* s2 = db_->GetSnapshot();
+  Put("foo", "v3");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);
+
+  // Each snapshot still reads its own overwritten value
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ(AllEntriesFor("foo"), "[ v3, v2, v1 ]");
+
+  // Once s1 is gone, v1 and v2 lie below the same snapshot and only v2
+  // can still be read
+  db_->ReleaseSnapshot(s1);
+  dbfull()->TEST_CompactRange(last + 1, NULL, NULL);
+  ASSERT_EQ(AllEntriesFor("foo"), "[ v3, v2 ]");
+  ASSERT_EQ("v2", Get("foo", s2));
+  ASSERT_EQ("v3", Get("foo"));
+
+  db_->ReleaseSnapshot(s2);
+  dbfull()->TEST_CompactRange(last + 2, NULL, NULL);
+  ASSERT_EQ(AllEntriesFor("foo"), "[ v3 ]");
+}
+
+TEST(DBTest, SequenceZeroedAtBaseLevel) {
+  Put("a", "va");
+  Put("foo", "v1");
+  const Snapshot* snapshot = db_->GetSnapshot();
+  Put("foo", "v2");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ(NumTableFilesAtLevel(last + 1), 1);
+
+  // "a" is visible to every snapshot and nothing lives below it
+  std::vector<SequenceNumber> seqs;
+  Iterator* iter = dbfull()->TEST_NewInternalIterator();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    ASSERT_TRUE(ParseInternalKey(iter->key(), &ikey));
+    seqs.push_back(ikey.sequence);
+  }
+  delete iter;
+  ASSERT_EQ(3u, seqs.size());
+  ASSERT_EQ(0, seqs[0]);
+  ASSERT_GT(seqs[1], 0);      // foo => v2 is newer than the snapshot
+  ASSERT_EQ(0, seqs[2]);      // foo => v1 is the oldest visible version
+  ASSERT_EQ("va", Get("a"));
+  ASSERT_EQ("v1", Get("foo", snapshot));
+  ASSERT_EQ("v2", Get("foo"));
+  db_->ReleaseSnapshot(snapshot);
+
+  Put("a", "va2");
+  ASSERT_EQ("va2", Get("a"));
+  Reopen();
+  ASSERT_EQ("va2", Get("a"));
+  ASSERT_EQ("v2", Get("foo"));
+  dbfull()->TEST_CompactRange(last + 1, NULL, NULL);
+  ASSERT_EQ(AllEntriesFor("foo"), "[ v2 ]");
+  ASSERT_EQ("va2", Get("a"));
+  ASSERT_EQ("v2", Get("foo"));
+}
+
+TEST(DBTest, PartitionMemTableOutput) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100 << 20;  // Compactions are forced manually
+  options.max_file_size = 1 << 20;        // Pieces of at least 512KB
+  options.partition_memtable_output = true;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 300; i++) {
+    values.push_back(RandomString(&rnd, 10000));
+  }
+  char key[10];
+  for (int i = 100; i < 200; i++) {
+    snprintf(key, sizeof(key), "k%03d", i);
+    ASSERT_OK(Put(key, values[i]));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ("0,0,1", FilesPerLevel());
+
+  // Keys below the existing file form their own table, which does not
+  // overlap anything and is pushed to the last level.  The rest of the
+  // memtable overlaps the existing file and stays above it.
+  for (int i = 0; i < 300; i++) {
+    if (i < 100 || i >= 200 || i == 150) {
+      snprintf(key, sizeof(key), "k%03d", i);
+      ASSERT_OK(Put(key, values[i]));
+    }
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(2, NumTableFilesAtLevel(last));
+  ASSERT_EQ(1, NumTableFilesAtLevel(last - 1));
+
+  for (int i = 0; i < 300; i++) {
+    snprintf(key, sizeof(key), "k%03d", i);
+    ASSERT_EQ(values[i], Get(key));
+  }
+  Reopen(&options);
+  for (int i = 0; i < 300; i++) {
+    snprintf(key, sizeof(key), "k%03d", i);
+    ASSERT_EQ(values[i], Get(key));
+  }
+}
+
+namespace {
+// Counts jobs and hands them to another service, or fails them all
+// when "target" is NULL.
+class CountingCompactionService : public CompactionService {
+ public:
+  explicit CountingCompactionService(CompactionService* target)
+      : target_(target) { }
+  virtual Status Compact(const std::string& dbname, const std::string& job,
+                         std::string* result) {
+    jobs_.Increment();
+    if (target_ == NULL) {
+      return Status::IOError("compaction service unavailable");
+    }
+    return target_->Compact(dbname, job, result);
+  }
+  int jobs() { return jobs_.Read(); }
+
+ private:
+  CompactionService* target_;
+  AtomicCounter jobs_;
+};
+
+// Quote "s" as a single word for the shell
+static std::string ShellQuote(const std::string& s) {
+  std::string result = "'";
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '\'') {
+      result += "'\\''";
+    } else {
+      result += s[i];
+    }
+  }
+  result += "'";
+  return result;
+}
+
+// Runs each job in a "leveldbutil compact" worker process.
+class WorkerProcessCompactionService : public CompactionService {
+ public:
+  explicit WorkerProcessCompactionService(const std::string& program)
+      : program_(program) { }
+  virtual Status Compact(const std::string& dbname, const std::string& job,
+                         std::string* result) {
+    const std::string job_file = test::TmpDir() + "/db_test_compaction_job";
+    Status s = WriteStringToFile(Env::Default(), job, job_file);
+    if (!s.ok()) {
+      return s;
+    }
+    const std::string command = ShellQuote(program_) + " compact " +
+                                ShellQuote(dbname) + " < " +
+                                ShellQuote(job_file);
+    FILE* worker = popen(command.c_str(), "r");
+    if (worker == NULL) {
+      return Status::IOError(command, strerror(errno));
+    }
+    result->clear();
+    char buf[8192];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), worker)) > 0) {
+      result->append(buf, n);
+    }
+    if (pclose(worker) != 0) {
+      return Status::IOError(command, "worker failed");
+    }
+    return Status::OK();
+  }
+
+ private:
+  const std::string program_;
+};
+}  // namespace
+
+// Write two overlapping generations of keys and compact them from the
+// level they were flushed to into the next one.
+static void CompactTwoGenerations(DBTest* t, std::vector<std::string>* values) {
+  Random rnd(301);
+  char key[10];
+  for (int pass = 0; pass < 2; pass++) {
+    values->clear();
+    for (int i = 0; i < 500; i++) {
+      values->push_back(RandomString(&rnd, 10000));
+      snprintf(key, sizeof(key), "k%03d", i);
+      ASSERT_OK(t->Put(key, (*values)[i]));
+    }
+    ASSERT_OK(t->dbfull()->TEST_CompactMemTable());
+  }
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ("0,1,1", t->FilesPerLevel());
+  t->dbfull()->TEST_CompactRange(last - 1, NULL, NULL);
+  ASSERT_EQ(0, t->NumTableFilesAtLevel(last - 1));
+  ASSERT_GT(t->NumTableFilesAtLevel(last), 3);
+}
+
+static void CheckTwoGenerations(DBTest* t,
+                                const std::vector<std::string>& values) {
+  char key[10];
+  for (int i = 0; i < 500; i++) {
+    snprintf(key, sizeof(key), "k%03d", i);
+    ASSERT_EQ(values[i], t->Get(key));
+  }
+}
+
+TEST(DBTest, PipelinedCompaction) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100 << 20;  // Compactions are forced manually
+  options.max_file_size = 1 << 20;        // Several output files
+  options.pipelined_compaction = true;
+  Reopen(&options);
+
+  std::vector<std::string> values;
+  CompactTwoGenerations(this, &values);
+  CheckTwoGenerations(this, values);
+  Reopen(&options);
+  CheckTwoGenerations(this, values);
+}
+
+TEST(DBTest, CompactionService) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100 << 20;  // Compactions are forced manually
+  options.max_file_size = 1 << 20;        // Several output files
+  CompactionService* local = NewLocalCompactionService(options);
+  CountingCompactionService service(local);
+  options.compaction_service = &service;
+  Reopen(&options);
+
+  std::vector<std::string> values;
+  CompactTwoGenerations(this, &values);
+  ASSERT_EQ(1, service.jobs());
+  CheckTwoGenerations(this, values);
+  Reopen(&options);
+  CheckTwoGenerations(this, values);
+
+  Close();
+  delete local;
+}
+
+TEST(DBTest, CompactionServiceFailure) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100 << 20;
+  options.max_file_size = 1 << 20;
+  CountingCompactionService service(NULL);
+  options.compaction_service = &service;
+  Reopen(&options);
+
+  // The compaction falls back to running locally
+  std::vector<std::string> values;
+  CompactTwoGenerations(this, &values);
+  ASSERT_EQ(1, service.jobs());
+  CheckTwoGenerations(this, values);
+  Close();
+}
+
+TEST(DBTest, CompactionServiceWorkerProcess) {
+  const std::string program = LEVELDBUTIL_PATH;
+  ASSERT_TRUE(env_->FileExists(program)) << program << " not built";
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100 << 20;
+  options.max_file_size = 1 << 20;
+  WorkerProcessCompactionService worker(program);
+  CountingCompactionService service(&worker);
+  options.compaction_service = &service;
+  Reopen(&options);
+
+  std::vector<std::string> values;
+  CompactTwoGenerations(this, &values);
+  ASSERT_EQ(1, service.jobs());
+  CheckTwoGenerations(this, values);
+  Reopen(&options);
+  CheckTwoGenerations(this, values);
+  Close();
+}
+
+namespace {
+struct CompactRangeThread {
+  DB* db;
+  CompactionHandle* handle;
+  Status status;
+  port::AtomicPointer done;
+};
+
+static void RunCompactRange(void* arg) {
+  CompactRangeThread* t = reinterpret_cast<CompactRangeThread*>(arg);
+  t->status = t->db->CompactRange(NULL, NULL, t->handle);
+  t->done.Release_Store(t);
+}
+}  // namespace
+
+TEST(DBTest, CompactRangeCancel) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 100 << 20;  // Compactions are forced manually
+  options.max_file_size = 1 << 20;        // Several output files
+  Reopen(&options);
+
+  Random rnd(301);
+  char key[10];
+  std::vector<std::string> values;
+  for (int pass = 0; pass < 2; pass++) {
+    values.clear();
+    for (int i = 0; i < 500; i++) {
+      values.push_back(RandomString(&rnd, 10000));
+      snprintf(key, sizeof(key), "k%03d", i);
+      ASSERT_OK(Put(key, values[i]));
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ("0,1,1", FilesPerLevel());
+
+  // Cancelled before it starts: nothing happens
+  CompactionHandle cancelled;
+  cancelled.Cancel();
+  ASSERT_TRUE(db_->CompactRange(NULL, NULL, &cancelled).IsIncomplete());
+  ASSERT_EQ("0,1,1", FilesPerLevel());
+
+  // Cancelled while the first output file is being synced
+  CompactionHandle handle;
+  CompactRangeThread thread;
+  thread.db = db_;
+  thread.handle = &handle;
+  thread.done.Release_Store(NULL);
+  env_->delay_data_sync_.Release_Store(env_);
+  env_->StartThread(&RunCompactRange, &thread);
+  DelayMilliseconds(100);
+  handle.Cancel();
+  env_->delay_data_sync_.Release_Store(NULL);
+  while (thread.done.Acquire_Load() == NULL) {
+    DelayMilliseconds(10);
+  }
+  ASSERT_TRUE(thread.status.IsIncomplete());
+  ASSERT_EQ("0,1,1", FilesPerLevel());
+  CheckTwoGenerations(this, values);
+
+  // Cancelling is not an error: the DB can still compact
+  CompactionHandle fresh;
+  ASSERT_OK(db_->CompactRange(NULL, NULL, &fresh));
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  ASSERT_GT(NumTableFilesAtLevel(2), 3);
+  CheckTwoGenerations(this, values);
+}
+
 TEST(DBTest, DeletionMarkers1) {
   Put("foo", "v1");
   ASSERT_OK(dbfull()->TEST_CompactMemTable());
@@ -1306,10 +2497,13 @@ TEST(DBTest, DeletionMarkers1) {
   ASSERT_EQ(NumTableFilesAtLevel(last-1), 1);
 
   Delete("foo");
+  const Snapshot* snapshot = db_->GetSnapshot();
   Put("foo", "v2");
   ASSERT_EQ(AllEntriesFor("foo"), "[ v2, DEL, v1 ]");
   ASSERT_OK(dbfull()->TEST_CompactMemTable());  // Moves to level last-2
+  // DEL kept by the memtable flush since the snapshot can still see it
   ASSERT_EQ(AllEntriesFor("foo"), "[ v2, DEL, v1 ]");
+  db_->ReleaseSnapshot(snapshot);
   Slice z("z");
   dbfull()->TEST_CompactRange(last-2, NULL, &z);
   // DEL eliminated, but v1 remains because we aren't compacting that level
@@ -1806,6 +3000,73 @@ TEST(DBTest, FilesDeletedAfterCompaction) {
   ASSERT_EQ(CountFiles(), num_files);
 }
 
+TEST(DBTest, FilesDeletedAtLimitedRate) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.delete_rate_bytes_per_sec = 1 << 20;
+  options.delete_truncate_step = 64 << 10;
+  Reopen(&options);
+
+  Random rnd(301);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 100000)));
+  }
+  Compact("a", "z");
+  dbfull()->TEST_WaitForDeletions();
+  std::vector<std::string> old_files;
+  std::vector<std::string> children;
+  env_->GetChildren(dbname_, &children);
+  uint64_t number;
+  FileType type;
+  uint64_t old_bytes = 0;
+  for (size_t i = 0; i < children.size(); i++) {
+    if (ParseFileName(children[i], &number, &type) && type == kTableFile) {
+      old_files.push_back(dbname_ + "/" + children[i]);
+      uint64_t size;
+      ASSERT_OK(env_->GetFileSize(old_files.back(), &size));
+      old_bytes += size;
+    }
+  }
+  ASSERT_GT(old_files.size(), 0);
+  ASSERT_GT(old_bytes, options.delete_truncate_step);
+
+  // Overwriting every key makes the ~2MB of old tables obsolete.  The
+  // scheduler sleeps through the env after each truncation step, so
+  // holding the sleeps keeps the old files around and counting them
+  // shows the rate without depending on the clock.
+  env_->sleep_micros_counter_.Reset();
+  env_->fake_sleeps_.Release_Store(env_);
+  env_->hold_sleeps_.Release_Store(env_);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_OK(Put(Key(i), "v"));
+  }
+  Compact("a", "z");
+  int remaining = 0;
+  for (size_t i = 0; i < old_files.size(); i++) {
+    if (env_->FileExists(old_files[i])) {
+      remaining++;
+    }
+  }
+  ASSERT_GT(remaining, 0);
+
+  env_->hold_sleeps_.Release_Store(NULL);
+  dbfull()->TEST_WaitForDeletions();
+  env_->fake_sleeps_.Release_Store(NULL);
+  for (size_t i = 0; i < old_files.size(); i++) {
+    ASSERT_TRUE(!env_->FileExists(old_files[i])) << old_files[i];
+  }
+  // The scheduler must have slept as long as deleting old_bytes takes at
+  // the configured rate, less under a microsecond of rounding per sleep
+  const uint64_t expected_micros =
+      old_bytes * 1000000 / options.delete_rate_bytes_per_sec;
+  ASSERT_GE(static_cast<uint64_t>(env_->sleep_micros_counter_.Read()),
+            expected_micros - old_bytes / options.delete_truncate_step -
+                old_files.size());
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ("v", Get(Key(i)));
+  }
+}
+
 TEST(DBTest, BloomFilter) {
   env_->count_random_reads_ = true;
   Options options = CurrentOptions();
@@ -1853,6 +3114,40 @@ TEST(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
+TEST(DBTest, BlockAlignWithBloomFilter) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_align = true;
+  options.compression = kNoCompression;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewBloomFilterPolicy(10);
+  Reopen(&options);
+
+  // Values of varying size make the builder pad many blocks
+  Random rnd(301);
+  const int N = 5000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 1 + rnd.Uniform(300))));
+  }
+  db_->CompactRange(NULL, NULL);
+
+  // The filter of each block must be found at its padded offset
+  for (int i = 0; i < N; i++) {
+    std::string value;
+    ASSERT_OK(db_->Get(ReadOptions(), Key(i), &value)) << Key(i);
+  }
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+  }
+  ASSERT_LE(env_->random_read_counter_.Read(), 3*N/100);
+
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
 // Multi-threaded test:
 namespace {
 
@@ -1951,6 +3246,150 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+namespace {
+
+// Each thread overwrites its own key and checks that a snapshot taken
+// just before the write still sees the previous value.
+static void MTSnapshotThreadBody(void* arg) {
+  MTThread* t = reinterpret_cast<MTThread*>(arg);
+  int id = t->id;
+  DB* db = t->state->test->db_;
+  char keybuf[20];
+  snprintf(keybuf, sizeof(keybuf), "thread%d", id);
+  char valbuf[1500];
+  std::string value;
+  int counter = 0;
+  ASSERT_OK(db->Put(WriteOptions(), keybuf, "0"));
+  while (t->state->stop.Acquire_Load() == NULL) {
+    ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+    // Pad the values to force compactions
+    snprintf(valbuf, sizeof(valbuf), "%-1000d", counter + 1);
+    ASSERT_OK(db->Put(WriteOptions(), keybuf, valbuf));
+    ASSERT_OK(db->Get(options, keybuf, &value));
+    ASSERT_EQ(counter, atoi(value.c_str()));
+    db->ReleaseSnapshot(options.snapshot);
+    counter++;
+  }
+  t->state->thread_done[id].Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, MultiThreadedSnapshots) {
+  do {
+    MTState mt;
+    mt.test = this;
+    mt.stop.Release_Store(0);
+    for (int id = 0; id < kNumThreads; id++) {
+      mt.thread_done[id].Release_Store(0);
+    }
+
+    MTThread thread[kNumThreads];
+    for (int id = 0; id < kNumThreads; id++) {
+      thread[id].state = &mt;
+      thread[id].id = id;
+      env_->StartThread(MTSnapshotThreadBody, &thread[id]);
+    }
+
+    DelayMilliseconds(kTestSeconds * 1000);
+
+    mt.stop.Release_Store(&mt);
+    for (int id = 0; id < kNumThreads; id++) {
+      while (mt.thread_done[id].Acquire_Load() == NULL) {
+        DelayMilliseconds(100);
+      }
+    }
+  } while (ChangeOptions());
+}
+
+namespace {
+
+static const int kGroupWriters = 8;
+static const int kWritesPerGroupWriter = 20;
+static const int kGroupValueSize = 100000;
+
+struct GroupWriter {
+  DB* db;
+  int id;
+  port::AtomicPointer done;
+};
+
+static std::string GroupWriterKey(int id, int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "writer%d.%06d", id, i);
+  return std::string(buf);
+}
+
+static void GroupWriterBody(void* arg) {
+  GroupWriter* w = reinterpret_cast<GroupWriter*>(arg);
+  for (int i = 0; i < kWritesPerGroupWriter; i++) {
+    ASSERT_OK(w->db->Put(WriteOptions(), GroupWriterKey(w->id, i),
+                         std::string(kGroupValueSize, 'a' + w->id)));
+  }
+  w->done.Release_Store(w);
+}
+
+}  // namespace
+
+TEST(DBTest, WriteGroupsStayWithinLimit) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 64 << 20;  // Keep all writes in one memtable
+  Reopen(&options);
+
+  GroupWriter writers[kGroupWriters];
+  for (int id = 0; id < kGroupWriters; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].done.Release_Store(NULL);
+    env_->StartThread(GroupWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kGroupWriters; id++) {
+    while (writers[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  // Each group is logged as one record.  The group limit never exceeds
+  // 4MB, and a group whose first write is at most an eighth of the limit
+  // grows by at most another eighth, so no record may hold more than six
+  // of these writes although eight writers queue up.
+  WriteBatch batch;
+  batch.Put(GroupWriterKey(0, 0), std::string(kGroupValueSize, 'a'));
+  const size_t max_record = WriteBatchInternal::ByteSize(&batch) +
+                            (4 << 20) / 8;
+  int logged = 0;
+  std::vector<std::string> children;
+  ASSERT_OK(env_->GetChildren(dbname_, &children));
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < children.size(); i++) {
+    if (!ParseFileName(children[i], &number, &type) || type != kLogFile) {
+      continue;
+    }
+    SequentialFile* file;
+    ASSERT_OK(env_->NewSequentialFile(dbname_ + "/" + children[i], &file));
+    log::Reader reader(file, NULL, true, 0);
+    Slice record;
+    std::string scratch;
+    while (reader.ReadRecord(&record, &scratch)) {
+      ASSERT_LE(record.size(), max_record);
+      WriteBatchInternal::SetContents(&batch, record);
+      logged += WriteBatchInternal::Count(&batch);
+    }
+    delete file;
+  }
+  ASSERT_EQ(kGroupWriters * kWritesPerGroupWriter, logged);
+
+  Reopen(&options);
+  for (int id = 0; id < kGroupWriters; id++) {
+    for (int i = 0; i < kWritesPerGroupWriter; i++) {
+      ASSERT_EQ(std::string(kGroupValueSize, 'a' + id),
+                Get(GroupWriterKey(id, i)));
+    }
+  }
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
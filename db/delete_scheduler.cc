@@ -0,0 +1,96 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/delete_scheduler.h"
+
+#include "leveldb/env.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+// Longest single sleep, so that shutdown is noticed promptly
+static const uint64_t kMaxSleepMicros = 100000;
+
+DeleteScheduler::DeleteScheduler(Env* env, Logger* info_log,
+                                 uint64_t rate_bytes_per_sec,
+                                 uint64_t truncate_step)
+    : env_(env),
+      info_log_(info_log),
+      rate_bytes_per_sec_(rate_bytes_per_sec),
+      truncate_step_(truncate_step),
+      shutting_down_(NULL),
+      cv_(&mu_),
+      bg_running_(false) {
+  assert(rate_bytes_per_sec_ > 0);
+}
+
+DeleteScheduler::~DeleteScheduler() {
+  shutting_down_.Release_Store(this);
+  WaitForEmpty();
+}
+
+void DeleteScheduler::Schedule(const std::string& fname) {
+  MutexLock l(&mu_);
+  queue_.push_back(fname);
+  if (!bg_running_) {
+    bg_running_ = true;
+    env_->StartThread(&DeleteScheduler::BGWork, this);
+  }
+}
+
+void DeleteScheduler::WaitForEmpty() {
+  MutexLock l(&mu_);
+  while (bg_running_) {
+    cv_.Wait();
+  }
+}
+
+void DeleteScheduler::BGWork(void* arg) {
+  reinterpret_cast<DeleteScheduler*>(arg)->BackgroundThread();
+}
+
+void DeleteScheduler::BackgroundThread() {
+  MutexLock l(&mu_);
+  while (!queue_.empty()) {
+    const std::string fname = queue_.front();
+    queue_.pop_front();
+    mu_.Unlock();
+    DeleteOne(fname);
+    mu_.Lock();
+  }
+  bg_running_ = false;
+  cv_.SignalAll();
+}
+
+void DeleteScheduler::DeleteOne(const std::string& fname) {
+  uint64_t size = 0;
+  env_->GetFileSize(fname, &size);  // Ignoring errors on purpose
+  if (truncate_step_ > 0) {
+    while (size > truncate_step_ && shutting_down_.Acquire_Load() == NULL) {
+      if (!env_->TruncateFile(fname, size - truncate_step_).ok()) {
+        break;  // Not supported; unlink the rest in one go
+      }
+      size -= truncate_step_;
+      Throttle(truncate_step_);
+    }
+  }
+  Status s = env_->DeleteFile(fname);
+  if (!s.ok()) {
+    Log(info_log_, "Delete %s failed: %s\n",
+        fname.c_str(), s.ToString().c_str());
+  }
+  Throttle(size);
+}
+
+void DeleteScheduler::Throttle(uint64_t bytes) {
+  uint64_t micros = bytes * 1000000 / rate_bytes_per_sec_;
+  while (micros > 0 && shutting_down_.Acquire_Load() == NULL) {
+    const uint64_t sleep = (micros < kMaxSleepMicros) ? micros
+                                                      : kMaxSleepMicros;
+    env_->SleepForMicroseconds(static_cast<int>(sleep));
+    micros -= sleep;
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,65 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_DELETE_SCHEDULER_H_
+#define STORAGE_LEVELDB_DB_DELETE_SCHEDULER_H_
+
+#include <deque>
+#include <string>
+#include <stdint.h>
+#include "port/port.h"
+
+namespace leveldb {
+
+class Env;
+class Logger;
+
+// Deletes files on a background thread, spreading the work so that no
+// more than a given number of bytes are removed per second.  Unlinking a
+// large file in one go makes some filesystems stall other I/O; when
+// truncate_step is non-zero, files are shrunk by that many bytes at a
+// time before being unlinked.
+//
+// Thread-safe.
+class DeleteScheduler {
+ public:
+  // rate_bytes_per_sec must be positive.
+  DeleteScheduler(Env* env, Logger* info_log,
+                  uint64_t rate_bytes_per_sec, uint64_t truncate_step);
+
+  // Deletes every file that is still queued, without rate limiting.
+  ~DeleteScheduler();
+
+  // Queue the named file for deletion.
+  void Schedule(const std::string& fname);
+
+  // Wait until all queued files have been deleted.
+  void WaitForEmpty();
+
+ private:
+  static void BGWork(void* arg);
+  void BackgroundThread();
+  void DeleteOne(const std::string& fname);
+  void Throttle(uint64_t bytes);
+
+  Env* const env_;
+  Logger* const info_log_;
+  const uint64_t rate_bytes_per_sec_;
+  const uint64_t truncate_step_;
+  port::AtomicPointer shutting_down_;  // Non-NULL: stop throttling
+
+  // State below is protected by mu_
+  port::Mutex mu_;
+  port::CondVar cv_;                   // Signalled when the queue drains
+  std::deque<std::string> queue_;
+  bool bg_running_;                    // Background thread is running
+
+  // No copying allowed
+  DeleteScheduler(const DeleteScheduler&);
+  void operator=(const DeleteScheduler&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_DELETE_SCHEDULER_H_
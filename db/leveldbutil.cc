@@ -3,8 +3,11 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <stdio.h>
+#include <string>
+#include "leveldb/compaction_service.h"
 #include "leveldb/dumpfile.h"
 #include "leveldb/env.h"
+#include "leveldb/options.h"
 #include "leveldb/status.h"
 
 namespace leveldb {
@@ -34,6 +37,28 @@ bool HandleDumpCommand(Env* env, char** files, int num) {
   return ok;
 }
 
+// Run a compaction job read from stdin against the database "dbname"
+// and write the result to stdout.  The database must use the default
+// comparator and no filter policy.
+bool HandleCompactCommand(Env* env, const char* dbname) {
+  std::string job;
+  char buf[8192];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+    job.append(buf, n);
+  }
+  Options options;
+  options.env = env;
+  std::string result;
+  Status s = RunCompactionJob(options, dbname, job, &result);
+  if (!s.ok()) {
+    fprintf(stderr, "%s\n", s.ToString().c_str());
+    return false;
+  }
+  fwrite(result.data(), 1, result.size(), stdout);
+  return fflush(stdout) == 0;
+}
+
 }  // namespace
 }  // namespace leveldb
 
@@ -42,6 +67,7 @@ static void Usage() {
       stderr,
       "Usage: leveldbutil command...\n"
       "   dump files...         -- dump contents of specified files\n"
+      "   compact dbname        -- run a compaction job from stdin\n"
       );
 }
 
@@ -55,6 +81,8 @@ int main(int argc, char** argv) {
     std::string command = argv[1];
     if (command == "dump") {
       ok = leveldb::HandleDumpCommand(env, argv+2, argc-2);
+    } else if (command == "compact" && argc == 3) {
+      ok = leveldb::HandleCompactCommand(env, argv[2]);
     } else {
       Usage();
       ok = false;
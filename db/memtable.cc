@@ -3,6 +3,9 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "db/memtable.h"
+
+#include <new>
+#include <vector>
 #include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
@@ -87,6 +90,7 @@ class MemTableIterator: public Iterator {
   }
 
   virtual Status status() const { return Status::OK(); }
+  virtual bool IsKeyPinned() const { return true; }  // Lives in the arena
 
  private:
   MemTable::Table::Iterator iter_;
@@ -97,7 +101,11 @@ class MemTableIterator: public Iterator {
   void operator=(const MemTableIterator&);
 };
 
-Iterator* MemTable::NewIterator() {
+Iterator* MemTable::NewIterator(Arena* arena) {
+  if (arena != NULL) {
+    void* mem = arena->AllocateAligned(sizeof(MemTableIterator));
+    return new (mem) MemTableIterator(&table_);
+  }
   return new MemTableIterator(&table_);
 }
 
@@ -221,38 +229,61 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
   // 在SkipList中找到第一个值大于等于memkey的结点
   iter.Seek(memkey.data());
   if (iter.Valid()) {
-    // entry format is:
-    //    klength  varint32
-    //    userkey  char[klength]
-    //    tag      uint64
-    //    vlength  varint32
-    //    value    char[vlength]
-    // Check that it belongs to same user key.  We do not check the
-    // sequence number since the Seek() call above should have skipped
-    // all entries with overly large sequence numbers.
-    const char* entry = iter.key();
-    uint32_t key_length;
-    // 在这里判断iter指向结点的user_key是否和传入的相同，如果相同才有必要
-    // 进行判断, 判断当前结点操作的类型，如果是kTypeValue, 则解析出对应的
-    // value进行返回，如果是kTypeDeletion则直接返回NotFound(), 需要注意的
-    // 是当前iter指向的结点肯定是对应user_key最新的操作结点，具体原因可以
-    // 查看LevelDB的三种比较器
-    const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
-    if (comparator_.comparator.user_comparator()->Compare(
-            Slice(key_ptr, key_length - 8),
-            key.user_key()) == 0) {
-      // Correct user key
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
-          return true;
-        }
-        case kTypeDeletion:
-          *s = Status::NotFound(Slice());
-          return true;
+    return SaveResult(key, iter.key(), value, s);
+  }
+  return false;
+}
+
+void MemTable::GetBatch(int n, const LookupKey* const* keys,
+                        std::string* values, Status* s, bool* found) {
+  std::vector<const char*> targets(n);
+  std::vector<Table::Iterator> iters(n, Table::Iterator(&table_));
+  std::vector<Table::Iterator*> iter_ptrs(n);
+  for (int i = 0; i < n; i++) {
+    targets[i] = keys[i]->memtable_key().data();
+    iter_ptrs[i] = &iters[i];
+  }
+  if (n > 0) {
+    table_.SeekBatch(n, &targets[0], &iter_ptrs[0]);
+  }
+  for (int i = 0; i < n; i++) {
+    found[i] = iters[i].Valid() &&
+        SaveResult(*keys[i], iters[i].key(), &values[i], &s[i]);
+  }
+}
+
+bool MemTable::SaveResult(const LookupKey& key, const char* entry,
+                          std::string* value, Status* s) {
+  // entry format is:
+  //    klength  varint32
+  //    userkey  char[klength]
+  //    tag      uint64
+  //    vlength  varint32
+  //    value    char[vlength]
+  // Check that it belongs to same user key.  We do not check the
+  // sequence number since the Seek() call above should have skipped
+  // all entries with overly large sequence numbers.
+  uint32_t key_length;
+  // 在这里判断iter指向结点的user_key是否和传入的相同，如果相同才有必要
+  // 进行判断, 判断当前结点操作的类型，如果是kTypeValue, 则解析出对应的
+  // value进行返回，如果是kTypeDeletion则直接返回NotFound(), 需要注意的
+  // 是当前iter指向的结点肯定是对应user_key最新的操作结点，具体原因可以
+  // 查看LevelDB的三种比较器
+  const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
+  if (comparator_.comparator.user_comparator()->Compare(
+          Slice(key_ptr, key_length - 8),
+          key.user_key()) == 0) {
+    // Correct user key
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    switch (static_cast<ValueType>(tag & 0xff)) {
+      case kTypeValue: {
+        Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
+        value->assign(v.data(), v.size());
+        return true;
       }
+      case kTypeDeletion:
+        *s = Status::NotFound(Slice());
+        return true;
     }
   }
   return false;
@@ -45,7 +45,10 @@ class MemTable {
   // while the returned iterator is live.  The keys returned by this
   // iterator are internal keys encoded by AppendInternalKey in the
   // db/format.{h,cc} module.
-  Iterator* NewIterator();
+  //
+  // If "arena" is non-NULL the iterator is placed in *arena and must be
+  // released with iter->~Iterator() instead of delete.
+  Iterator* NewIterator(Arena* arena = NULL);
 
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
@@ -60,9 +63,20 @@ class MemTable {
   // Else, return false.
   bool Get(const LookupKey& key, std::string* value, Status* s);
 
+  // Equivalent to "found[i] = Get(*keys[i], &values[i], &s[i])" for each
+  // i in [0,n), but the lookups are interleaved to hide memory latency.
+  void GetBatch(int n, const LookupKey* const* keys,
+                std::string* values, Status* s, bool* found);
+
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
 
+  // Fill in the result of a lookup for "key" that found "entry", the
+  // first entry at or after it.  Returns false if entry is for another
+  // user key.
+  bool SaveResult(const LookupKey& key, const char* entry,
+                  std::string* value, Status* s);
+
   struct KeyComparator {
     const InternalKeyComparator comparator;
     explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) { }
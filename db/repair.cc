@@ -224,7 +224,11 @@ class Repairer {
     FileMetaData meta;
     meta.number = next_file_number_++;
     Iterator* iter = mem->NewIterator();
-    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    // No snapshots can exist while repairing, so every hidden entry
+    // may be dropped.
+    std::vector<SequenceNumber> no_snapshots;
+    status = BuildTable(dbname_, env_, options_, table_cache_, iter,
+                        no_snapshots, &meta);
     delete iter;
     mem->Unref();
     mem = NULL;
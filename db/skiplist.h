@@ -89,11 +89,19 @@ class SkipList {
     void SeekToLast();
 
    private:
+    friend class SkipList;
     const SkipList* list_;
     Node* node_;
     // Intentionally copyable
   };
 
+  // Equivalent to "iters[i]->Seek(targets[i])" for each i in [0,n), but
+  // several searches proceed in turns.  Each search prefetches the node
+  // it looks at next before giving way to the others, so that their
+  // cache misses overlap instead of following one another.
+  // REQUIRES: every iters[i] was created over this list
+  void SeekBatch(int n, const Key* targets, Iterator* const* iters) const;
+
  private:
   enum { kMaxHeight = 12 };
 
@@ -122,6 +130,17 @@ class SkipList {
   // Return true if key is greater than the data stored in "n"
   bool KeyIsAfterNode(const Key& key, Node* n) const;
 
+  // Hint that the memory at p will be read soon
+  static void Prefetch(const void* p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#endif
+  }
+
+  // Keys that point to their data (memtable entries) are prefetched too
+  static void PrefetchKey(const char* key) { Prefetch(key); }
+  template<typename K> static void PrefetchKey(const K&) { }
+
   // Return the earliest node that comes at or after key.
   // Return NULL if there is no such node.
   //
@@ -245,6 +264,62 @@ inline void SkipList<Key,Comparator>::Iterator::Seek(const Key& target) {
   node_ = list_->FindGreaterOrEqual(target, NULL);
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::SeekBatch(int n, const Key* targets,
+                                         Iterator* const* iters) const {
+  // Number of searches in flight.  Enough to cover memory latency with
+  // the work of the other searches, few enough to stay in registers.
+  static const int kWidth = 8;
+
+  // A search alternates between two kinds of turns: one touches the
+  // prefetched node "next" and prefetches the key it points to, the
+  // following one compares against that key and moves on.
+  Node* x[kWidth];
+  Node* next[kWidth];
+  int level[kWidth];
+  bool key_ready[kWidth];
+  for (int start = 0; start < n; start += kWidth) {
+    const int m = (n - start < kWidth) ? n - start : kWidth;
+    const int top = GetMaxHeight() - 1;
+    for (int i = 0; i < m; i++) {
+      x[i] = head_;
+      level[i] = top;
+      next[i] = head_->Next(top);
+      key_ready[i] = false;
+      if (next[i] != NULL) Prefetch(next[i]);
+    }
+
+    int active = m;
+    while (active > 0) {
+      for (int i = 0; i < m; i++) {
+        if (level[i] < 0) {
+          continue;  // Finished
+        }
+        if (next[i] != NULL && !key_ready[i]) {
+          PrefetchKey(next[i]->key);
+          key_ready[i] = true;
+          continue;
+        }
+        if (KeyIsAfterNode(targets[start + i], next[i])) {
+          // Keep searching in this list
+          x[i] = next[i];
+        } else if (level[i] == 0) {
+          iters[start + i]->node_ = next[i];
+          level[i] = -1;
+          active--;
+          continue;
+        } else {
+          // Switch to next list
+          level[i]--;
+        }
+        next[i] = x[i]->Next(level[i]);
+        key_ready[i] = false;
+        if (next[i] != NULL) Prefetch(next[i]);
+      }
+    }
+  }
+}
+
 template<typename Key, class Comparator>
 inline void SkipList<Key,Comparator>::Iterator::SeekToFirst() {
   node_ = list_->head_->Next(0);
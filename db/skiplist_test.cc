@@ -4,6 +4,7 @@
 
 #include "db/skiplist.h"
 #include <set>
+#include <vector>
 #include "leveldb/env.h"
 #include "util/arena.h"
 #include "util/hash.h"
@@ -85,6 +86,30 @@ TEST(SkipTest, InsertAndLookup) {
     ASSERT_EQ(*(keys.rbegin()), iter.key());
   }
 
+  // Batched seeks must land where individual seeks do
+  {
+    std::vector<Key> targets;
+    for (int i = 0; i < 100; i++) {
+      targets.push_back(rnd.Next() % (R + 10));
+    }
+    std::vector<SkipList<Key, Comparator>::Iterator> iters(
+        targets.size(), SkipList<Key, Comparator>::Iterator(&list));
+    std::vector<SkipList<Key, Comparator>::Iterator*> iter_ptrs;
+    for (size_t i = 0; i < iters.size(); i++) {
+      iter_ptrs.push_back(&iters[i]);
+    }
+    list.SeekBatch(targets.size(), &targets[0], &iter_ptrs[0]);
+    for (size_t i = 0; i < targets.size(); i++) {
+      std::set<Key>::iterator model_iter = keys.lower_bound(targets[i]);
+      if (model_iter == keys.end()) {
+        ASSERT_TRUE(!iters[i].Valid());
+      } else {
+        ASSERT_TRUE(iters[i].Valid());
+        ASSERT_EQ(*model_iter, iters[i].key());
+      }
+    }
+  }
+
   // Forward iteration test
   for (int i = 0; i < R; i++) {
     SkipList<Key, Comparator>::Iterator iter(&list);
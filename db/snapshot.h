@@ -5,14 +5,20 @@
 #ifndef STORAGE_LEVELDB_DB_SNAPSHOT_H_
 #define STORAGE_LEVELDB_DB_SNAPSHOT_H_
 
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
 #include "db/dbformat.h"
+#include "db/version_set.h"
 #include "leveldb/db.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
 class SnapshotList;
 
-// Snapshots are kept in a doubly-linked list in the DB.
+// Snapshots are kept in doubly-linked lists in the DB.
 // Each SnapshotImpl corresponds to a particular sequence number.
 class SnapshotImpl : public Snapshot {
  public:
@@ -26,25 +32,54 @@ class SnapshotImpl : public Snapshot {
   SnapshotImpl* next_;
 
   SnapshotList* list_;                 // just for sanity checks
+  int shard_;                          // Index of the list it is kept in
 };
 
+// The live snapshots of a DB, spread over several lists that each have
+// their own lock, so that taking and releasing snapshots neither takes
+// the DB mutex nor contends much with other threads doing the same.
+//
+// Thread-safe.
 class SnapshotList {
  public:
   SnapshotList() {
-    list_.prev_ = &list_;
-    list_.next_ = &list_;
+    for (int i = 0; i < kNumShards; i++) {
+      shards_[i].head.prev_ = &shards_[i].head;
+      shards_[i].head.next_ = &shards_[i].head;
+    }
   }
 
-  bool empty() const { return list_.next_ == &list_; }
-  SnapshotImpl* oldest() const { assert(!empty()); return list_.next_; }
-  SnapshotImpl* newest() const { assert(!empty()); return list_.prev_; }
+  // Store the sequence numbers of all snapshots in *snapshots, oldest
+  // first.  A snapshot that is missed because it is taken concurrently
+  // reads a sequence number no smaller than the last sequence number read
+  // before the call.
+  void GetAll(std::vector<SequenceNumber>* snapshots) {
+    snapshots->clear();
+    for (int i = 0; i < kNumShards; i++) {
+      Shard* shard = &shards_[i];
+      MutexLock l(&shard->mu);
+      for (const SnapshotImpl* s = shard->head.next_; s != &shard->head;
+           s = s->next_) {
+        snapshots->push_back(s->number_);
+      }
+    }
+    std::sort(snapshots->begin(), snapshots->end());
+  }
 
-  const SnapshotImpl* New(SequenceNumber seq) {
+  // Take a snapshot at the last sequence number of *versions.
+  const SnapshotImpl* New(const VersionSet* versions) {
     SnapshotImpl* s = new SnapshotImpl;
-    s->number_ = seq;
     s->list_ = this;
-    s->next_ = &list_;
-    s->prev_ = list_.prev_;
+    // Threads allocate from different places, so the address spreads
+    // them over the shards
+    s->shard_ = static_cast<int>(
+        (reinterpret_cast<uintptr_t>(s) >> 6) % kNumShards);
+    Shard* shard = &shards_[s->shard_];
+    MutexLock l(&shard->mu);
+    // Read under the lock so that each list stays in sequence order
+    s->number_ = versions->AcquireLastSequence();
+    s->next_ = &shard->head;
+    s->prev_ = shard->head.prev_;
     s->prev_->next_ = s;
     s->next_->prev_ = s;
     return s;
@@ -52,14 +87,27 @@ class SnapshotList {
 
   void Delete(const SnapshotImpl* s) {
     assert(s->list_ == this);
-    s->prev_->next_ = s->next_;
-    s->next_->prev_ = s->prev_;
+    {
+      MutexLock l(&shards_[s->shard_].mu);
+      s->prev_->next_ = s->next_;
+      s->next_->prev_ = s->prev_;
+    }
     delete s;
   }
 
  private:
-  // Dummy head of doubly-linked list of snapshots
-  SnapshotImpl list_;
+  enum { kNumShards = 16 };
+
+  struct Shard {
+    port::Mutex mu;
+    SnapshotImpl head;  // Dummy head of doubly-linked list of snapshots
+  };
+
+  Shard shards_[kNumShards];
+
+  // No copying allowed
+  SnapshotList(const SnapshotList&);
+  void operator=(const SnapshotList&);
 };
 
 }  // namespace leveldb
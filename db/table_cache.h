@@ -16,6 +16,7 @@
 
 namespace leveldb {
 
+class Arena;
 class Env;
 
 class TableCache {
@@ -29,18 +30,28 @@ class TableCache {
   // underlying the returned iterator, or NULL if no Table object underlies
   // the returned iterator.  The returned "*tableptr" object is owned by
   // the cache and should not be deleted, and is valid for as long as the
-  // returned iterator is live.
+  // returned iterator is live.  If "arena" is non-NULL the iterator is
+  // placed in *arena and must be released with iter->~Iterator().
   Iterator* NewIterator(const ReadOptions& options,
                         uint64_t file_number,
                         uint64_t file_size,
-                        Table** tableptr = NULL);
+                        Table** tableptr = NULL,
+                        Arena* arena = NULL);
+
+  // Return an iterator over the index block of the specified file.  Its
+  // keys are internal keys that separate the file's data blocks and its
+  // values are the encoded BlockHandles of those blocks.
+  Iterator* NewIndexIterator(uint64_t file_number, uint64_t file_size);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value), where found_value
+  // holds the bytes [offset, offset+length) of the entry's value.
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
              const Slice& k,
+             uint64_t offset,
+             uint64_t length,
              void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
@@ -53,7 +64,11 @@ class TableCache {
   const Options* options_;
   Cache* cache_;
 
-  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  // If the table is not cached, returns Incomplete when options.read_tier
+  // rules out I/O and TimedOut when options.deadline has passed.
+  Status FindTable(const ReadOptions& options,
+                   uint64_t file_number, uint64_t file_size,
+                   Cache::Handle**);
 };
 
 }  // namespace leveldb
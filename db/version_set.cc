@@ -5,7 +5,9 @@
 #include "db/version_set.h"
 
 #include <algorithm>
+#include <new>
 #include <stdio.h>
+#include "db/compaction_rules.h"
 #include "db/filename.h"
 #include "db/log_reader.h"
 #include "db/log_writer.h"
@@ -13,8 +15,10 @@
 #include "db/table_cache.h"
 #include "leveldb/env.h"
 #include "leveldb/table_builder.h"
+#include "table/format.h"
 #include "table/merger.h"
 #include "table/two_level_iterator.h"
+#include "util/arena.h"
 #include "util/coding.h"
 #include "util/logging.h"
 
@@ -77,6 +81,7 @@ Version::~Version() {
       assert(f->refs > 0);
       f->refs--;
       if (f->refs <= 0) {
+        vset_->obsolete_files_.push_back(f->number);
         delete f;
       }
     }
@@ -246,19 +251,27 @@ static Iterator* GetFileIterator(void* arg,
 }
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
-                                            int level) const {
-  return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]),
-      &GetFileIterator, vset_->table_cache_, options);
+                                            int level, Arena* arena) const {
+  Iterator* index_iter;
+  if (arena != NULL) {
+    void* mem = arena->AllocateAligned(sizeof(LevelFileNumIterator));
+    index_iter = new (mem) LevelFileNumIterator(vset_->icmp_, &files_[level]);
+  } else {
+    index_iter = new LevelFileNumIterator(vset_->icmp_, &files_[level]);
+  }
+  return NewTwoLevelIterator(index_iter, &GetFileIterator,
+                             vset_->table_cache_, options, arena);
 }
 
 void Version::AddIterators(const ReadOptions& options,
-                           std::vector<Iterator*>* iters) {
+                           std::vector<Iterator*>* iters,
+                           Arena* arena) {
   // Merge all level zero files together since they may overlap
   for (size_t i = 0; i < files_[0].size(); i++) {
     iters->push_back(
         vset_->table_cache_->NewIterator(
-            options, files_[0][i]->number, files_[0][i]->file_size));
+            options, files_[0][i]->number, files_[0][i]->file_size,
+            NULL, arena));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
@@ -266,11 +279,70 @@ void Version::AddIterators(const ReadOptions& options,
   // lazily.
   for (int level = 1; level < config::kNumLevels; level++) {
     if (!files_[level].empty()) {
-      iters->push_back(NewConcatenatingIterator(options, level));
+      iters->push_back(NewConcatenatingIterator(options, level, arena));
     }
   }
 }
 
+void Version::SampleKeys(
+    const Slice* begin, const Slice* end, int max_samples,
+    std::vector<std::pair<std::string, uint64_t> >* samples) {
+  assert(max_samples > 0);
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  std::vector<FileMetaData*> files;
+  uint64_t total = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    for (size_t i = 0; i < files_[level].size(); i++) {
+      FileMetaData* f = files_[level][i];
+      if ((begin != NULL &&
+           ucmp->Compare(f->largest.user_key(), *begin) < 0) ||
+          (end != NULL &&
+           ucmp->Compare(f->smallest.user_key(), *end) >= 0)) {
+        continue;  // No overlap
+      }
+      files.push_back(f);
+      total += f->file_size;
+    }
+  }
+
+  // Emit a sample whenever a file has covered "granularity" more bytes
+  const uint64_t granularity =
+      (total / max_samples > 0) ? total / max_samples : 1;
+  std::string last_key;
+  for (size_t i = 0; i < files.size(); i++) {
+    Iterator* iter = vset_->table_cache_->NewIndexIterator(
+        files[i]->number, files[i]->file_size);
+    if (begin != NULL) {
+      InternalKey ibegin(*begin, kMaxSequenceNumber, kValueTypeForSeek);
+      iter->Seek(ibegin.Encode());
+    } else {
+      iter->SeekToFirst();
+    }
+    uint64_t pending = 0;
+    for (; iter->Valid(); iter->Next()) {
+      const Slice user_key = ExtractUserKey(iter->key());
+      if (end != NULL && ucmp->Compare(user_key, *end) >= 0) {
+        break;
+      }
+      Slice input = iter->value();
+      BlockHandle handle;
+      if (!handle.DecodeFrom(&input).ok()) {
+        break;
+      }
+      pending += handle.size();
+      last_key.assign(user_key.data(), user_key.size());
+      if (pending >= granularity) {
+        samples->push_back(std::make_pair(last_key, pending));
+        pending = 0;
+      }
+    }
+    if (pending > 0) {
+      samples->push_back(std::make_pair(last_key, pending));
+    }
+    delete iter;
+  }
+}
+
 // Callback from TableCache::Get()
 namespace {
 enum SaverState {
@@ -352,6 +424,8 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
 
 Status Version::Get(const ReadOptions& options,
                     const LookupKey& k,
+                    uint64_t offset,
+                    uint64_t length,
                     std::string* value,
                     GetStats* stats) {
   Slice ikey = k.internal_key();
@@ -427,7 +501,7 @@ Status Version::Get(const ReadOptions& options,
       saver.user_key = user_key;
       saver.value = value;
       s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+                                   ikey, offset, length, &saver, SaveValue);
       if (!s.ok()) {
         return s;
       }
@@ -840,12 +914,16 @@ VersionSet::VersionSet(const std::string& dbname,
       next_file_number_(2),
       manifest_file_number_(0),  // Filled by Recover()
       last_sequence_(0),
+      seq_version_(NULL),
+      seq_high_(NULL),
+      seq_low_(NULL),
       log_number_(0),
       prev_log_number_(0),
       descriptor_file_(NULL),
       descriptor_log_(NULL),
       dummy_versions_(this),
-      current_(NULL) {
+      current_(NULL),
+      current_copy_(NULL) {
   AppendVersion(new Version(this));
 }
 
@@ -866,6 +944,7 @@ void VersionSet::AppendVersion(Version* v) {
     current_->Unref();
   }
   current_ = v;
+  current_copy_.Release_Store(v);
   v->Ref();
 
   // Append to linked list
@@ -1081,7 +1160,7 @@ Status VersionSet::Recover(bool *save_manifest) {
     AppendVersion(v);
     manifest_file_number_ = next_file;
     next_file_number_ = next_file + 1;
-    last_sequence_ = last_sequence;
+    SetLastSequence(last_sequence);
     log_number_ = log_number;
     prev_log_number_ = prev_log_number;
 
@@ -1538,13 +1617,7 @@ Compaction* VersionSet::CompactRange(
 Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
-      input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
-  for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
-  }
+      input_version_(NULL) {
 }
 
 Compaction::~Compaction() {
@@ -1571,50 +1644,17 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-// 判断给定的user_key是否可能出现在[level_ + 2， kNumLevels]的sst文件当中
-// 如果可能返回false, 如果不可能，返回true
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
-  // Maybe use binary search to find right entry instead of linear search?
-  const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
-  for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
-    const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
-      if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
-        // We've advanced far enough
-        if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
-          // Key falls in this file's range, so definitely not base level
-          return false;
-        }
-        break;
-      }
-      level_ptrs_[lvl]++;
-    }
+void Compaction::AddDeeperLevels(CompactionRules* rules) const {
+  if (level_ + 2 < config::kNumLevels) {
+    rules->AddDeeperLevel(level_ + 2, &grandparents_);
   }
-  return true;
-}
-
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
-  const VersionSet* vset = input_version_->vset_;
-  // Scan to find earliest grandparent file that contains key.
-  const InternalKeyComparator* icmp = &vset->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
-      icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
-    }
-    grandparent_index_++;
+  for (int lvl = level_ + 3; lvl < config::kNumLevels; lvl++) {
+    rules->AddDeeperLevel(lvl, &input_version_->files_[lvl]);
   }
-  seen_key_ = true;
+}
 
-  if (overlapped_bytes_ > MaxGrandParentOverlapBytes(vset->options_)) {
-    // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
-    return true;
-  } else {
-    return false;
-  }
+int64_t Compaction::MaxGrandParentOverlap() const {
+  return MaxGrandParentOverlapBytes(input_version_->vset_->options_);
 }
 
 void Compaction::ReleaseInputs() {
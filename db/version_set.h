@@ -27,7 +27,9 @@ namespace leveldb {
 
 namespace log { class Writer; }
 
+class Arena;
 class Compaction;
+class CompactionRules;
 class Iterator;
 class MemTable;
 class TableBuilder;
@@ -60,17 +62,22 @@ class Version {
  public:
   // Append to *iters a sequence of iterators that will
   // yield the contents of this Version when merged together.
+  // If "arena" is non-NULL the iterators are placed in *arena and must be
+  // released with iter->~Iterator() instead of delete.
   // REQUIRES: This version has been saved (see VersionSet::SaveTo)
-  void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
+  void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters,
+                    Arena* arena = NULL);
 
-  // Lookup the value for key.  If found, store it in *val and
-  // return OK.  Else return a non-OK status.  Fills *stats.
+  // Lookup the value for key.  If found, store its bytes
+  // [offset, offset+length) in *val and return OK.  Else return a
+  // non-OK status.  Fills *stats.
   // REQUIRES: lock is not held
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
   };
-  Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
+  Status Get(const ReadOptions&, const LookupKey& key,
+             uint64_t offset, uint64_t length, std::string* val,
              GetStats* stats);
 
   // Adds "stats" into the current state.  Returns true if a new
@@ -95,6 +102,17 @@ class Version {
       const InternalKey* end,           // NULL means after all keys
       std::vector<FileMetaData*>* inputs);
 
+  // Append to *samples user keys spread over the table data in
+  // [*begin,*end), in no particular order.  Each key is paired with the
+  // approximate number of bytes of table data it stands for.  The keys
+  // come from the index blocks of the tables, and about max_samples of
+  // them are produced in total.
+  // begin==NULL represents a key smaller than all keys in the DB.
+  // end==NULL represents a key larger than all keys in the DB.
+  // REQUIRES: lock is not held
+  void SampleKeys(const Slice* begin, const Slice* end, int max_samples,
+                  std::vector<std::pair<std::string, uint64_t> >* samples);
+
   // Returns true iff some file in the specified level overlaps
   // some part of [*smallest_user_key,*largest_user_key].
   // smallest_user_key==NULL represents a key smaller than all keys in the DB.
@@ -110,6 +128,13 @@ class Version {
 
   int NumFiles(int level) const { return files_[level].size(); }
 
+  // Return the files in the specified level.  Files in levels > 0 are
+  // disjoint and sorted by key.  The result is only valid while this
+  // version is referenced.
+  const std::vector<FileMetaData*>& LevelFiles(int level) const {
+    return files_[level];
+  }
+
   // Return a human readable string that describes this version's contents.
   std::string DebugString() const;
 
@@ -118,7 +143,8 @@ class Version {
   friend class VersionSet;
 
   class LevelFileNumIterator;
-  Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
+  Iterator* NewConcatenatingIterator(const ReadOptions&, int level,
+                                     Arena* arena) const;
 
   // Call func(arg, level, f) for every file that overlaps user_key in
   // order from newest to oldest.  If an invocation of func returns
@@ -184,6 +210,13 @@ class VersionSet {
   // Return the current version.
   Version* current() const { return current_; }
 
+  // Return the current version without holding the DB mutex.  The
+  // result may be deleted at any time, so it is only good for comparing
+  // against a version the caller holds a reference to.
+  const Version* AcquireCurrent() const {
+    return reinterpret_cast<const Version*>(current_copy_.Acquire_Load());
+  }
+
   // Return the current manifest file number
   uint64_t ManifestFileNumber() const { return manifest_file_number_; }
 
@@ -208,10 +241,40 @@ class VersionSet {
   // Return the last sequence number.
   uint64_t LastSequence() const { return last_sequence_; }
 
+  // Return the last sequence number.  Unlike LastSequence(), may be
+  // called without holding the DB mutex.
+  uint64_t AcquireLastSequence() const {
+    while (true) {
+      const uintptr_t version =
+          reinterpret_cast<uintptr_t>(seq_version_.Acquire_Load());
+      const uint64_t high =
+          reinterpret_cast<uintptr_t>(seq_high_.Acquire_Load());
+      const uint64_t low =
+          reinterpret_cast<uintptr_t>(seq_low_.Acquire_Load());
+      if ((version & 1) == 0 &&
+          reinterpret_cast<uintptr_t>(seq_version_.Acquire_Load()) ==
+          version) {
+        return (high << 32) | low;
+      }
+    }
+  }
+
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
     assert(s >= last_sequence_);
     last_sequence_ = s;
+
+    // Publish s for AcquireLastSequence().  A pointer may be only 32
+    // bits wide, so the halves are stored separately and guarded by a
+    // version that is odd while they are being changed.
+    const uintptr_t version =
+        reinterpret_cast<uintptr_t>(seq_version_.NoBarrier_Load());
+    seq_version_.Release_Store(reinterpret_cast<void*>(version + 1));
+    seq_high_.Release_Store(reinterpret_cast<void*>(
+        static_cast<uintptr_t>(s >> 32)));
+    seq_low_.Release_Store(reinterpret_cast<void*>(
+        static_cast<uintptr_t>(s & 0xffffffffu)));
+    seq_version_.Release_Store(reinterpret_cast<void*>(version + 2));
   }
 
   // Mark the specified file number as used.
@@ -257,6 +320,14 @@ class VersionSet {
   // May also mutate some internal state.
   void AddLiveFiles(std::set<uint64_t>* live);
 
+  // Append to *files the numbers of table files that have been dropped
+  // by every version since the last call.  Such a file may still be
+  // live if it was moved to another level.
+  void GetObsoleteFiles(std::vector<uint64_t>* files) {
+    files->insert(files->end(), obsolete_files_.begin(), obsolete_files_.end());
+    obsolete_files_.clear();
+  }
+
   // Return the approximate offset in the database of the data for
   // "key" as of version "v".
   uint64_t ApproximateOffsetOf(Version* v, const InternalKey& key);
@@ -302,6 +373,9 @@ class VersionSet {
   uint64_t next_file_number_;       //下一个log文件序列号，对应于rocksdb里面的write2file
   uint64_t manifest_file_number_;
   uint64_t last_sequence_;
+  port::AtomicPointer seq_version_;  // Copy of last_sequence_ for
+  port::AtomicPointer seq_high_;     // AcquireLastSequence()
+  port::AtomicPointer seq_low_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
 
@@ -310,11 +384,15 @@ class VersionSet {
   log::Writer* descriptor_log_;
   Version dummy_versions_;  // Head of circular doubly-linked list of versions.
   Version* current_;        // == dummy_versions_.prev_
+  port::AtomicPointer current_copy_;  // == current_, for AcquireCurrent()
 
   // Per-level key at which the next compaction at that level should start.
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
 
+  // Table files no longer referenced by any version
+  std::vector<uint64_t> obsolete_files_;
+
   // No copying allowed
   VersionSet(const VersionSet&);
   void operator=(const VersionSet&);
@@ -342,6 +420,13 @@ class Compaction {
   // Maximum size of files to build during this compaction.
   uint64_t MaxOutputFileSize() const { return max_output_file_size_; }
 
+  // Number of grandparent bytes an output may overlap before
+  // ShouldStopBefore() starts a new output.
+  int64_t MaxGrandParentOverlap() const;
+
+  // Return the version the inputs of this compaction were picked from.
+  Version* input_version() const { return input_version_; }
+
   // Is this a trivial compaction that can be implemented by just
   // moving a single input file to the next level (no merging or splitting)
   bool IsTrivialMove() const;
@@ -349,14 +434,10 @@ class Compaction {
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
-  // Returns true if the information we have available guarantees that
-  // the compaction is producing data in "level+1" for which no data exists
-  // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
-
-  // Returns true iff we should stop building the current output
-  // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  // Pass the files of the levels below "level+1" that may overlap the
+  // inputs to rules->AddDeeperLevel().  They stay valid until
+  // ReleaseInputs() is called.
+  void AddDeeperLevels(CompactionRules* rules) const;
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -376,21 +457,9 @@ class Compaction {
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];      // The two sets of inputs
 
-  // State used to check for number of of overlapping grandparent files
+  // Files of the grandparent level that overlap the inputs
   // (parent == level_ + 1, grandparent == level_ + 2)
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
 };
 
 }  // namespace leveldb
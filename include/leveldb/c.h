@@ -96,6 +96,18 @@ LEVELDB_EXPORT char* leveldb_get(leveldb_t* db,
                                  const char* key, size_t keylen, size_t* vallen,
                                  char** errptr);
 
+/* Looks up keys[0,num_keys-1] with a single call; lookups that need disk
+   reads run concurrently.  For each key, values[i] is set to NULL if the
+   key is not found or on error, else to a malloc()ed array whose length
+   is stored in vallens[i].  An error for keys[i] is reported through
+   errs[i] in the same way as through errptr in leveldb_get(). */
+LEVELDB_EXPORT void leveldb_multiget(leveldb_t* db,
+                                     const leveldb_readoptions_t* options,
+                                     size_t num_keys,
+                                     const char* const* keys,
+                                     const size_t* keylens, char** values,
+                                     size_t* vallens, char** errs);
+
 LEVELDB_EXPORT leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db, const leveldb_readoptions_t* options);
 
@@ -141,6 +153,16 @@ LEVELDB_EXPORT const char* leveldb_iter_key(const leveldb_iterator_t*,
                                             size_t* klen);
 LEVELDB_EXPORT const char* leveldb_iter_value(const leveldb_iterator_t*,
                                               size_t* vlen);
+/* Copies up to max_entries entries, starting with the current one, into
+   buf and moves past them.  Each entry is its key followed by its value,
+   packed back to back, with lengths in klens[i] and vlens[i].  Returns
+   the number of entries copied and stores the bytes used in *used.
+   Returns 0 with the iterator still valid if the current entry does not
+   fit in buflen bytes. */
+LEVELDB_EXPORT size_t leveldb_iter_next_batch(leveldb_iterator_t*,
+                                              size_t max_entries, char* buf,
+                                              size_t buflen, size_t* klens,
+                                              size_t* vlens, size_t* used);
 LEVELDB_EXPORT void leveldb_iter_get_error(const leveldb_iterator_t*,
                                            char** errptr);
 
@@ -154,6 +176,14 @@ LEVELDB_EXPORT void leveldb_writebatch_put(leveldb_writebatch_t*,
                                            const char* val, size_t vlen);
 LEVELDB_EXPORT void leveldb_writebatch_delete(leveldb_writebatch_t*,
                                               const char* key, size_t klen);
+/* Same as calling leveldb_writebatch_put() or leveldb_writebatch_delete()
+   for each i in [0,num-1]. */
+LEVELDB_EXPORT void leveldb_writebatch_put_batch(
+    leveldb_writebatch_t*, size_t num, const char* const* keys,
+    const size_t* klens, const char* const* vals, const size_t* vlens);
+LEVELDB_EXPORT void leveldb_writebatch_delete_batch(
+    leveldb_writebatch_t*, size_t num, const char* const* keys,
+    const size_t* klens);
 LEVELDB_EXPORT void leveldb_writebatch_iterate(
     leveldb_writebatch_t*, void* state,
     void (*put)(void*, const char* k, size_t klen, const char* v, size_t vlen),
@@ -0,0 +1,68 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A CompactionService runs compactions on behalf of a DB, for example in
+// a separate worker process so that large compactions do not compete
+// with the serving process for CPU and memory.
+//
+// The DB describes each compaction as an opaque "job" string: the input
+// files, the levels involved, the oldest live snapshot and the file
+// numbers the outputs may use.  The service must arrange for
+// RunCompactionJob() to be called with that string against the same
+// database directory, and hand back the result it produced.  The DB then
+// installs the output files itself.  If the service fails, the DB runs
+// the compaction on its own background thread instead.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_COMPACTION_SERVICE_H_
+#define STORAGE_LEVELDB_INCLUDE_COMPACTION_SERVICE_H_
+
+#include <string>
+#include "leveldb/export.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+struct Options;
+
+class LEVELDB_EXPORT CompactionService {
+ public:
+  CompactionService() { }
+  virtual ~CompactionService();
+
+  // Run the compaction described by "job" on the database named by
+  // "dbname" and store the encoded result in *result.
+  //
+  // May be called from the DB's background thread while other DB
+  // operations proceed.  Must be safe to call concurrently from several
+  // DBs if it is shared between them.
+  virtual Status Compact(const std::string& dbname, const std::string& job,
+                         std::string* result) = 0;
+
+ private:
+  // No copying allowed
+  CompactionService(const CompactionService&);
+  void operator=(const CompactionService&);
+};
+
+// Return a service that runs every job on the calling thread.  "options"
+// must be the options the database was opened with; it is copied, but
+// the objects it points to must outlive the service.
+// The caller should delete the result when it is no longer needed.
+LEVELDB_EXPORT CompactionService* NewLocalCompactionService(
+    const Options& options);
+
+// Execute the compaction job "job" against the database named by
+// "dbname", writing the output tables into that directory, and store the
+// encoded result in *result.  This is the entry point for worker
+// processes.  options.comparator and options.filter_policy must match
+// the ones the database was opened with; the table format settings are
+// taken from the job.
+LEVELDB_EXPORT Status RunCompactionJob(const Options& options,
+                                       const std::string& dbname,
+                                       const std::string& job,
+                                       std::string* result);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_COMPACTION_SERVICE_H_
@@ -7,6 +7,8 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
@@ -39,6 +41,30 @@ struct LEVELDB_EXPORT Range {
   Range(const Slice& s, const Slice& l) : start(s), limit(l) { }
 };
 
+// Lets one thread stop a CompactRange() that another thread is running.
+// Thread-safe.
+class LEVELDB_EXPORT CompactionHandle {
+ public:
+  CompactionHandle();
+  ~CompactionHandle();
+
+  // Ask the compaction to stop.  It returns soon afterwards, discarding
+  // the work of the compaction step it was in.  If called before the
+  // compaction starts, the compaction does nothing.
+  void Cancel();
+
+  // Returns true iff Cancel() has been called.
+  bool IsCancelled() const;
+
+ private:
+  struct Rep;
+  Rep* rep_;
+
+  // No copying allowed
+  CompactionHandle(const CompactionHandle&);
+  void operator=(const CompactionHandle&);
+};
+
 // A DB is a persistent ordered map from keys to values.
 // A DB is safe for concurrent access from multiple threads without
 // any external synchronization.
@@ -84,6 +110,51 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Like Get(), but store only the bytes [offset, offset+length) of the
+  // value in *value.  The range is clipped to the end of the value, so
+  // *value may be shorter than "length", or empty.  Values written while
+  // options.large_value_threshold was in effect are read partially from
+  // the table files instead of in full.
+  //
+  // The default implementation calls Get() and copies the range.
+  virtual Status GetRange(const ReadOptions& options, const Slice& key,
+                          uint64_t offset, uint64_t length,
+                          std::string* value);
+
+  // Receives the result of an asynchronous lookup: the status Get() would
+  // have returned and, if it is OK, the value.  "value" is only valid
+  // until the callback returns.
+  typedef void (*GetCallback)(void* arg, const Status& s, const Slice& value);
+
+  // Look up "key" like Get(), but do not wait for disk reads.  If the
+  // result can be determined from memory, "(*callback)(arg, ...)" is
+  // invoked before GetAsync() returns.  Otherwise the lookup is finished
+  // on a background thread, which invokes the callback.  The callback is
+  // invoked exactly once and must not block for long.
+  //
+  // If options.snapshot is non-NULL, it must not be released before the
+  // callback has been invoked.  Otherwise the lookup reads the state of
+  // the DB when GetAsync() is called, even if it finishes later.  All
+  // callbacks are invoked before the DB is deleted.
+  //
+  // The default implementation calls Get() and invokes the callback
+  // before returning.
+  virtual void GetAsync(const ReadOptions& options, const Slice& key,
+                        GetCallback callback, void* arg);
+
+  // Receives the result of the lookup of keys[index] in MultiGetAsync().
+  typedef void (*MultiGetCallback)(void* arg, int index, const Status& s,
+                                   const Slice& value);
+
+  // Look up keys[0,n-1] like GetAsync(), reporting the result for each
+  // key through "(*callback)(arg, index, ...)".  Callbacks may be invoked
+  // in any order and concurrently from several threads.  All keys are
+  // read from the same state of the DB.  The keys are copied as needed
+  // and may be freed when MultiGetAsync() returns.
+  virtual void MultiGetAsync(const ReadOptions& options,
+                             int n, const Slice* keys,
+                             MultiGetCallback callback, void* arg);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -92,6 +163,47 @@ class LEVELDB_EXPORT DB {
   // The returned iterator should be deleted before this db is deleted.
   virtual Iterator* NewIterator(const ReadOptions& options) = 0;
 
+  // Store in iterators[0,n-1] "n" iterators that all observe the same
+  // state of the database: options.snapshot if it is non-NULL, else the
+  // current state.  Meant for scanning partitions of a key range (see
+  // GetPartitionBoundaries()) on separate threads.
+  //
+  // Caller should delete the iterators when they are no longer needed.
+  virtual void NewIterators(const ReadOptions& options, int n,
+                            Iterator** iterators);
+
+  // Split the key range [*begin,*end) into at most "n" partitions that
+  // hold roughly equal amounts of data, and store in *boundaries the
+  // keys that separate adjacent partitions, in increasing order.
+  // Partition i is [boundaries[i-1],boundaries[i]), where the first
+  // partition starts at *begin and the last one ends at *end.  Fewer
+  // partitions are returned if the range holds too little data.
+  //
+  // begin==NULL is treated as a key before all keys in the database.
+  // end==NULL is treated as a key after all keys in the database.
+  //
+  // The default implementation returns a single partition.
+  virtual void GetPartitionBoundaries(const Slice* begin, const Slice* end,
+                                      int n,
+                                      std::vector<std::string>* boundaries);
+
+  // Receives the entries of partition "partition" in ParallelScan(), in
+  // key order.  Returns false to stop scanning that partition.
+  typedef bool (*ScanCallback)(void* arg, int partition,
+                               const Slice& key, const Slice& value);
+
+  // Scan the key range [*begin,*end) as of a single state of the
+  // database (as for NewIterators()), split into up to "n" partitions
+  // (see GetPartitionBoundaries()) that are scanned concurrently on
+  // separate threads.  "(*callback)(arg, ...)" is invoked for each entry
+  // and may be invoked from several threads at once.  Returns when every
+  // partition has been scanned, with the first error encountered.
+  //
+  // The default implementation returns a NotSupported error.
+  virtual Status ParallelScan(const ReadOptions& options,
+                              const Slice* begin, const Slice* end, int n,
+                              ScanCallback callback, void* arg);
+
   // Return a handle to the current DB state.  Iterators created with
   // this handle will all observe a stable snapshot of the current DB
   // state.  The caller must call ReleaseSnapshot(result) when the
@@ -118,6 +230,9 @@ class LEVELDB_EXPORT DB {
   //     of the sstables that make up the db contents.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  "leveldb.memory-allocator-stats" - returns a multi-line string that
+  //     describes the memory use and fragmentation of
+  //     options.memory_allocator, if it keeps statistics.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -143,6 +258,15 @@ class LEVELDB_EXPORT DB {
   //    db->CompactRange(NULL, NULL);
   virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+  // Like CompactRange(), but stops early once handle->Cancel() is called
+  // and then returns a Status::Incomplete() error.  The tables written by
+  // the step that was interrupted are discarded; earlier steps are kept.
+  // "handle" may be NULL.  Also returns any background error.
+  //
+  // The default implementation calls CompactRange() and returns OK.
+  virtual Status CompactRange(const Slice* begin, const Slice* end,
+                              CompactionHandle* handle);
+
  private:
   // No copying allowed
   DB(const DB&);
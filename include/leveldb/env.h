@@ -112,6 +112,12 @@ class LEVELDB_EXPORT Env {
   virtual Status RenameFile(const std::string& src,
                             const std::string& target) = 0;
 
+  // Shrink the named file to "size" bytes.
+  //
+  // May return an IsNotSupportedError error if this Env cannot
+  // truncate files.  The default implementation does that.
+  virtual Status TruncateFile(const std::string& fname, uint64_t size);
+
   // Lock the specified file.  Used to prevent concurrent access to
   // the same db by multiple processes.  On failure, stores NULL in
   // *lock and returns non-OK.
@@ -323,6 +329,9 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
   Status RenameFile(const std::string& s, const std::string& t) {
     return target_->RenameFile(s, t);
   }
+  Status TruncateFile(const std::string& f, uint64_t size) {
+    return target_->TruncateFile(f, size);
+  }
   Status LockFile(const std::string& f, FileLock** l) {
     return target_->LockFile(f, l);
   }
@@ -68,6 +68,40 @@ class LEVELDB_EXPORT Iterator {
   // If an error has occurred, return it.  Else return an ok status.
   virtual Status status() const = 0;
 
+  // Move the iterator to the latest state of its source, so that it sees
+  // data added since it was created.  Any snapshot the iterator was
+  // created with is dropped.  The iterator is not valid after this call:
+  // the caller must call one of the Seek methods before using it.
+  // Cheaper than deleting the iterator and creating a new one.
+  //
+  // The default implementation returns a NotSupported error.
+  virtual Status Refresh();
+
+  // Returns true if key() points into memory that stays valid and
+  // unchanged until the iterator is deleted, rather than into a buffer
+  // that the next move may overwrite.  Iterators over a DB only return
+  // true if they were created with ReadOptions::pin_data.
+  // REQUIRES: Valid()
+  //
+  // The default implementation returns false.
+  virtual bool IsKeyPinned() const;
+
+  // Copy the current entry and the ones after it into "buf", advancing
+  // past each entry copied, so that many entries can be fetched with one
+  // call.  Each entry is stored as its key immediately followed by its
+  // value, and entries are packed back to back; the lengths of entry i go
+  // in key_sizes[i] and value_sizes[i].  Stops after "max_entries"
+  // entries, when the iterator becomes invalid, or when the next entry
+  // does not fit in the rest of the "buf_size" bytes.  Returns the number
+  // of entries copied and stores the number of bytes used in *bytes_used.
+  // If the current entry alone does not fit, returns 0 and leaves the
+  // iterator where it is.
+  //
+  // The default implementation uses key(), value() and Next().
+  virtual size_t NextBatch(size_t max_entries, char* buf, size_t buf_size,
+                           size_t* key_sizes, size_t* value_sizes,
+                           size_t* bytes_used);
+
   // Clients are allowed to register function/arg1/arg2 triples that
   // will be invoked when this iterator is destroyed.
   //
@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A MemoryAllocator provides the memory that blocks read from table
+// files are kept in while they are in use or in the block cache.  It
+// must be safe to call concurrently from multiple threads.
+//
+// A builtin implementation that hands out memory from per-size-class
+// free lists is provided.  Clients may use their own implementations
+// (e.g. one backed by a slab or arena allocator).
+
+#ifndef STORAGE_LEVELDB_INCLUDE_MEMORY_ALLOCATOR_H_
+#define STORAGE_LEVELDB_INCLUDE_MEMORY_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+// Memory use of an allocator, in bytes
+struct LEVELDB_EXPORT MemoryAllocatorStats {
+  uint64_t requested;   // Asked for by live allocations
+  uint64_t allocated;   // Set aside for live allocations
+  uint64_t free;        // Held for reuse by later allocations
+  uint64_t reserved;    // Obtained from the system; at least the above
+};
+
+class LEVELDB_EXPORT MemoryAllocator {
+ public:
+  MemoryAllocator() { }
+  virtual ~MemoryAllocator();
+
+  // The name of the allocator, used in log messages.
+  virtual const char* Name() const = 0;
+
+  // Return a pointer to at least "size" bytes of memory.  "size" is
+  // always positive.
+  virtual char* Allocate(size_t size) = 0;
+
+  // Free memory returned by an earlier call to Allocate().
+  virtual void Deallocate(char* p) = 0;
+
+  // Return the number of bytes set aside for "p", which was returned by
+  // Allocate(size).  The block cache charges blocks by this amount.
+  // The default implementation returns size.
+  virtual size_t UsableSize(const char* p, size_t size) const;
+
+  // If the allocator keeps statistics, store them in *stats and return
+  // true.  The default implementation returns false.
+  virtual bool GetStats(MemoryAllocatorStats* stats) const;
+
+ private:
+  // No copying allowed
+  MemoryAllocator(const MemoryAllocator&);
+  void operator=(const MemoryAllocator&);
+};
+
+// Create an allocator that rounds requests up to one of a set of size
+// classes and keeps freed memory on a free list per class for reuse, so
+// that block cache churn does not fragment the heap.  The memory is
+// carved out of large slabs, which are returned to the system only when
+// the allocator is deleted.  If "use_huge_pages" is true, the slabs are
+// aligned to and advised for transparent huge pages where the platform
+// supports it.  Requests larger than the biggest size class are passed
+// to the system allocator.  The allocator keeps statistics, which show
+// how much of the reserved memory is lost to rounding and free lists.
+LEVELDB_EXPORT MemoryAllocator* NewSizeClassAllocator(bool use_huge_pages);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_MEMORY_ALLOCATOR_H_
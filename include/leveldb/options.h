@@ -6,16 +6,20 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <stddef.h>
+#include <stdint.h>
 #include "leveldb/export.h"
 
 namespace leveldb {
 
 class Cache;
 class Comparator;
+class CompactionService;
 class Env;
 class FilterPolicy;
 class Logger;
+class MemoryAllocator;
 class Snapshot;
+class TableFactory;
 
 // DB contents are stored in a set of blocks, each of which holds a
 // sequence of key,value pairs.  Each block may be compressed before
@@ -98,6 +102,14 @@ struct LEVELDB_EXPORT Options {
   // Default: NULL
   Cache* block_cache;
 
+  // If non-NULL, use the specified allocator for the memory of blocks
+  // read from table files, including blocks held by the block cache.
+  // Cached blocks free their memory through the allocator, so it must
+  // outlive the DB and any block_cache supplied above.
+  // If NULL, blocks are allocated with new[].
+  // Default: NULL
+  MemoryAllocator* memory_allocator;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -113,6 +125,33 @@ struct LEVELDB_EXPORT Options {
   // Default: 16
   int block_restart_interval;
 
+  // Values of at least this many bytes are written uncompressed to a
+  // data block of their own, so that DB::GetRange() can read just the
+  // requested part of them from the file.  Zero disables this.  This
+  // parameter can be changed dynamically.
+  //
+  // Default: 0
+  size_t large_value_threshold;
+
+  // If true, tables are laid out so that no block that fits in a 4KB page
+  // crosses a page boundary: the file is padded before such a block where
+  // needed, and data blocks are ended early so that they fit in a page.
+  // Reading a block then touches a single page of an mmapped file or of
+  // the page cache, at the cost of somewhat larger files and of more,
+  // smaller blocks when block_size exceeds a page.  Tables written with
+  // this option can be read without it.  This parameter can be changed
+  // dynamically.
+  //
+  // Default: false
+  bool block_align;
+
+  // If non-NULL, new tables are written in the format of this factory
+  // (see leveldb/table_factory.h).  Tables already written in another
+  // format can still be read.  The factory must outlive the DB.
+  // If NULL, the block-based format is used.
+  // Default: NULL
+  const TableFactory* table_factory;
+
   // Leveldb will write up to this amount of bytes to a file before
   // switching to a new one.
   // Most clients should leave this parameter alone.  However if your
@@ -147,6 +186,25 @@ struct LEVELDB_EXPORT Options {
   // Default: currently false, but may become true later.
   bool reuse_logs;
 
+  // EXPERIMENTAL: If true, a memtable compaction may be written as
+  // several tables, cut at the file boundaries of the first non-empty
+  // level below level-0.  Pieces that do not overlap existing files can
+  // then be placed directly into deeper levels, and pieces that stay in
+  // level-0 overlap fewer level-1 files, which keeps the following
+  // compactions small.  Every piece but the last holds at least
+  // max_file_size/2 bytes.
+  //
+  // Default: false
+  bool partition_memtable_output;
+
+  // If true, compactions build and write their output tables on a
+  // separate thread while the compaction thread keeps reading and
+  // merging the inputs.  Entries are handed over in batches through a
+  // small bounded queue, so extra memory use stays around 1MB.
+  //
+  // Default: false
+  bool pipelined_compaction;
+
   // If non-NULL, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -154,10 +212,47 @@ struct LEVELDB_EXPORT Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If non-zero, obsolete files are deleted on a background thread at
+  // no more than this many bytes per second, instead of right away by the
+  // thread that made them obsolete.  Use this when unlinking large files
+  // causes I/O latency spikes.
+  //
+  // Default: 0
+  size_t delete_rate_bytes_per_sec;
+
+  // If non-zero, files deleted at a limited rate (see above) are shrunk
+  // by this many bytes at a time before being unlinked, so that the
+  // space is returned to the filesystem gradually.  Ignored if the Env
+  // cannot truncate files.
+  //
+  // Default: 0
+  size_t delete_truncate_step;
+
+  // EXPERIMENTAL: If non-NULL, compactions between levels are handed to
+  // this service (see leveldb/compaction_service.h) instead of being run
+  // on the DB's background thread.  Memtable compactions still run
+  // locally, including while the service is busy.
+  //
+  // Default: NULL
+  CompactionService* compaction_service;
+
+  // Maximum number of threads that finish the lookups of DB::GetAsync()
+  // and DB::MultiGetAsync() which need to read from disk.  Threads are
+  // started when first needed.
+  //
+  // Default: 4
+  int async_read_threads;
+
   // Create an Options object with default values for all fields.
   Options();
 };
 
+// Which data a read may consult
+enum ReadTier {
+  kReadAllTier = 0,     // Memtables, block cache, and files on disk
+  kBlockCacheTier = 1   // Memtables and block cache only
+};
+
 // Options that control read operations
 struct LEVELDB_EXPORT ReadOptions {
   // If true, all data read from underlying storage will be
@@ -177,10 +272,50 @@ struct LEVELDB_EXPORT ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If true, create a tailing iterator for readers that follow keys as
+  // they are appended.  Every Seek(), SeekToFirst() and SeekToLast()
+  // first refreshes the iterator (see Iterator::Refresh()), so it sees
+  // all data written before the call, usually without being rebuilt.
+  // Next() may also return entries written after the iterator was
+  // positioned.  "snapshot" is ignored.  Has no effect on Get().
+  // Default: false
+  bool tailing;
+
+  // With kBlockCacheTier, reads never do file I/O: a Get() or iterator
+  // that would need a data block or table that is not already cached
+  // stops with a Status::Incomplete() error instead.  Iterators become
+  // invalid at that point.  Tables that the Env maps into memory are
+  // still read directly, which may fault pages in from disk.
+  // Default: kReadAllTier
+  ReadTier read_tier;
+
+  // If non-zero, the time in Env::NowMicros() units after which the read
+  // gives up.  It is checked before every table or block that has to be
+  // read from a file: once it has passed, Get() returns
+  // Status::TimedOut() and iterators become invalid with that status.
+  // Data that is already in memory is still returned.
+  // Default: 0
+  uint64_t deadline;
+
+  // If true, an iterator keeps every block it reads in memory until it is
+  // deleted or refreshed, and its key() and value() point straight into
+  // those blocks instead of into buffers that the next move overwrites
+  // (see Iterator::IsKeyPinned()).  Scans then copy no keys or values.
+  // Keys are only pinned in tables written with block_restart_interval
+  // == 1, since prefix-compressed keys have to be rebuilt.  Memory use
+  // grows with the amount of data the iterator reads.  Has no effect on
+  // Get().
+  // Default: false
+  bool pin_data;
+
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        snapshot(NULL),
+        tailing(false),
+        read_tier(kReadAllTier),
+        deadline(0),
+        pin_data(false) {
   }
 };
 
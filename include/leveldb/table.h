@@ -11,6 +11,7 @@
 
 namespace leveldb {
 
+class Arena;
 class Block;
 class BlockHandle;
 class Footer;
@@ -63,15 +64,39 @@ class LEVELDB_EXPORT Table {
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
 
-  // Calls (*handle_result)(arg, ...) with the entry found after a call
-  // to Seek(key).  May not make such a call if filter policy says
-  // that key is not present.
+  // The members below are internal to the library; only TableCache uses
+  // them.
   friend class TableCache;
+
+  // Like NewIterator(), but places the iterator in *arena, if non-NULL.
+  Iterator* NewIterator(const ReadOptions&, Arena* arena) const;
+
+  // Calls (*handle_result)(arg, ...) with the entry found after a call
+  // to Seek(key), passing only the bytes [offset, offset+length) of its
+  // value.  May not make such a call if filter policy says that key is
+  // not present.
   Status InternalGet(
       const ReadOptions&, const Slice& key,
+      uint64_t offset, uint64_t length,
       void* arg,
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
+  // If "handle" refers to an uncompressed block holding a single entry,
+  // reads just the key and the requested part of the value of that entry
+  // from the file, calls (*handle_result)(...) as InternalGet() does and
+  // returns true.  Returns false if the block has some other layout.
+  bool GetFromLargeValueBlock(
+      const ReadOptions&, const BlockHandle& handle, const Slice& key,
+      uint64_t offset, uint64_t length, Status* s,
+      void* arg,
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+
+  // Returns an iterator over the index block.  Its keys separate the data
+  // blocks and its values are the encoded BlockHandles of the blocks.
+  Iterator* NewIndexIterator() const;
+
+  // The read_into_scratch argument of ReadBlock() for this table
+  bool ReadIntoScratch() const;
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
@@ -0,0 +1,86 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A TableFactory selects the format of the table files that a DB (or a
+// TableBuilder) writes.  Tables are read in whatever format they were
+// written in, which is recognized by the magic number at the end of the
+// file, so the factory may be changed between opens of a DB.
+//
+// If Options::table_factory is NULL, the block-based format is used:
+// blocks of prefix-compressed entries, optionally compressed, that are
+// read through the block cache.  See NewPlainTableFactory() and
+// NewCuckooTableFactory() below for formats suited to tables that are
+// kept in memory.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_TABLE_FACTORY_H_
+#define STORAGE_LEVELDB_INCLUDE_TABLE_FACTORY_H_
+
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+struct Options;
+class TableBuilder;
+class TableWriter;
+class WritableFile;
+
+class LEVELDB_EXPORT TableFactory {
+ public:
+  TableFactory() { }
+  virtual ~TableFactory();
+
+  // The name of the table format, used in log messages.
+  virtual const char* Name() const = 0;
+
+ private:
+  // Only the builtin formats are supported.
+  friend class TableBuilder;
+  virtual TableWriter* NewTableWriter(const Options& options,
+                                      WritableFile* file) const = 0;
+
+  // No copying allowed
+  TableFactory(const TableFactory&);
+  void operator=(const TableFactory&);
+};
+
+// Return a factory for plain tables, which are meant to be read from
+// memory: from an mmapped file (see Env::NewRandomAccessFile()), or else
+// from a copy of the whole file that is read when the table is opened.
+// Entries are stored one after the other without prefix compression or
+// block compression, and are read in place, so the block cache is not
+// used.  In tables written by a DB, a hash index over the user keys
+// finds the entries for a key with a single probe.  Every
+// "index_interval"-th entry is also recorded in a sorted index that
+// serves seeks.  Smaller values make seeks faster and tables larger.
+//
+// Plain tables hold no checksums and are limited to 4GB.  Options
+// compression, block_size, block_restart_interval, block_align,
+// large_value_threshold and filter_policy do not apply to them.
+//
+// The result must be deleted when no longer needed, after any DB that
+// uses it has been closed.
+LEVELDB_EXPORT TableFactory* NewPlainTableFactory(int index_interval);
+
+// Return a factory for cuckoo tables, which, like plain tables, are read
+// from memory and hold their entries unencoded.  They are meant for data
+// that is bulk-loaded and then served by point lookups.  A cuckoo hash
+// index finds the entries for a key in at most three probes, with no
+// filter, sorted index or binary search involved.  Tables can be
+// written with a TableBuilder (e.g. to build a DB's files offline) or
+// by a DB, and are read through the usual table cache.
+//
+// Iterating over a cuckoo table first scans all of its entries to
+// collect their offsets (four bytes of memory per entry, kept until
+// the table is closed), so iterators and compactions are slower to
+// start than with other formats.  Cuckoo tables hold no checksums and
+// are limited to 4GB.  The block-specific options listed for plain
+// tables do not apply to them either.
+//
+// The result must be deleted when no longer needed, after any DB that
+// uses it has been closed.
+LEVELDB_EXPORT TableFactory* NewCuckooTableFactory();
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_TABLE_FACTORY_H_
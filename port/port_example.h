@@ -124,6 +124,11 @@ extern bool Snappy_Uncompress(const char* input_data, size_t input_length,
 
 // ------------------ Miscellaneous -------------------
 
+// Returns a buffer of at least n bytes that belongs to the calling thread.
+// The buffer is reused by the next call on the same thread and freed when
+// the thread exits.
+extern char* ThreadLocalScratch(size_t n);
+
 // If heap profiling is not supported, returns false.
 // Else repeatedly calls (*func)(arg, data, n) and then returns true.
 // The concatenation of all "data[0,n-1]" fragments is the heap profile.
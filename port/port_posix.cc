@@ -49,5 +49,45 @@ void InitOnce(OnceType* once, void (*initializer)()) {
   PthreadCall("once", pthread_once(once, initializer));
 }
 
+namespace {
+
+struct Scratch {
+  char* buf;
+  size_t size;
+};
+
+pthread_key_t scratch_key;
+OnceType scratch_once = LEVELDB_ONCE_INIT;
+
+void DeleteScratch(void* arg) {
+  Scratch* scratch = reinterpret_cast<Scratch*>(arg);
+  delete[] scratch->buf;
+  delete scratch;
+}
+
+void InitScratchKey() {
+  PthreadCall("key create", pthread_key_create(&scratch_key, &DeleteScratch));
+}
+
+}  // namespace
+
+char* ThreadLocalScratch(size_t n) {
+  InitOnce(&scratch_once, &InitScratchKey);
+  Scratch* scratch = reinterpret_cast<Scratch*>(
+      pthread_getspecific(scratch_key));
+  if (scratch == NULL) {
+    scratch = new Scratch;
+    scratch->buf = NULL;
+    scratch->size = 0;
+    PthreadCall("set specific", pthread_setspecific(scratch_key, scratch));
+  }
+  if (scratch->size < n) {
+    delete[] scratch->buf;
+    scratch->buf = new char[n];
+    scratch->size = n;
+  }
+  return scratch->buf;
+}
+
 }  // namespace port
 }  // namespace leveldb
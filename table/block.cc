@@ -8,8 +8,12 @@
 
 #include <vector>
 #include <algorithm>
+#include <new>
 #include "leveldb/comparator.h"
+#include "leveldb/memory_allocator.h"
 #include "table/format.h"
+#include "table/iterator_wrapper.h"
+#include "util/arena.h"
 #include "util/coding.h"
 #include "util/logging.h"
 
@@ -48,7 +52,12 @@ inline uint32_t Block::NumRestarts() const {
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
-      owned_(contents.heap_allocated) {
+      owned_(contents.heap_allocated),
+      allocator_(contents.heap_allocated ? contents.allocator : NULL),
+      charge_(size_) {
+  if (allocator_ != NULL) {
+    charge_ = allocator_->UsableSize(data_, size_);
+  }
   // 都不够容纳一个表示重启点数组大小的情况
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
@@ -69,7 +78,7 @@ Block::Block(const BlockContents& contents)
 
 Block::~Block() {
   if (owned_) {
-    delete[] data_;
+    DeleteBlockData(allocator_, data_);
   }
 }
 
@@ -116,7 +125,8 @@ class Block::Iter : public Iterator {
   // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
   uint32_t current_;
   uint32_t restart_index_;  // Index of restart block in which current_ falls
-  std::string key_;
+  Slice key_;               // Points into data_ or key_buf_
+  std::string key_buf_;     // Holds key_ when it is prefix-compressed
   Slice value_;
   Status status_;
 
@@ -174,6 +184,10 @@ class Block::Iter : public Iterator {
     assert(Valid());
     return value_;
   }
+  virtual bool IsKeyPinned() const {
+    assert(Valid());
+    return key_.data() != key_buf_.data();
+  }
 
   virtual void Next() {
     assert(Valid());
@@ -308,9 +322,19 @@ class Block::Iter : public Iterator {
       return false;
     } else {
       // 如果是p的位置是重启点指向的位置，那么解析出来的shared应该
-      // 为0, 而key_.resize(shared)会将key_中的内容清空
-      key_.resize(shared);
-      key_.append(p, non_shared);
+      // 为0
+      if (shared == 0) {
+        // Stored in full: point into the block instead of copying
+        key_ = Slice(p, non_shared);
+      } else {
+        if (key_.data() != key_buf_.data()) {
+          key_buf_.assign(key_.data(), shared);
+        } else {
+          key_buf_.resize(shared);
+        }
+        key_buf_.append(p, non_shared);
+        key_ = key_buf_;
+      }
       value_ = Slice(p + non_shared, value_length);
       // 如果当前的位置已经大于等于下一个重启点的位置
       // 则更新重启点索引信息
@@ -323,13 +347,16 @@ class Block::Iter : public Iterator {
   }
 };
 
-Iterator* Block::NewIterator(const Comparator* cmp) {
+Iterator* Block::NewIterator(const Comparator* cmp, Arena* arena) {
   if (size_ < sizeof(uint32_t)) {
-    return NewErrorIterator(Status::Corruption("bad block contents"));
+    return NewErrorIterator(Status::Corruption("bad block contents"), arena);
   }
   const uint32_t num_restarts = NumRestarts();
   if (num_restarts == 0) {
-    return NewEmptyIterator();
+    return NewEmptyIterator(arena);
+  } else if (arena != NULL) {
+    void* mem = arena->AllocateAligned(sizeof(Iter));
+    return new (mem) Iter(cmp, data_, restart_offset_, num_restarts);
   } else {
     return new Iter(cmp, data_, restart_offset_, num_restarts);
   }
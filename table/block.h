@@ -12,7 +12,9 @@
 namespace leveldb {
 
 struct BlockContents;
+class Arena;
 class Comparator;
+class MemoryAllocator;
 
 class Block {
  public:
@@ -22,7 +24,13 @@ class Block {
   ~Block();
 
   size_t size() const { return size_; }
-  Iterator* NewIterator(const Comparator* comparator);
+
+  // Bytes of memory held by the block, which is what it costs to keep
+  // it in the block cache
+  size_t charge() const { return charge_; }
+  // If "arena" is non-NULL the result is placed in *arena and must be
+  // released with iter->~Iterator() instead of delete.
+  Iterator* NewIterator(const Comparator* comparator, Arena* arena = NULL);
 
  private:
   uint32_t NumRestarts() const;
@@ -31,6 +39,8 @@ class Block {
   size_t size_;
   uint32_t restart_offset_;     // Offset in data_ of restart array
   bool owned_;                  // Block owns data_[]
+  MemoryAllocator* allocator_;  // Allocator of data_ if owned_, or NULL
+  size_t charge_;
 
   // No copying allowed
   Block(const Block&);
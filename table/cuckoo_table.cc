@@ -0,0 +1,541 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/cuckoo_table.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+#include "leveldb/comparator.h"
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "leveldb/options.h"
+#include "leveldb/table_factory.h"
+#include "port/port.h"
+#include "table/format.h"
+#include "table/iterator_wrapper.h"
+#include "table/plain_table.h"
+#include "table/table_reader.h"
+#include "table/table_writer.h"
+#include "util/arena.h"
+#include "util/coding.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+
+namespace leveldb {
+
+namespace {
+
+static const uint32_t kSeedA = 0xbc9f1d34;
+static const uint32_t kSeedB = 0x7a3c8e15;
+
+static const int kNumHashes = 3;
+
+// Footer flag: the table holds internal keys, hashed by their user key
+static const uint32_t kHashUserKeys = 0x1;
+
+// Evictions tried when placing one key before starting over
+static const int kMaxDisplacements = 500;
+
+// Offsets are stored as fixed32, and buckets hold offsets plus one
+static const uint64_t kMaxDataSize = 0xffffffffu - 1;
+
+// Size of the fixed fields at the start of the footer
+static const size_t kFooterFieldsSize = 8 + 4 * 4;
+
+// Entries per range of the index iterator
+static const uint32_t kIndexInterval = 16;
+
+static bool IsInternalKeyComparator(const Comparator* cmp) {
+  return strcmp(cmp->Name(), "leveldb.InternalKeyComparator") == 0;
+}
+
+static Slice UserKey(const Slice& internal_key) {
+  return Slice(internal_key.data(), internal_key.size() - 8);
+}
+
+// The bucket of the i-th hash function of a key whose two independent
+// hashes are hash_a and hash_b.  The first function needs only hash_a.
+static uint32_t Bucket(uint32_t hash_a, uint32_t hash_b, int i,
+                       uint32_t seed, uint32_t num_buckets) {
+  uint32_t h = hash_a + i * hash_b + seed * 0x9e3779b9u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return static_cast<uint32_t>(
+      (static_cast<uint64_t>(h) * num_buckets) >> 32);
+}
+
+class CuckooTableWriter : public TableWriter {
+ public:
+  CuckooTableWriter(const Options& options, WritableFile* file)
+      : file_(file),
+        hash_user_keys_(IsInternalKeyComparator(options.comparator)),
+        offset_(0),
+        num_entries_(0) {
+  }
+
+  virtual void Add(const Slice& key, const Slice& value);
+  virtual Status status() const { return status_; }
+  virtual Status Finish();
+  virtual uint64_t NumEntries() const { return num_entries_; }
+  virtual uint64_t FileSize() const { return offset_; }
+
+ private:
+  struct KeyInfo {
+    uint32_t hash_a;
+    uint32_t hash_b;
+    uint32_t offset;      // Of the first entry with the key
+  };
+
+  // Try to place every key into *buckets, which get num_buckets
+  // elements holding the index of a key plus one, or zero
+  bool PlaceKeys(uint32_t num_buckets, uint32_t seed,
+                 std::vector<uint32_t>* buckets) const;
+
+  WritableFile* const file_;
+  const bool hash_user_keys_;
+  Status status_;
+  uint64_t offset_;
+  uint64_t num_entries_;
+  std::string entry_;       // Encoding of the entry being added
+  std::string last_key_;    // Last hashed key
+  std::vector<KeyInfo> keys_;
+};
+
+void CuckooTableWriter::Add(const Slice& key, const Slice& value) {
+  if (!status_.ok()) return;
+  entry_.clear();
+  PutVarint32(&entry_, key.size());
+  entry_.append(key.data(), key.size());
+  PutVarint32(&entry_, value.size());
+  if (offset_ + entry_.size() + value.size() > kMaxDataSize) {
+    status_ = Status::NotSupported("cuckoo table larger than 4GB");
+    return;
+  }
+
+  Slice hashed = key;
+  if (hash_user_keys_) {
+    if (key.size() < 8) {
+      status_ = Status::InvalidArgument("bad internal key");
+      return;
+    }
+    hashed = UserKey(key);
+  }
+  if (keys_.empty() || hashed != Slice(last_key_)) {
+    KeyInfo info;
+    info.hash_a = Hash(hashed.data(), hashed.size(), kSeedA);
+    info.hash_b = Hash(hashed.data(), hashed.size(), kSeedB);
+    info.offset = static_cast<uint32_t>(offset_);
+    keys_.push_back(info);
+    last_key_.assign(hashed.data(), hashed.size());
+  }
+
+  status_ = file_->Append(entry_);
+  if (status_.ok()) {
+    status_ = file_->Append(value);
+  }
+  if (status_.ok()) {
+    offset_ += entry_.size() + value.size();
+    num_entries_++;
+  }
+}
+
+bool CuckooTableWriter::PlaceKeys(uint32_t num_buckets, uint32_t seed,
+                                  std::vector<uint32_t>* buckets) const {
+  buckets->assign(num_buckets, 0);
+  Random rnd(seed + 1);
+  for (size_t k = 0; k < keys_.size(); k++) {
+    uint32_t item = static_cast<uint32_t>(k + 1);
+    uint32_t from = num_buckets;    // Bucket that item was evicted from
+    for (int displacements = 0; ; displacements++) {
+      const KeyInfo& info = keys_[item - 1];
+      uint32_t b[kNumHashes];
+      bool placed = false;
+      for (int i = 0; i < kNumHashes && !placed; i++) {
+        b[i] = Bucket(info.hash_a, info.hash_b, i, seed, num_buckets);
+        if ((*buckets)[b[i]] == 0) {
+          (*buckets)[b[i]] = item;
+          placed = true;
+        }
+      }
+      if (placed) break;
+      if (displacements == kMaxDisplacements) {
+        return false;
+      }
+      // Evict the key of another bucket than the one item just left
+      int i = rnd.Uniform(kNumHashes);
+      if (b[i] == from) {
+        i = (i + 1) % kNumHashes;
+      }
+      std::swap(item, (*buckets)[b[i]]);
+      from = b[i];
+    }
+  }
+  return true;
+}
+
+Status CuckooTableWriter::Finish() {
+  if (!status_.ok()) return status_;
+
+  // Start at a load factor of 0.8, which three hash functions reach
+  // with few evictions
+  const size_t n = keys_.size();
+  uint32_t num_buckets = (n == 0) ? 0 : static_cast<uint32_t>(n + n / 4 + 1);
+  uint32_t seed = 0;
+  std::vector<uint32_t> buckets;
+  while (n > 0 && !PlaceKeys(num_buckets, seed, &buckets)) {
+    num_buckets += num_buckets / 16 + 1;
+    seed++;
+  }
+
+  std::string tail;
+  tail.reserve(4 * static_cast<size_t>(num_buckets) + Footer::kEncodedLength);
+  for (uint32_t i = 0; i < num_buckets; i++) {
+    const uint32_t item = buckets[i];
+    PutFixed32(&tail, (item == 0) ? 0 : keys_[item - 1].offset + 1);
+  }
+  PutFixed64(&tail, offset_);
+  PutFixed32(&tail, static_cast<uint32_t>(num_entries_));
+  PutFixed32(&tail, num_buckets);
+  PutFixed32(&tail, seed);
+  PutFixed32(&tail, hash_user_keys_ ? kHashUserKeys : 0);
+  tail.append(Footer::kEncodedLength - 8 - kFooterFieldsSize, '\0');
+  PutFixed64(&tail, kCuckooTableMagicNumber);
+
+  status_ = file_->Append(tail);
+  if (status_.ok()) {
+    offset_ += tail.size();
+  }
+  return status_;
+}
+
+class CuckooTableFactory : public TableFactory {
+ public:
+  CuckooTableFactory() { }
+
+  virtual const char* Name() const { return "leveldb.CuckooTable"; }
+
+ private:
+  virtual TableWriter* NewTableWriter(const Options& options,
+                                      WritableFile* file) const {
+    return new CuckooTableWriter(options, file);
+  }
+};
+
+class CuckooTableReader : public TableReader {
+ public:
+  CuckooTableReader(const Options& options, const char* data,
+                    char* owned, const Slice& footer);
+  virtual ~CuckooTableReader() { delete[] owned_; }
+
+  virtual Iterator* NewIterator(const ReadOptions& options,
+                                Arena* arena) const;
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     bool* found, Slice* found_key,
+                     Slice* found_value) const;
+  virtual Iterator* NewIndexIterator() const;
+  virtual uint64_t ApproximateOffsetOf(const Slice& key) const;
+
+ private:
+  friend class CuckooTableIterator;
+
+  // Decode the entry at "offset" and set *next to the offset of the
+  // entry after it.  Returns false if the entry is corrupt.
+  bool EntryAt(uint64_t offset, Slice* key, Slice* value,
+               uint64_t* next) const {
+    if (offset >= data_size_) {
+      return false;
+    }
+    const char* p = DecodePlainTableEntry(data_ + offset, data_ + data_size_,
+                                          key, value);
+    if (p == NULL) {
+      return false;
+    }
+    *next = p - data_;
+    return true;
+  }
+
+  // The hash index has no order, so iterators use the offsets of all
+  // entries, which are collected by a scan of the table on first use.
+  // Sets *offsets to NULL if the table is corrupt.
+  Status EntryOffsets(const std::vector<uint32_t>** offsets) const;
+
+  const Comparator* const comparator_;
+  const char* const data_;      // The table, starting with the entries
+  char* const owned_;           // Copy of the table if the file is not
+                                // in memory, else NULL
+  uint64_t data_size_;
+  uint32_t num_entries_;
+  const char* buckets_;
+  uint32_t num_buckets_;
+  uint32_t seed_;
+  uint32_t flags_;
+
+  // State below is protected by mu_
+  mutable port::Mutex mu_;
+  mutable bool offsets_done_;
+  mutable Status offsets_status_;
+  mutable std::vector<uint32_t> offsets_;   // Unchanged once offsets_done_
+};
+
+CuckooTableReader::CuckooTableReader(const Options& options,
+                                     const char* data,
+                                     char* owned, const Slice& footer)
+    : comparator_(options.comparator),
+      data_(data),
+      owned_(owned),
+      offsets_done_(false) {
+  data_size_ = DecodeFixed64(footer.data());
+  num_entries_ = DecodeFixed32(footer.data() + 8);
+  num_buckets_ = DecodeFixed32(footer.data() + 12);
+  seed_ = DecodeFixed32(footer.data() + 16);
+  flags_ = DecodeFixed32(footer.data() + 20);
+  buckets_ = data_ + data_size_;
+}
+
+Status CuckooTableReader::Get(const ReadOptions& options, const Slice& k,
+                              bool* found, Slice* found_key,
+                              Slice* found_value) const {
+  *found = false;
+  const bool user_keys = (flags_ & kHashUserKeys) != 0;
+  if (num_buckets_ == 0 || (user_keys && k.size() < 8)) {
+    return Status::OK();
+  }
+  const Slice hashed = user_keys ? UserKey(k) : k;
+  const uint32_t hash_a = Hash(hashed.data(), hashed.size(), kSeedA);
+  uint32_t hash_b = 0;
+  Slice key, value;
+  uint64_t next;
+  for (int i = 0; i < kNumHashes; i++) {
+    if (i == 1) {
+      hash_b = Hash(hashed.data(), hashed.size(), kSeedB);
+    }
+    const uint32_t b = Bucket(hash_a, hash_b, i, seed_, num_buckets_);
+    const uint32_t slot = DecodeFixed32(buckets_ + 4 * b);
+    if (slot == 0) continue;
+    uint64_t offset = slot - 1;
+    if (!EntryAt(offset, &key, &value, &next) ||
+        (user_keys && key.size() < 8)) {
+      return Status::Corruption("bad entry in cuckoo table");
+    }
+    if ((user_keys ? UserKey(key) : key) != hashed) continue;
+
+    if (user_keys) {
+      // Newer entries of a user key come first; skip those that are
+      // newer than k
+      while (comparator_->Compare(key, k) < 0) {
+        offset = next;
+        if (offset >= data_size_) return Status::OK();
+        if (!EntryAt(offset, &key, &value, &next) || key.size() < 8) {
+          return Status::Corruption("bad entry in cuckoo table");
+        }
+        if (UserKey(key) != hashed) return Status::OK();
+      }
+    }
+    *found = true;
+    *found_key = key;
+    *found_value = value;
+    return Status::OK();
+  }
+  return Status::OK();
+}
+
+Status CuckooTableReader::EntryOffsets(
+    const std::vector<uint32_t>** offsets) const {
+  MutexLock l(&mu_);
+  if (!offsets_done_) {
+    offsets_.reserve(num_entries_);
+    uint64_t offset = 0;
+    Slice key, value;
+    uint64_t next;
+    while (offset < data_size_) {
+      if (!EntryAt(offset, &key, &value, &next)) {
+        offsets_status_ = Status::Corruption("bad entry in cuckoo table");
+        break;
+      }
+      offsets_.push_back(static_cast<uint32_t>(offset));
+      offset = next;
+    }
+    offsets_done_ = true;
+  }
+  *offsets = offsets_status_.ok() ? &offsets_ : NULL;
+  return offsets_status_;
+}
+
+// Iterates over the entries in order, or, for the index iterator, over
+// ranges of "stride" entries.  The key of a range is the key of its last
+// entry and its value is the encoded BlockHandle of the range.
+class CuckooTableIterator : public Iterator {
+ public:
+  CuckooTableIterator(const CuckooTableReader* table,
+                      const std::vector<uint32_t>* offsets,
+                      uint32_t stride)
+      : table_(table),
+        offsets_(*offsets),
+        stride_(stride),
+        num_positions_(static_cast<uint32_t>(
+            (offsets->size() + stride - 1) / stride)),
+        pos_(num_positions_) {
+  }
+
+  virtual bool Valid() const { return pos_ < num_positions_; }
+  virtual void SeekToFirst() { SetPosition(0); }
+  virtual void SeekToLast() { SetPosition(num_positions_ - 1); }
+
+  virtual void Seek(const Slice& target) {
+    // Binary search for the first position with a key at or after target
+    uint32_t left = 0;
+    uint32_t right = num_positions_;
+    while (left < right) {
+      const uint32_t mid = left + (right - left) / 2;
+      SetPosition(mid);
+      if (!Valid()) return;
+      if (table_->comparator_->Compare(key_, target) < 0) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    SetPosition(left);
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    SetPosition(pos_ + 1);
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    SetPosition(pos_ - 1);   // Wraps around to invalid at the start
+  }
+
+  virtual Slice key() const {
+    assert(Valid());
+    return key_;
+  }
+
+  virtual Slice value() const {
+    assert(Valid());
+    return value_;
+  }
+
+  virtual Status status() const { return status_; }
+
+  // Keys point into the table, which outlives the iterator
+  virtual bool IsKeyPinned() const { return true; }
+
+  // The offset of the first entry at the current position
+  uint64_t offset() const {
+    assert(Valid());
+    return offsets_[static_cast<size_t>(pos_) * stride_];
+  }
+
+ private:
+  void SetPosition(uint32_t pos) {
+    pos_ = pos;
+    if (!Valid()) return;
+    const uint64_t last = std::min<uint64_t>(
+        static_cast<uint64_t>(pos_) * stride_ + stride_, offsets_.size()) - 1;
+    uint64_t next;
+    if (!table_->EntryAt(offsets_[last], &key_, &value_, &next)) {
+      status_ = Status::Corruption("bad entry in cuckoo table");
+      pos_ = num_positions_;
+      return;
+    }
+    if (stride_ > 1) {
+      const uint64_t start = offset();
+      BlockHandle handle;
+      handle.set_offset(start);
+      handle.set_size(next - start);
+      handle_encoding_.clear();
+      handle.EncodeTo(&handle_encoding_);
+      value_ = handle_encoding_;
+    }
+  }
+
+  const CuckooTableReader* const table_;
+  const std::vector<uint32_t>& offsets_;
+  const uint32_t stride_;
+  const uint32_t num_positions_;
+  uint32_t pos_;
+  Slice key_;
+  Slice value_;
+  std::string handle_encoding_;
+  Status status_;
+};
+
+Iterator* CuckooTableReader::NewIterator(const ReadOptions& options,
+                                         Arena* arena) const {
+  const std::vector<uint32_t>* offsets;
+  Status s = EntryOffsets(&offsets);
+  if (!s.ok()) {
+    return NewErrorIterator(s, arena);
+  }
+  if (arena != NULL) {
+    void* mem = arena->AllocateAligned(sizeof(CuckooTableIterator));
+    return new (mem) CuckooTableIterator(this, offsets, 1);
+  }
+  return new CuckooTableIterator(this, offsets, 1);
+}
+
+Iterator* CuckooTableReader::NewIndexIterator() const {
+  const std::vector<uint32_t>* offsets;
+  Status s = EntryOffsets(&offsets);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
+  }
+  return new CuckooTableIterator(this, offsets, kIndexInterval);
+}
+
+uint64_t CuckooTableReader::ApproximateOffsetOf(const Slice& key) const {
+  const std::vector<uint32_t>* offsets;
+  if (!EntryOffsets(&offsets).ok()) {
+    return data_size_;
+  }
+  CuckooTableIterator iter(this, offsets, 1);
+  iter.Seek(key);
+  if (!iter.Valid()) {
+    return data_size_;
+  }
+  return iter.offset();
+}
+
+}  // namespace
+
+Status NewCuckooTableReader(const Options& options,
+                            RandomAccessFile* file,
+                            uint64_t file_size,
+                            const Slice& footer,
+                            bool file_in_memory,
+                            TableReader** reader) {
+  *reader = NULL;
+  assert(footer.size() == Footer::kEncodedLength);
+  const uint64_t data_size = DecodeFixed64(footer.data());
+  const uint64_t num_buckets = DecodeFixed32(footer.data() + 12);
+  const uint64_t size = file_size - Footer::kEncodedLength;
+  if (data_size > kMaxDataSize || data_size + 4 * num_buckets != size) {
+    return Status::Corruption("bad cuckoo table footer");
+  }
+
+  char* owned;
+  Slice contents;
+  Status s = ReadFileContents(file, size, file_in_memory, &contents, &owned);
+  if (s.ok()) {
+    *reader = new CuckooTableReader(options, contents.data(), owned, footer);
+  }
+  return s;
+}
+
+TableFactory* NewCuckooTableFactory() {
+  return new CuckooTableFactory();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,52 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Cuckoo tables are written by the factory returned by
+// NewCuckooTableFactory().  A cuckoo table file holds:
+//
+//    entries:  every entry, in key order, encoded as in a plain table
+//              (see table/plain_table.h)
+//    buckets:  num_buckets fixed32 buckets
+//    footer:   fixed64 size of the entries
+//              fixed32 num_entries
+//              fixed32 num_buckets
+//              fixed32 seed
+//              fixed32 flags
+//              zero padding to 40 bytes
+//              fixed64 kCuckooTableMagicNumber
+//
+// Each distinct key, or each distinct user key if bit 0 of the flags is
+// set (i.e. the table holds internal keys), is stored in one of three
+// buckets given by hashes of it and the seed, as the offset of its first
+// entry plus one.  Zero marks an empty bucket.  A lookup therefore
+// probes at most three buckets.  The writer places the keys by cuckoo
+// hashing: a key whose buckets are all taken evicts the key in one of
+// them, which moves to another of its own buckets, and so on.  If that
+// does not settle, the writer starts over with more buckets and the next
+// seed.
+
+#ifndef STORAGE_LEVELDB_TABLE_CUCKOO_TABLE_H_
+#define STORAGE_LEVELDB_TABLE_CUCKOO_TABLE_H_
+
+#include <stdint.h>
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+struct Options;
+class RandomAccessFile;
+class Slice;
+class TableReader;
+
+// Like NewPlainTableReader(), for cuckoo tables.
+extern Status NewCuckooTableReader(const Options& options,
+                                   RandomAccessFile* file,
+                                   uint64_t file_size,
+                                   const Slice& footer,
+                                   bool file_in_memory,
+                                   TableReader** reader);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_CUCKOO_TABLE_H_
@@ -4,7 +4,9 @@
 
 #include "table/format.h"
 
+#include <string.h>
 #include "leveldb/env.h"
+#include "leveldb/memory_allocator.h"
 #include "port/port.h"
 #include "table/block.h"
 #include "util/coding.h"
@@ -97,13 +99,32 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
+// Blocks larger than this are never read into thread scratch memory,
+// so that a thread does not keep a huge buffer alive.
+static const size_t kMaxScratchBlockSize = 1 << 20;
+
+static char* NewBlockData(MemoryAllocator* allocator, size_t n) {
+  return (allocator != NULL) ? allocator->Allocate(n) : new char[n];
+}
+
+void DeleteBlockData(MemoryAllocator* allocator, const char* data) {
+  if (allocator != NULL) {
+    allocator->Deallocate(const_cast<char*>(data));
+  } else {
+    delete[] data;
+  }
+}
+
 Status ReadBlock(RandomAccessFile* file,
                  const ReadOptions& options,
                  const BlockHandle& handle,
+                 MemoryAllocator* allocator,
+                 bool read_into_scratch,
                  BlockContents* result) {
   result->data = Slice();
   result->cachable = false;
   result->heap_allocated = false;
+  result->allocator = allocator;
 
   // Read the block contents as well as the type/crc footer.
   // See table_builder.cc for the code that built this structure.
@@ -114,30 +135,37 @@ Status ReadBlock(RandomAccessFile* file,
   //   handle.size()    1 Bytes      4 Bytes
 
   size_t n = static_cast<size_t>(handle.size());
-  char* buf = new char[n + kBlockTrailerSize];
-  Slice contents;
-  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
-  if (!s.ok()) {
-    delete[] buf;
-    return s;
+  const size_t read_size = n + kBlockTrailerSize;
+  // buf is NULL when the read goes to scratch memory, and otherwise
+  // becomes the memory of an uncompressed block.
+  char* buf = NULL;
+  char* scratch;
+  if (read_into_scratch && read_size <= kMaxScratchBlockSize) {
+    scratch = port::ThreadLocalScratch(read_size);
+  } else {
+    buf = NewBlockData(allocator, read_size);
+    scratch = buf;
   }
-  if (contents.size() != n + kBlockTrailerSize) {
-    delete[] buf;
-    return Status::Corruption("truncated block read");
+  Slice contents;
+  Status s = file->Read(handle.offset(), read_size, &contents, scratch);
+  if (s.ok() && contents.size() != read_size) {
+    s = Status::Corruption("truncated block read");
   }
 
   // 如果需要CRC的校验就进行校验
   // Check the crc of the type and the block contents
   const char* data = contents.data();    // Pointer to where Read put the data
-  if (options.verify_checksums) {
+  if (s.ok() && options.verify_checksums) {
     const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
     const uint32_t actual = crc32c::Value(data, n + 1);
     if (actual != crc) {
-      delete[] buf;
       s = Status::Corruption("block checksum mismatch");
-      return s;
     }
   }
+  if (!s.ok()) {
+    if (buf != NULL) DeleteBlockData(allocator, buf);
+    return s;
+  }
 
   switch (data[n]) {
     case kNoCompression:
@@ -147,15 +175,20 @@ Status ReadBlock(RandomAccessFile* file,
       // 那么就需要将多个Block中的数据拷贝到我们自己创建的buffer空间
       // 当中，而这部分空间是在heap上进行分配的，后续我们需要手动
       // 释放，所以在下面会做标记
-      if (data != buf) {
+      if (data != scratch) {
         // File implementation gave us pointer to some other data.
         // Use it directly under the assumption that it will be live
         // while the file is open.
-        delete[] buf;
+        if (buf != NULL) DeleteBlockData(allocator, buf);
         result->data = Slice(data, n);
         result->heap_allocated = false;
         result->cachable = false;  // Do not double-cache
       } else {
+        if (buf == NULL) {
+          // Read into scratch memory, so the block needs its own copy
+          buf = NewBlockData(allocator, n > 0 ? n : 1);
+          memcpy(buf, data, n);
+        }
         result->data = Slice(buf, n);
         result->heap_allocated = true;
         result->cachable = true;
@@ -166,29 +199,60 @@ Status ReadBlock(RandomAccessFile* file,
     case kSnappyCompression: {
       // 如果采用Snappy形式进行压缩，首先先获取数据压缩之前的实际长度
       // 是多少，然后分配对应的空间存储解压之后的数据
+      // The raw data is not needed afterwards, so it is decompressed
+      // straight into the memory that the block will own.
       size_t ulength = 0;
-      if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
-        delete[] buf;
-        return Status::Corruption("corrupted compressed block contents");
+      char* ubuf = NULL;
+      if (port::Snappy_GetUncompressedLength(data, n, &ulength)) {
+        ubuf = NewBlockData(allocator, ulength > 0 ? ulength : 1);
+        if (!port::Snappy_Uncompress(data, n, ubuf)) {
+          DeleteBlockData(allocator, ubuf);
+          ubuf = NULL;
+        }
       }
-      char* ubuf = new char[ulength];
-      if (!port::Snappy_Uncompress(data, n, ubuf)) {
-        delete[] buf;
-        delete[] ubuf;
+      if (buf != NULL) DeleteBlockData(allocator, buf);
+      if (ubuf == NULL) {
         return Status::Corruption("corrupted compressed block contents");
       }
-      delete[] buf;
       result->data = Slice(ubuf, ulength);
       result->heap_allocated = true;
       result->cachable = true;
       break;
     }
     default:
-      delete[] buf;
+      if (buf != NULL) DeleteBlockData(allocator, buf);
       return Status::Corruption("bad block type");
   }
 
   return Status::OK();
 }
 
+Status ReadFileContents(RandomAccessFile* file, uint64_t n,
+                        bool file_in_memory,
+                        Slice* contents, char** owned) {
+  *owned = NULL;
+  Status s;
+  if (file_in_memory) {
+    s = file->Read(0, n, contents, NULL);
+  } else {
+    char* buf = new char[n > 0 ? n : 1];
+    s = file->Read(0, n, contents, buf);
+    if (s.ok() && contents->data() != buf && contents->size() == n) {
+      memcpy(buf, contents->data(), n);
+      *contents = Slice(buf, n);
+    }
+    if (s.ok()) {
+      *owned = buf;
+    } else {
+      delete[] buf;
+    }
+  }
+  if (s.ok() && contents->size() != n) {
+    s = Status::Corruption("truncated table file");
+    delete[] *owned;
+    *owned = NULL;
+  }
+  return s;
+}
+
 }  // namespace leveldb
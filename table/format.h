@@ -14,6 +14,7 @@
 namespace leveldb {
 
 class Block;
+class MemoryAllocator;
 class RandomAccessFile;
 struct ReadOptions;
 
@@ -80,22 +81,61 @@ class Footer {
 // and taking the leading 64 bits.
 static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 
+// The magic number of plain tables (see table/plain_table.h), which end
+// in a footer of the same length.  Picked by running
+//    echo leveldb plain table | sha1sum
+// and taking the leading 64 bits.
+static const uint64_t kPlainTableMagicNumber = 0xe0e4f0554780d243ull;
+
+// The magic number of cuckoo tables (see table/cuckoo_table.h), picked
+// the same way from "leveldb cuckoo table".
+static const uint64_t kCuckooTableMagicNumber = 0xc50263b7c5fef578ull;
+
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
+// With Options::block_align, blocks of up to this size, including their
+// trailer, do not cross a multiple of it.
+static const size_t kBlockAlignment = 4096;
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
-  bool heap_allocated;  // True iff caller should delete[] data.data()
+  bool heap_allocated;  // True iff caller should free data.data()
+  MemoryAllocator* allocator;  // Source of data.data() if heap_allocated;
+                               // NULL means new[]
 };
 
 // Read the block identified by "handle" from "file".  On failure
 // return non-OK.  On success fill *result and return OK.
+//
+// Memory for the block comes from "allocator", or from new[] if it is
+// NULL.  If "read_into_scratch" is true, the raw block is read into a
+// buffer owned by the calling thread, which suits files that are mapped
+// into memory: the read does not touch it.  Otherwise the raw block is
+// read straight into memory from "allocator".  An uncompressed block keeps
+// that memory without a copy; a compressed one is decompressed out of it
+// and the raw memory is freed.
 extern Status ReadBlock(RandomAccessFile* file,
                         const ReadOptions& options,
                         const BlockHandle& handle,
+                        MemoryAllocator* allocator,
+                        bool read_into_scratch,
                         BlockContents* result);
 
+// Free the heap allocated data of a BlockContents
+extern void DeleteBlockData(MemoryAllocator* allocator, const char* data);
+
+// Read bytes [0..n) of "file", for table formats that are read from
+// memory.  If "file_in_memory", file->Read() returns memory of its own
+// that stays valid, which *contents points to, and *owned is set to
+// NULL.  Otherwise the bytes are copied into a new[] array, which
+// *contents points to and which is stored in *owned for the caller to
+// delete[].  On failure *owned is NULL.
+extern Status ReadFileContents(RandomAccessFile* file, uint64_t n,
+                               bool file_in_memory,
+                               Slice* contents, char** owned);
+
 // Implementation details follow.  Clients should ignore,
 
 inline BlockHandle::BlockHandle()
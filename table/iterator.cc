@@ -4,6 +4,11 @@
 
 #include "leveldb/iterator.h"
 
+#include <new>
+#include <string.h>
+#include "table/iterator_wrapper.h"
+#include "util/arena.h"
+
 namespace leveldb {
 
 Iterator::Iterator() {
@@ -38,6 +43,37 @@ void Iterator::RegisterCleanup(CleanupFunction func, void* arg1, void* arg2) {
   c->arg2 = arg2;
 }
 
+Status Iterator::Refresh() {
+  return Status::NotSupported("Refresh() not supported by this iterator");
+}
+
+bool Iterator::IsKeyPinned() const {
+  return false;
+}
+
+size_t Iterator::NextBatch(size_t max_entries, char* buf, size_t buf_size,
+                           size_t* key_sizes, size_t* value_sizes,
+                           size_t* bytes_used) {
+  size_t n = 0;
+  size_t used = 0;
+  while (n < max_entries && Valid()) {
+    const Slice k = key();
+    const Slice v = value();
+    if (k.size() + v.size() > buf_size - used) {
+      break;
+    }
+    memcpy(buf + used, k.data(), k.size());
+    memcpy(buf + used + k.size(), v.data(), v.size());
+    used += k.size() + v.size();
+    key_sizes[n] = k.size();
+    value_sizes[n] = v.size();
+    n++;
+    Next();
+  }
+  *bytes_used = used;
+  return n;
+}
+
 namespace {
 class EmptyIterator : public Iterator {
  public:
@@ -64,4 +100,16 @@ Iterator* NewErrorIterator(const Status& status) {
   return new EmptyIterator(status);
 }
 
+Iterator* NewEmptyIterator(Arena* arena) {
+  return NewErrorIterator(Status::OK(), arena);
+}
+
+Iterator* NewErrorIterator(const Status& status, Arena* arena) {
+  if (arena == NULL) {
+    return new EmptyIterator(status);
+  }
+  void* mem = arena->AllocateAligned(sizeof(EmptyIterator));
+  return new (mem) EmptyIterator(status);
+}
+
 }  // namespace leveldb
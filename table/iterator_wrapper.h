@@ -10,23 +10,25 @@
 
 namespace leveldb {
 
+class Arena;
+
 // A internal wrapper class with an interface similar to Iterator that
 // caches the valid() and key() results for an underlying iterator.
 // This can help avoid virtual function calls and also gives better
 // cache locality.
 class IteratorWrapper {
  public:
-  IteratorWrapper(): iter_(NULL), valid_(false) { }
-  explicit IteratorWrapper(Iterator* iter): iter_(NULL) {
+  IteratorWrapper(): iter_(NULL), valid_(false), arena_mode_(false) { }
+  explicit IteratorWrapper(Iterator* iter): iter_(NULL), arena_mode_(false) {
     Set(iter);
   }
-  ~IteratorWrapper() { delete iter_; }
+  ~IteratorWrapper() { DestroyIter(); }
   Iterator* iter() const { return iter_; }
 
   // Takes ownership of "iter" and will delete it when destroyed, or
   // when Set() is invoked again.
   void Set(Iterator* iter) {
-    delete iter_;
+    DestroyIter();
     iter_ = iter;
     if (iter_ == NULL) {
       valid_ = false;
@@ -40,6 +42,7 @@ class IteratorWrapper {
   bool Valid() const        { return valid_; }
   Slice key() const         { assert(Valid()); return key_; }
   Slice value() const       { assert(Valid()); return iter_->value(); }
+  bool IsKeyPinned() const  { assert(Valid()); return iter_->IsKeyPinned(); }
   // Methods below require iter() != NULL
   Status status() const     { assert(iter_); return iter_->status(); }
   void Next()               { assert(iter_); iter_->Next();        Update(); }
@@ -48,7 +51,28 @@ class IteratorWrapper {
   void SeekToFirst()        { assert(iter_); iter_->SeekToFirst(); Update(); }
   void SeekToLast()         { assert(iter_); iter_->SeekToLast();  Update(); }
 
+  // Give up ownership of the iterator and return it.
+  Iterator* Release() {
+    Iterator* result = iter_;
+    iter_ = NULL;
+    valid_ = false;
+    return result;
+  }
+
+  // If "arena_mode" is true, iterators handed to Set() were placed in an
+  // Arena: they are destroyed but their memory is left to the arena.
+  void SetArenaMode(bool arena_mode) { arena_mode_ = arena_mode; }
+
  private:
+  void DestroyIter() {
+    if (arena_mode_) {
+      if (iter_ != NULL) iter_->~Iterator();
+    } else {
+      delete iter_;
+    }
+  }
+
+
   void Update() {
     valid_ = iter_->Valid();
     if (valid_) {
@@ -58,9 +82,16 @@ class IteratorWrapper {
 
   Iterator* iter_;
   bool valid_;
+  bool arena_mode_;
   Slice key_;
 };
 
+// Like NewEmptyIterator() and NewErrorIterator(), but if "arena" is
+// non-NULL the result is placed in *arena and must be released with
+// iter->~Iterator() instead of delete.
+extern Iterator* NewEmptyIterator(Arena* arena);
+extern Iterator* NewErrorIterator(const Status& status, Arena* arena);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_TABLE_ITERATOR_WRAPPER_H_
@@ -4,9 +4,11 @@
 
 #include "table/merger.h"
 
+#include <new>
 #include "leveldb/comparator.h"
 #include "leveldb/iterator.h"
 #include "table/iterator_wrapper.h"
+#include "util/arena.h"
 
 namespace leveldb {
 
@@ -15,19 +17,36 @@ namespace {
 // 以及指向Level0层各个sst文件的迭代器(table/block.cc)
 class MergingIterator : public Iterator {
  public:
-  MergingIterator(const Comparator* comparator, Iterator** children, int n)
+  MergingIterator(const Comparator* comparator, Iterator** children, int n,
+                  Arena* arena)
       : comparator_(comparator),
-        children_(new IteratorWrapper[n]),
+        arena_mode_(arena != NULL),
         n_(n),
         current_(NULL),
         direction_(kForward) {
+    if (arena_mode_) {
+      void* mem = arena->AllocateAligned(sizeof(IteratorWrapper) * n);
+      children_ = reinterpret_cast<IteratorWrapper*>(mem);
+      for (int i = 0; i < n; i++) {
+        new (&children_[i]) IteratorWrapper;
+        children_[i].SetArenaMode(true);
+      }
+    } else {
+      children_ = new IteratorWrapper[n];
+    }
     for (int i = 0; i < n; i++) {
       children_[i].Set(children[i]);
     }
   }
 
   virtual ~MergingIterator() {
-    delete[] children_;
+    if (arena_mode_) {
+      for (int i = 0; i < n_; i++) {
+        children_[i].~IteratorWrapper();
+      }
+    } else {
+      delete[] children_;
+    }
   }
 
   virtual bool Valid() const {
@@ -127,6 +146,11 @@ class MergingIterator : public Iterator {
     return current_->value();
   }
 
+  virtual bool IsKeyPinned() const {
+    assert(Valid());
+    return current_->IsKeyPinned();
+  }
+
   virtual Status status() const {
     Status status;
     for (int i = 0; i < n_; i++) {
@@ -146,6 +170,7 @@ class MergingIterator : public Iterator {
   // For now we use a simple array since we expect a very small number
   // of children in leveldb.
   const Comparator* comparator_;
+  const bool arena_mode_;       // children_ and the children live in an Arena
   IteratorWrapper* children_;
   int n_;
   IteratorWrapper* current_;
@@ -195,14 +220,18 @@ void MergingIterator::FindLargest() {
 // 如果当前传入的Iterator集合大小为1，则直接返回Memtable生成的那个Iterator
 // 如果当前传入的Iterator集合大小大于1，则将这些Iterator进行包装，返回一个
 // MerginIterator;
-Iterator* NewMergingIterator(const Comparator* cmp, Iterator** list, int n) {
+Iterator* NewMergingIterator(const Comparator* cmp, Iterator** list, int n,
+                             Arena* arena) {
   assert(n >= 0);
   if (n == 0) {
-    return NewEmptyIterator();
+    return NewEmptyIterator(arena);
   } else if (n == 1) {
     return list[0];
+  } else if (arena != NULL) {
+    void* mem = arena->AllocateAligned(sizeof(MergingIterator));
+    return new (mem) MergingIterator(cmp, list, n, arena);
   } else {
-    return new MergingIterator(cmp, list, n);
+    return new MergingIterator(cmp, list, n, NULL);
   }
 }
 
@@ -5,8 +5,11 @@
 #ifndef STORAGE_LEVELDB_TABLE_MERGER_H_
 #define STORAGE_LEVELDB_TABLE_MERGER_H_
 
+#include <stddef.h>
+
 namespace leveldb {
 
+class Arena;
 class Comparator;
 class Iterator;
 
@@ -17,9 +20,14 @@ class Iterator;
 // The result does no duplicate suppression.  I.e., if a particular
 // key is present in K child iterators, it will be yielded K times.
 //
+// If "arena" is non-NULL, the children must have been placed in *arena
+// too; the result is placed there and must be released with
+// iter->~Iterator() instead of delete.
+//
 // REQUIRES: n >= 0
 extern Iterator* NewMergingIterator(
-    const Comparator* comparator, Iterator** children, int n);
+    const Comparator* comparator, Iterator** children, int n,
+    Arena* arena = NULL);
 
 }  // namespace leveldb
 
@@ -0,0 +1,609 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/plain_table.h"
+
+#include <assert.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include "leveldb/comparator.h"
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "leveldb/options.h"
+#include "leveldb/table_factory.h"
+#include "table/format.h"
+#include "table/table_reader.h"
+#include "table/table_writer.h"
+#include "util/arena.h"
+#include "util/coding.h"
+#include "util/hash.h"
+
+namespace leveldb {
+
+namespace {
+
+static const uint32_t kHashSeed = 0x9ae16a3b;
+
+// Offsets are stored as fixed32, and slots hold offsets plus one
+static const uint64_t kMaxDataSize = 0xffffffffu - 1;
+
+// Size of the fixed fields at the start of the footer
+static const size_t kFooterFieldsSize = 8 + 3 * 4;
+
+// Only tables of internal keys get a hash index, since their user keys
+// can be looked up exactly.  The comparator is recognized by name, as
+// table/ does not depend on db/.
+static bool IsInternalKeyComparator(const Comparator* cmp) {
+  return strcmp(cmp->Name(), "leveldb.InternalKeyComparator") == 0;
+}
+
+// The user key part of an internal key
+static Slice UserKey(const Slice& internal_key) {
+  return Slice(internal_key.data(), internal_key.size() - 8);
+}
+
+class PlainTableWriter : public TableWriter {
+ public:
+  PlainTableWriter(const Options& options, WritableFile* file,
+                   int index_interval)
+      : file_(file),
+        index_interval_(index_interval),
+        hash_user_keys_(IsInternalKeyComparator(options.comparator)),
+        offset_(0),
+        num_entries_(0) {
+  }
+
+  virtual void Add(const Slice& key, const Slice& value);
+  virtual Status status() const { return status_; }
+  virtual Status Finish();
+  virtual uint64_t NumEntries() const { return num_entries_; }
+  virtual uint64_t FileSize() const { return offset_; }
+
+ private:
+  WritableFile* const file_;
+  const int index_interval_;
+  const bool hash_user_keys_;
+  Status status_;
+  uint64_t offset_;
+  uint64_t num_entries_;
+  std::string entry_;       // Encoding of the entry being added
+  std::string samples_;     // Encoded offsets of the sampled entries
+  std::string last_user_key_;
+
+  // Hash of each distinct user key and the offset of its first entry
+  std::vector<std::pair<uint32_t, uint32_t> > user_keys_;
+};
+
+void PlainTableWriter::Add(const Slice& key, const Slice& value) {
+  if (!status_.ok()) return;
+  entry_.clear();
+  PutVarint32(&entry_, key.size());
+  entry_.append(key.data(), key.size());
+  PutVarint32(&entry_, value.size());
+  if (offset_ + entry_.size() + value.size() > kMaxDataSize) {
+    status_ = Status::NotSupported("plain table larger than 4GB");
+    return;
+  }
+
+  const uint32_t offset = static_cast<uint32_t>(offset_);
+  if (num_entries_ % index_interval_ == 0) {
+    PutFixed32(&samples_, offset);
+  }
+  if (hash_user_keys_ && key.size() >= 8) {
+    const Slice user_key = UserKey(key);
+    if (user_keys_.empty() || user_key != Slice(last_user_key_)) {
+      user_keys_.push_back(std::make_pair(
+          Hash(user_key.data(), user_key.size(), kHashSeed), offset));
+      last_user_key_.assign(user_key.data(), user_key.size());
+    }
+  }
+
+  status_ = file_->Append(entry_);
+  if (status_.ok()) {
+    status_ = file_->Append(value);
+  }
+  if (status_.ok()) {
+    offset_ += entry_.size() + value.size();
+    num_entries_++;
+  }
+}
+
+Status PlainTableWriter::Finish() {
+  if (!status_.ok()) return status_;
+
+  // Size the hash index for a load factor of at most 3/4
+  const size_t n = user_keys_.size();
+  uint32_t num_slots = 0;
+  if (n > 0) {
+    num_slots = 1;
+    while (num_slots < n + n / 3 + 1) {
+      num_slots *= 2;
+    }
+  }
+  std::vector<uint32_t> slots(num_slots, 0);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t s = user_keys_[i].first & (num_slots - 1);
+    while (slots[s] != 0) {
+      s = (s + 1) & (num_slots - 1);
+    }
+    slots[s] = user_keys_[i].second + 1;
+  }
+
+  std::string tail = samples_;
+  for (uint32_t i = 0; i < num_slots; i++) {
+    PutFixed32(&tail, slots[i]);
+  }
+  PutFixed64(&tail, offset_);
+  PutFixed32(&tail, static_cast<uint32_t>(samples_.size() / 4));
+  PutFixed32(&tail, num_slots);
+  PutFixed32(&tail, static_cast<uint32_t>(index_interval_));
+  tail.append(Footer::kEncodedLength - 8 - kFooterFieldsSize, '\0');
+  PutFixed64(&tail, kPlainTableMagicNumber);
+
+  status_ = file_->Append(tail);
+  if (status_.ok()) {
+    offset_ += tail.size();
+  }
+  return status_;
+}
+
+class PlainTableFactory : public TableFactory {
+ public:
+  explicit PlainTableFactory(int index_interval)
+      : index_interval_(index_interval < 1 ? 1 : index_interval) {
+  }
+
+  virtual const char* Name() const { return "leveldb.PlainTable"; }
+
+ private:
+  virtual TableWriter* NewTableWriter(const Options& options,
+                                      WritableFile* file) const {
+    return new PlainTableWriter(options, file, index_interval_);
+  }
+
+  const int index_interval_;
+};
+
+class PlainTableReader : public TableReader {
+ public:
+  PlainTableReader(const Options& options, const char* data,
+                   char* owned, const Slice& footer);
+  virtual ~PlainTableReader() { delete[] owned_; }
+
+  // Check the entries that the indexes do not cover
+  Status Init();
+
+  virtual Iterator* NewIterator(const ReadOptions& options,
+                                Arena* arena) const;
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     bool* found, Slice* found_key,
+                     Slice* found_value) const;
+  virtual Iterator* NewIndexIterator() const;
+  virtual uint64_t ApproximateOffsetOf(const Slice& key) const;
+
+ private:
+  friend class PlainTableIterator;
+  friend class PlainTableIndexIterator;
+
+  uint64_t SampleOffset(uint32_t i) const {
+    return DecodeFixed32(samples_ + 4 * i);
+  }
+
+  // Decode the entry at "offset" and set *next to the offset of the
+  // entry after it.  Returns false if the entry is corrupt.
+  bool EntryAt(uint64_t offset, Slice* key, Slice* value,
+               uint64_t* next) const;
+
+  // Set *offset to the offset of the first entry at or after target, or
+  // to data_size_ if there is none.
+  Status Seek(const Slice& target, uint64_t* offset) const;
+
+  const Comparator* const comparator_;
+  const char* const data_;      // The table, starting with the entries
+  char* const owned_;           // Copy of the table if the file is not
+                                // in memory, else NULL
+  uint64_t data_size_;
+  const char* samples_;
+  uint32_t num_samples_;
+  const char* slots_;
+  uint32_t num_slots_;
+  Slice last_key_;              // Key of the last entry
+};
+
+PlainTableReader::PlainTableReader(const Options& options, const char* data,
+                                   char* owned, const Slice& footer)
+    : comparator_(options.comparator),
+      data_(data),
+      owned_(owned) {
+  data_size_ = DecodeFixed64(footer.data());
+  num_samples_ = DecodeFixed32(footer.data() + 8);
+  num_slots_ = DecodeFixed32(footer.data() + 12);
+  samples_ = data_ + data_size_;
+  slots_ = samples_ + 4 * static_cast<uint64_t>(num_samples_);
+}
+
+Status PlainTableReader::Init() {
+  if (data_size_ == 0) {
+    return Status::OK();
+  }
+  if (num_samples_ == 0 || SampleOffset(0) != 0) {
+    return Status::Corruption("bad plain table index");
+  }
+  uint64_t offset = SampleOffset(num_samples_ - 1);
+  if (offset >= data_size_) {
+    return Status::Corruption("bad plain table index");
+  }
+  Slice key, value;
+  uint64_t next;
+  while (true) {
+    if (!EntryAt(offset, &key, &value, &next)) {
+      return Status::Corruption("bad entry in plain table");
+    }
+    if (next == data_size_) break;
+    offset = next;
+  }
+  last_key_ = key;
+  return Status::OK();
+}
+
+bool PlainTableReader::EntryAt(uint64_t offset, Slice* key, Slice* value,
+                               uint64_t* next) const {
+  if (offset >= data_size_) {
+    return false;
+  }
+  const char* p = DecodePlainTableEntry(data_ + offset, data_ + data_size_,
+                                        key, value);
+  if (p == NULL) {
+    return false;
+  }
+  *next = p - data_;
+  return true;
+}
+
+Status PlainTableReader::Seek(const Slice& target, uint64_t* offset) const {
+  // Binary search for the first sampled entry at or after target, then
+  // scan forward from the sample before it
+  Slice key, value;
+  uint64_t next;
+  uint32_t left = 0;
+  uint32_t right = num_samples_;
+  while (left < right) {
+    const uint32_t mid = left + (right - left) / 2;
+    if (!EntryAt(SampleOffset(mid), &key, &value, &next)) {
+      return Status::Corruption("bad entry in plain table");
+    }
+    if (comparator_->Compare(key, target) < 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  uint64_t result = (left == 0) ? 0 : SampleOffset(left - 1);
+  while (result < data_size_) {
+    if (!EntryAt(result, &key, &value, &next)) {
+      return Status::Corruption("bad entry in plain table");
+    }
+    if (comparator_->Compare(key, target) >= 0) break;
+    result = next;
+  }
+  *offset = result;
+  return Status::OK();
+}
+
+Status PlainTableReader::Get(const ReadOptions& options, const Slice& k,
+                             bool* found, Slice* found_key,
+                             Slice* found_value) const {
+  *found = false;
+  Slice key, value;
+  uint64_t next;
+  if (num_slots_ > 0 && k.size() >= 8) {
+    const Slice user_key = UserKey(k);
+    const uint32_t mask = num_slots_ - 1;
+    uint32_t s = Hash(user_key.data(), user_key.size(), kHashSeed) & mask;
+    for (uint32_t probes = 0; probes < num_slots_; probes++) {
+      const uint32_t slot = DecodeFixed32(slots_ + 4 * s);
+      if (slot == 0 || slot > data_size_) {
+        return (slot == 0) ? Status::OK()
+                           : Status::Corruption("bad plain table slot");
+      }
+      uint64_t offset = slot - 1;
+      if (!EntryAt(offset, &key, &value, &next) || key.size() < 8) {
+        return Status::Corruption("bad entry in plain table");
+      }
+      if (UserKey(key) == user_key) {
+        // Newer entries of a user key come first; skip those that are
+        // newer than k
+        while (comparator_->Compare(key, k) < 0) {
+          offset = next;
+          if (offset >= data_size_) return Status::OK();
+          if (!EntryAt(offset, &key, &value, &next) || key.size() < 8) {
+            return Status::Corruption("bad entry in plain table");
+          }
+          if (UserKey(key) != user_key) return Status::OK();
+        }
+        *found = true;
+        *found_key = key;
+        *found_value = value;
+        return Status::OK();
+      }
+      s = (s + 1) & mask;
+    }
+    return Status::OK();
+  }
+
+  uint64_t offset;
+  Status s = Seek(k, &offset);
+  if (s.ok() && offset < data_size_) {
+    EntryAt(offset, found_key, found_value, &next);
+    *found = true;
+  }
+  return s;
+}
+
+uint64_t PlainTableReader::ApproximateOffsetOf(const Slice& key) const {
+  uint64_t offset;
+  if (!Seek(key, &offset).ok()) {
+    // Give the end of the entries, as a block-based table would
+    offset = data_size_;
+  }
+  return offset;
+}
+
+class PlainTableIterator : public Iterator {
+ public:
+  explicit PlainTableIterator(const PlainTableReader* table)
+      : table_(table),
+        offset_(table->data_size_),
+        next_(table->data_size_) {
+  }
+
+  virtual bool Valid() const { return offset_ < table_->data_size_; }
+  virtual void SeekToFirst() { ParseEntryAt(0); }
+
+  virtual void SeekToLast() {
+    if (table_->data_size_ == 0) return;
+    // Scan the entries after the last sample
+    ParseEntryAt(table_->SampleOffset(table_->num_samples_ - 1));
+    while (Valid() && next_ < table_->data_size_) {
+      ParseEntryAt(next_);
+    }
+  }
+
+  virtual void Seek(const Slice& target) {
+    uint64_t offset;
+    status_ = table_->Seek(target, &offset);
+    ParseEntryAt(status_.ok() ? offset : table_->data_size_);
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    ParseEntryAt(next_);
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    // Scan forward from the last sample before the current entry
+    const uint64_t target = offset_;
+    uint32_t left = 0;
+    uint32_t right = table_->num_samples_;
+    while (left < right) {
+      const uint32_t mid = left + (right - left) / 2;
+      if (table_->SampleOffset(mid) < target) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    if (left == 0) {
+      offset_ = table_->data_size_;   // Before the first entry
+      return;
+    }
+    ParseEntryAt(table_->SampleOffset(left - 1));
+    while (Valid() && next_ < target) {
+      ParseEntryAt(next_);
+    }
+  }
+
+  virtual Slice key() const {
+    assert(Valid());
+    return key_;
+  }
+
+  virtual Slice value() const {
+    assert(Valid());
+    return value_;
+  }
+
+  virtual Status status() const { return status_; }
+
+  // Keys point into the table, which outlives the iterator
+  virtual bool IsKeyPinned() const { return true; }
+
+ private:
+  void ParseEntryAt(uint64_t offset) {
+    offset_ = offset;
+    if (offset_ < table_->data_size_ &&
+        !table_->EntryAt(offset_, &key_, &value_, &next_)) {
+      status_ = Status::Corruption("bad entry in plain table");
+      offset_ = table_->data_size_;
+    }
+  }
+
+  const PlainTableReader* const table_;
+  uint64_t offset_;     // Offset of the current entry; data_size_ if invalid
+  uint64_t next_;       // Offset of the entry after the current one
+  Slice key_;
+  Slice value_;
+  Status status_;
+};
+
+// Iterates over the ranges of entries between samples.  The key of each
+// range is the first key of the next range, or the last key of the
+// table for the last range, so that it is at or after every key in the
+// range, like a key of the index block of a block-based table.
+class PlainTableIndexIterator : public Iterator {
+ public:
+  explicit PlainTableIndexIterator(const PlainTableReader* table)
+      : table_(table),
+        index_(table->num_samples_) {
+  }
+
+  virtual bool Valid() const { return index_ < table_->num_samples_; }
+  virtual void SeekToFirst() { SetIndex(0); }
+  virtual void SeekToLast() { SetIndex(table_->num_samples_ - 1); }
+
+  virtual void Seek(const Slice& target) {
+    const uint32_t n = table_->num_samples_;
+    if (n == 0) return;
+    // Keys are in order, and the last one is the last key of the table
+    uint32_t left = 0;
+    uint32_t right = n - 1;
+    while (left < right) {
+      const uint32_t mid = left + (right - left) / 2;
+      SetIndex(mid);
+      if (!Valid()) return;
+      if (table_->comparator_->Compare(key_, target) < 0) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    SetIndex(left);
+    if (Valid() && table_->comparator_->Compare(key_, target) < 0) {
+      index_ = n;
+    }
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    SetIndex(index_ + 1);
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    SetIndex(index_ - 1);   // Wraps around to invalid at the start
+  }
+
+  virtual Slice key() const {
+    assert(Valid());
+    return key_;
+  }
+
+  virtual Slice value() const {
+    assert(Valid());
+    return handle_encoding_;
+  }
+
+  virtual Status status() const { return status_; }
+
+ private:
+  void SetIndex(uint32_t index) {
+    index_ = index;
+    if (!Valid()) return;
+    const uint64_t start = table_->SampleOffset(index_);
+    uint64_t limit;
+    if (index_ + 1 < table_->num_samples_) {
+      limit = table_->SampleOffset(index_ + 1);
+      Slice value;
+      uint64_t next;
+      if (limit >= table_->data_size_ ||
+          !table_->EntryAt(limit, &key_, &value, &next)) {
+        status_ = Status::Corruption("bad entry in plain table");
+        index_ = table_->num_samples_;
+        return;
+      }
+    } else {
+      limit = table_->data_size_;
+      key_ = table_->last_key_;
+    }
+    BlockHandle handle;
+    handle.set_offset(start);
+    handle.set_size(limit - start);
+    handle_encoding_.clear();
+    handle.EncodeTo(&handle_encoding_);
+  }
+
+  const PlainTableReader* const table_;
+  uint32_t index_;
+  Slice key_;
+  std::string handle_encoding_;
+  Status status_;
+};
+
+Iterator* PlainTableReader::NewIterator(const ReadOptions& options,
+                                        Arena* arena) const {
+  if (arena != NULL) {
+    void* mem = arena->AllocateAligned(sizeof(PlainTableIterator));
+    return new (mem) PlainTableIterator(this);
+  }
+  return new PlainTableIterator(this);
+}
+
+Iterator* PlainTableReader::NewIndexIterator() const {
+  return new PlainTableIndexIterator(this);
+}
+
+}  // namespace
+
+const char* DecodePlainTableEntry(const char* p, const char* limit,
+                                  Slice* key, Slice* value) {
+  uint32_t key_length, value_length;
+  if ((p = GetVarint32Ptr(p, limit, &key_length)) == NULL ||
+      static_cast<uint64_t>(limit - p) < key_length) {
+    return NULL;
+  }
+  *key = Slice(p, key_length);
+  p += key_length;
+  if ((p = GetVarint32Ptr(p, limit, &value_length)) == NULL ||
+      static_cast<uint64_t>(limit - p) < value_length) {
+    return NULL;
+  }
+  *value = Slice(p, value_length);
+  return p + value_length;
+}
+
+Status NewPlainTableReader(const Options& options,
+                           RandomAccessFile* file,
+                           uint64_t file_size,
+                           const Slice& footer,
+                           bool file_in_memory,
+                           TableReader** reader) {
+  *reader = NULL;
+  assert(footer.size() == Footer::kEncodedLength);
+  const uint64_t data_size = DecodeFixed64(footer.data());
+  const uint64_t num_samples = DecodeFixed32(footer.data() + 8);
+  const uint64_t num_slots = DecodeFixed32(footer.data() + 12);
+  const uint64_t size = file_size - Footer::kEncodedLength;
+  if (data_size > kMaxDataSize ||
+      data_size + 4 * (num_samples + num_slots) != size ||
+      (num_slots & (num_slots - 1)) != 0) {
+    return Status::Corruption("bad plain table footer");
+  }
+
+  char* owned;
+  Slice contents;
+  Status s = ReadFileContents(file, size, file_in_memory, &contents, &owned);
+  if (!s.ok()) {
+    return s;
+  }
+
+  PlainTableReader* r = new PlainTableReader(options, contents.data(), owned,
+                                             footer);
+  s = r->Init();
+  if (s.ok()) {
+    *reader = r;
+  } else {
+    delete r;
+  }
+  return s;
+}
+
+TableFactory* NewPlainTableFactory(int index_interval) {
+  return new PlainTableFactory(index_interval);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,62 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Plain tables are written by the factory returned by
+// NewPlainTableFactory().  A plain table file holds:
+//
+//    entries:  varint32 key length, key, varint32 value length, value
+//              for every entry, in key order
+//    samples:  fixed32 offset of every index_interval-th entry,
+//              starting with the first
+//    slots:    hash index of num_slots fixed32 slots (may be empty)
+//    footer:   fixed64 size of the entries
+//              fixed32 num_samples
+//              fixed32 num_slots
+//              fixed32 index_interval
+//              zero padding to 40 bytes
+//              fixed64 kPlainTableMagicNumber
+//
+// The footer is as long as that of block-based tables, so that
+// Table::Open() can tell the formats apart by the magic number.
+//
+// The hash index is only written for tables of internal keys (i.e.
+// those written by a DB).  It maps the user key of each such key to the
+// offset of its newest entry plus one, with linear probing from
+// Hash(user key) modulo num_slots, which is a power of two.  Zero marks
+// an empty slot, and at most three quarters of the slots are used.
+
+#ifndef STORAGE_LEVELDB_TABLE_PLAIN_TABLE_H_
+#define STORAGE_LEVELDB_TABLE_PLAIN_TABLE_H_
+
+#include <stdint.h>
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+struct Options;
+class RandomAccessFile;
+class Slice;
+class TableReader;
+
+// Decode the entry of a plain table that starts at p, where p < limit.
+// Sets *key and *value to point into the entry and returns the start of
+// the next entry, or returns NULL if the entry runs past limit.
+extern const char* DecodePlainTableEntry(const char* p, const char* limit,
+                                         Slice* key, Slice* value);
+
+// Create a reader for the plain table stored in bytes [0..file_size) of
+// "file", whose last Footer::kEncodedLength bytes are "footer".  If
+// "file_in_memory", file->Read() returns memory that stays valid, which
+// the reader uses in place; otherwise the table is copied into memory.
+// On success stores the reader in *reader.
+extern Status NewPlainTableReader(const Options& options,
+                                  RandomAccessFile* file,
+                                  uint64_t file_size,
+                                  const Slice& footer,
+                                  bool file_in_memory,
+                                  TableReader** reader);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_PLAIN_TABLE_H_
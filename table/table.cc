@@ -10,29 +10,42 @@
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
 #include "table/block.h"
+#include "table/cuckoo_table.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/plain_table.h"
+#include "table/table_reader.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 
 namespace leveldb {
 
+TableReader::~TableReader() {
+}
+
 struct Table::Rep {
   ~Rep() {
+    delete reader;
     delete filter;
-    delete [] filter_data;
+    if (filter_data != NULL) {
+      DeleteBlockData(options.memory_allocator, filter_data);
+    }
     delete index_block;
   }
 
   Options options;
   Status status;
   RandomAccessFile* file;
+  bool file_in_memory;  // file->Read() needs no I/O (e.g. it is mmapped)
   uint64_t cache_id;
   FilterBlockReader* filter;
   const char* filter_data;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+
+  // Reads the table if it is not in the block-based format, else NULL
+  TableReader* reader;
 };
 
 Status Table::Open(const Options& options,
@@ -49,6 +62,36 @@ Status Table::Open(const Options& options,
   Status s = file->Read(size - Footer::kEncodedLength, Footer::kEncodedLength,
                         &footer_input, footer_space);
   if (!s.ok()) return s;
+  // A file that returns its own memory instead of filling the scratch
+  // buffer has its contents mapped into memory
+  const bool file_in_memory = (footer_input.data() != footer_space);
+
+  // Other formats are recognized by the magic number at the end
+  const uint64_t magic =
+      DecodeFixed64(footer_input.data() + Footer::kEncodedLength - 8);
+  if (magic == kPlainTableMagicNumber || magic == kCuckooTableMagicNumber) {
+    TableReader* reader;
+    if (magic == kPlainTableMagicNumber) {
+      s = NewPlainTableReader(options, file, size, footer_input,
+                              file_in_memory, &reader);
+    } else {
+      s = NewCuckooTableReader(options, file, size, footer_input,
+                               file_in_memory, &reader);
+    }
+    if (s.ok()) {
+      Rep* rep = new Table::Rep;
+      rep->options = options;
+      rep->file = file;
+      rep->file_in_memory = true;
+      rep->index_block = NULL;
+      rep->cache_id = 0;
+      rep->filter_data = NULL;
+      rep->filter = NULL;
+      rep->reader = reader;
+      *table = new Table(rep);
+    }
+    return s;
+  }
 
   Footer footer;
   // 从文件末尾获取MetaIndex Block和Index Block的相关信息
@@ -65,7 +108,8 @@ Status Table::Open(const Options& options,
     if (options.paranoid_checks) {
       opt.verify_checksums = true;
     }
-    s = ReadBlock(file, opt, footer.index_handle(), &index_block_contents);
+    s = ReadBlock(file, opt, footer.index_handle(), options.memory_allocator,
+                  file_in_memory, &index_block_contents);
   }
 
   if (s.ok()) {
@@ -75,11 +119,13 @@ Status Table::Open(const Options& options,
     Rep* rep = new Table::Rep;
     rep->options = options;
     rep->file = file;
+    rep->file_in_memory = file_in_memory;
     rep->metaindex_handle = footer.metaindex_handle();
     rep->index_block = index_block;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = NULL;
     rep->filter = NULL;
+    rep->reader = NULL;
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   }
@@ -99,7 +145,9 @@ void Table::ReadMeta(const Footer& footer) {
     opt.verify_checksums = true;
   }
   BlockContents contents;
-  if (!ReadBlock(rep_->file, opt, footer.metaindex_handle(), &contents).ok()) {
+  if (!ReadBlock(rep_->file, opt, footer.metaindex_handle(),
+                 rep_->options.memory_allocator, ReadIntoScratch(),
+                 &contents).ok()) {
     // Do not propagate errors since meta info is not needed for operation
     return;
   }
@@ -130,7 +178,10 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
     opt.verify_checksums = true;
   }
   BlockContents block;
-  if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
+  // Filter blocks are never compressed
+  if (!ReadBlock(rep_->file, opt, filter_handle,
+                 rep_->options.memory_allocator, rep_->file_in_memory,
+                 &block).ok()) {
     return;
   }
   if (block.heap_allocated) {
@@ -143,6 +194,15 @@ Table::~Table() {
   delete rep_;
 }
 
+// Only a file in memory makes the block's own memory unnecessary.  The
+// options do not tell whether a block is compressed: the default asks for
+// snappy even where it is not compiled in, and poorly compressible blocks
+// are stored as they are.  So blocks of other files are read into the
+// block's memory, and a compressed one is decompressed out of it.
+bool Table::ReadIntoScratch() const {
+  return rep_->file_in_memory;
+}
+
 static void DeleteBlock(void* arg, void* ignored) {
   delete reinterpret_cast<Block*>(arg);
 }
@@ -158,6 +218,13 @@ static void ReleaseBlock(void* arg, void* h) {
   cache->Release(handle);
 }
 
+// True if options.deadline has passed
+static bool DeadlinePassed(const Options& table_options,
+                           const ReadOptions& options) {
+  return options.deadline != 0 &&
+         table_options.env->NowMicros() >= options.deadline;
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
@@ -187,8 +254,15 @@ Iterator* Table::BlockReader(void* arg,
       cache_handle = block_cache->Lookup(key);
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
+      } else if (options.read_tier == kBlockCacheTier &&
+                 !table->rep_->file_in_memory) {
+        s = Status::Incomplete("data block not in block cache");
+      } else if (DeadlinePassed(table->rep_->options, options)) {
+        s = Status::TimedOut("deadline passed before block read");
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        s = ReadBlock(table->rep_->file, options, handle,
+                      table->rep_->options.memory_allocator,
+                      table->ReadIntoScratch(), &contents);
         if (s.ok()) {
           block = new Block(contents);
           // 如果当前contents的空间是在堆上分配的, 并且options.fill_cache为
@@ -196,12 +270,19 @@ Iterator* Table::BlockReader(void* arg,
           // fill_cache的值设置成false, 在不需要的时候尽量减少内存的使用)
           if (contents.cachable && options.fill_cache) {
             cache_handle = block_cache->Insert(
-                key, block, block->size(), &DeleteCachedBlock);
+                key, block, block->charge(), &DeleteCachedBlock);
           }
         }
       }
+    } else if (options.read_tier == kBlockCacheTier &&
+               !table->rep_->file_in_memory) {
+      s = Status::Incomplete("no block cache");
+    } else if (DeadlinePassed(table->rep_->options, options)) {
+      s = Status::TimedOut("deadline passed before block read");
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      s = ReadBlock(table->rep_->file, options, handle,
+                    table->rep_->options.memory_allocator,
+                    table->ReadIntoScratch(), &contents);
       if (s.ok()) {
         block = new Block(contents);
       }
@@ -227,30 +308,160 @@ Iterator* Table::BlockReader(void* arg,
 }
 
 Iterator* Table::NewIterator(const ReadOptions& options) const {
+  return NewIterator(options, NULL);
+}
+
+Iterator* Table::NewIterator(const ReadOptions& options, Arena* arena) const {
+  if (rep_->reader != NULL) {
+    return rep_->reader->NewIterator(options, arena);
+  }
   return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+      rep_->index_block->NewIterator(rep_->options.comparator, arena),
+      &Table::BlockReader, const_cast<Table*>(this), options, arena);
+}
+
+Iterator* Table::NewIndexIterator() const {
+  if (rep_->reader != NULL) {
+    return rep_->reader->NewIndexIterator();
+  }
+  return rep_->index_block->NewIterator(rep_->options.comparator);
+}
+
+// Returns the bytes [offset, offset+length) of value, clipped to its end
+static Slice ValueRange(const Slice& value, uint64_t offset, uint64_t length) {
+  if (offset >= value.size()) {
+    return Slice();
+  }
+  const uint64_t avail = value.size() - offset;
+  return Slice(value.data() + offset, (length < avail) ? length : avail);
+}
+
+// Bytes read to find the entry header and key of a large value block
+// beyond the length of the key being looked up: the three varint32s of
+// the header take at most 15 bytes.
+static const size_t kLargeValueHeaderSlop = 16;
+
+bool Table::GetFromLargeValueBlock(
+    const ReadOptions& options, const BlockHandle& handle, const Slice& k,
+    uint64_t offset, uint64_t length, Status* s,
+    void* arg,
+    void (*saver)(void*, const Slice&, const Slice&)) {
+  // Checksums cover the whole block, and only a full read can be cached
+  if (options.verify_checksums || options.read_tier == kBlockCacheTier ||
+      DeadlinePassed(rep_->options, options)) {
+    return false;
+  }
+  // A block of less than two pages costs no more to read in full
+  const uint64_t block_size = handle.size();
+  if (block_size < 8192 || block_size <= k.size() + kLargeValueHeaderSlop) {
+    return false;
+  }
+  if (rep_->options.block_cache != NULL) {
+    char cache_key_buffer[16];
+    EncodeFixed64(cache_key_buffer, rep_->cache_id);
+    EncodeFixed64(cache_key_buffer+8, handle.offset());
+    Cache::Handle* h = rep_->options.block_cache->Lookup(
+        Slice(cache_key_buffer, sizeof(cache_key_buffer)));
+    if (h != NULL) {
+      rep_->options.block_cache->Release(h);
+      return false;
+    }
+  }
+
+  // The type byte of the block trailer tells whether it is compressed
+  char type_buf[1];
+  Slice type;
+  *s = rep_->file->Read(handle.offset() + block_size, 1, &type, type_buf);
+  if (!s->ok()) return true;
+  if (type.size() != 1 || type[0] != kNoCompression) return false;
+
+  // A single entry has no shared key prefix, and is followed only by a
+  // restart array of one element and its length
+  const size_t prefix_size = k.size() + kLargeValueHeaderSlop;
+  std::string prefix_buf(prefix_size, '\0');
+  Slice prefix;
+  *s = rep_->file->Read(handle.offset(), prefix_size, &prefix, &prefix_buf[0]);
+  if (!s->ok()) return true;
+  const char* p = prefix.data();
+  const char* limit = p + prefix.size();
+  uint32_t shared, non_shared, value_length;
+  if ((p = GetVarint32Ptr(p, limit, &shared)) == NULL ||
+      (p = GetVarint32Ptr(p, limit, &non_shared)) == NULL ||
+      (p = GetVarint32Ptr(p, limit, &value_length)) == NULL ||
+      shared != 0 ||
+      static_cast<size_t>(limit - p) < non_shared) {
+    return false;
+  }
+  const uint64_t header_size = p - prefix.data();
+  if (header_size + non_shared + value_length + 2 * sizeof(uint32_t) !=
+      block_size) {
+    return false;
+  }
+
+  // As Block::Iter::Seek() would, skip an entry that sorts before k
+  Slice entry_key(p, non_shared);
+  if (rep_->options.comparator->Compare(entry_key, k) < 0) {
+    return true;
+  }
+
+  if (offset > value_length) {
+    offset = value_length;
+  }
+  if (length > value_length - offset) {
+    length = value_length - offset;
+  }
+  std::string value_buf;
+  Slice value;
+  if (length > 0) {
+    value_buf.resize(static_cast<size_t>(length));
+    *s = rep_->file->Read(handle.offset() + header_size + non_shared + offset,
+                          value_buf.size(), &value, &value_buf[0]);
+  }
+  if (s->ok()) {
+    if (value.size() != length) {
+      *s = Status::Corruption("truncated large value block");
+    } else {
+      (*saver)(arg, entry_key, value);
+    }
+  }
+  return true;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
+                          uint64_t offset, uint64_t length,
                           void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
   Status s;
+  if (rep_->reader != NULL) {
+    bool found;
+    Slice found_key, found_value;
+    s = rep_->reader->Get(options, k, &found, &found_key, &found_value);
+    if (s.ok() && found) {
+      (*saver)(arg, found_key, ValueRange(found_value, offset, length));
+    }
+    return s;
+  }
   Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
     FilterBlockReader* filter = rep_->filter;
     BlockHandle handle;
-    if (filter != NULL &&
-        handle.DecodeFrom(&handle_value).ok() &&
+    Status hs = handle.DecodeFrom(&handle_value);
+    if (filter != NULL && hs.ok() &&
         !filter->KeyMayMatch(handle.offset(), k)) {
       // Not found
+    } else if (hs.ok() && !rep_->file_in_memory &&
+               (offset > 0 || length < handle.size()) &&
+               GetFromLargeValueBlock(options, handle, k, offset, length,
+                                      &s, arg, saver)) {
+      // Done
     } else {
       Iterator* block_iter = BlockReader(this, options, iiter->value());
       block_iter->Seek(k);
       if (block_iter->Valid()) {
-        (*saver)(arg, block_iter->key(), block_iter->value());
+        (*saver)(arg, block_iter->key(),
+                 ValueRange(block_iter->value(), offset, length));
       }
       s = block_iter->status();
       delete block_iter;
@@ -265,6 +476,9 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
 
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
+  if (rep_->reader != NULL) {
+    return rep_->reader->ApproximateOffsetOf(key);
+  }
   Iterator* index_iter =
       rep_->index_block->NewIterator(rep_->options.comparator);
   index_iter->Seek(key);
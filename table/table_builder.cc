@@ -5,18 +5,27 @@
 #include "leveldb/table_builder.h"
 
 #include <assert.h>
+#include <vector>
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/table_factory.h"
 #include "table/block_builder.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/table_writer.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
 
 namespace leveldb {
 
+TableFactory::~TableFactory() {
+}
+
+TableWriter::~TableWriter() {
+}
+
 struct TableBuilder::Rep {
   Options options;
   Options index_block_options;
@@ -43,6 +52,16 @@ struct TableBuilder::Rep {
   BlockHandle pending_handle;  // Handle to add to index block
 
   std::string compressed_output;
+  bool skip_compression;       // Store the next data block uncompressed
+
+  // With block_align, the keys of the current data block.  Padding may
+  // move the block, so they are only passed to filter_block once the
+  // block has been written and its offset is known.
+  std::string block_keys;                // Flattened key contents
+  std::vector<size_t> block_key_starts;  // Start of each key in block_keys
+
+  // Writes the table if options.table_factory is set, else NULL
+  TableWriter* writer;
 
   Rep(const Options& opt, WritableFile* f)
       : options(opt),
@@ -55,7 +74,10 @@ struct TableBuilder::Rep {
         closed(false),
         filter_block(opt.filter_policy == NULL ? NULL
                      : new FilterBlockBuilder(opt.filter_policy)),
-        pending_index_entry(false) {
+        pending_index_entry(false),
+        skip_compression(false),
+        writer(opt.table_factory == NULL ? NULL
+               : opt.table_factory->NewTableWriter(opt, f)) {
     // 因为在index_block中我们每个block的索引key差别比较大，
     // 所以我在这里将重启点的周期设置为1，也就是说不采用shard, no-shard那
     // 一套东西
@@ -73,6 +95,7 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
   delete rep_->filter_block;
+  delete rep_->writer;
   delete rep_;
 }
 
@@ -83,6 +106,13 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.table_factory != rep_->options.table_factory) {
+    return Status::InvalidArgument(
+        "changing table factory while building table");
+  }
+  if (options.block_align != rep_->options.block_align) {
+    return Status::InvalidArgument("changing block_align while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -137,11 +167,30 @@ Status TableBuilder::ChangeOptions(const Options& options) {
 void TableBuilder::Add(const Slice& key, const Slice& value) {
   Rep* r = rep_;
   assert(!r->closed);
+  if (r->writer != NULL) {
+    r->writer->Add(key, value);
+    return;
+  }
   if (!ok()) return;
   if (r->num_entries > 0) {
     assert(r->options.comparator->Compare(key, Slice(r->last_key)) > 0);
   }
 
+  // A large value gets an uncompressed block of its own (see
+  // Options::large_value_threshold)
+  const bool large_value = (r->options.large_value_threshold > 0 &&
+                            value.size() >= r->options.large_value_threshold);
+  // With block_align, end the current data block if this entry could
+  // make it outgrow a page.  The entry header takes at most 15 bytes, and
+  // the entry may add a restart point.
+  if (large_value ||
+      (r->options.block_align &&
+       r->data_block.CurrentSizeEstimate() + key.size() + value.size() +
+       15 + sizeof(uint32_t) > kBlockAlignment - kBlockTrailerSize)) {
+    Flush();
+    if (!ok()) return;
+  }
+
   // 当我们写完一个Raw Block以后要记录下一些数据
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
@@ -162,7 +211,12 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   }
 
   if (r->filter_block != NULL) {
-    r->filter_block->AddKey(key);
+    if (r->options.block_align) {
+      r->block_key_starts.push_back(r->block_keys.size());
+      r->block_keys.append(key.data(), key.size());
+    } else {
+      r->filter_block->AddKey(key);
+    }
   }
 
   r->last_key.assign(key.data(), key.size());
@@ -174,7 +228,11 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   // 的大小(uint32_t), 在option中我们配置block_size, 实际上在文件
   // 当中每个block的大小并不是一定是我们的block_size.
   const size_t estimated_block_size = r->data_block.CurrentSizeEstimate();
-  if (estimated_block_size >= r->options.block_size) {
+  if (large_value) {
+    r->skip_compression = true;
+    Flush();
+    r->skip_compression = false;
+  } else if (estimated_block_size >= r->options.block_size) {
     Flush();
   }
 }
@@ -183,6 +241,7 @@ void TableBuilder::Flush() {
   Rep* r = rep_;
   assert(!r->closed);
   if (!ok()) return;
+  if (r->writer != NULL) return;   // Other formats have no data blocks
   if (r->data_block.empty()) return;
   assert(!r->pending_index_entry);
   WriteBlock(&r->data_block, &r->pending_handle);
@@ -191,7 +250,22 @@ void TableBuilder::Flush() {
     r->status = r->file->Flush();
   }
   if (r->filter_block != NULL) {
-    r->filter_block->StartBlock(r->offset);
+    if (r->options.block_align) {
+      // The filter must be found at the offset of the padded block
+      r->filter_block->StartBlock(r->pending_handle.offset());
+      const size_t num_keys = r->block_key_starts.size();
+      for (size_t i = 0; i < num_keys; i++) {
+        const size_t start = r->block_key_starts[i];
+        const size_t limit = (i + 1 < num_keys) ? r->block_key_starts[i + 1]
+                                                : r->block_keys.size();
+        r->filter_block->AddKey(Slice(r->block_keys.data() + start,
+                                      limit - start));
+      }
+      r->block_keys.clear();
+      r->block_key_starts.clear();
+    } else {
+      r->filter_block->StartBlock(r->offset);
+    }
   }
 }
 
@@ -205,7 +279,8 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   Slice raw = block->Finish();
 
   Slice block_contents;
-  CompressionType type = r->options.compression;
+  CompressionType type = r->skip_compression ? kNoCompression
+                                             : r->options.compression;
   // TODO(postrelease): Support more compression options: zlib?
   switch (type) {
     case kNoCompression:
@@ -253,6 +328,18 @@ void TableBuilder::WriteRawBlock(const Slice& block_contents,
                                  CompressionType type,
                                  BlockHandle* handle) {
   Rep* r = rep_;
+  if (r->options.block_align) {
+    // Pad the file so that the block does not cross a page boundary
+    const uint64_t raw_size = block_contents.size() + kBlockTrailerSize;
+    const uint64_t page_used = r->offset % kBlockAlignment;
+    if (raw_size <= kBlockAlignment &&
+        page_used + raw_size > kBlockAlignment) {
+      const std::string padding(kBlockAlignment - page_used, '\0');
+      r->status = r->file->Append(padding);
+      if (!r->status.ok()) return;
+      r->offset += padding.size();
+    }
+  }
   handle->set_offset(r->offset);
   handle->set_size(block_contents.size());
   r->status = r->file->Append(block_contents);
@@ -270,6 +357,9 @@ void TableBuilder::WriteRawBlock(const Slice& block_contents,
 }
 
 Status TableBuilder::status() const {
+  if (rep_->writer != NULL) {
+    return rep_->writer->status();
+  }
   return rep_->status;
 }
 
@@ -335,6 +425,11 @@ Status TableBuilder::status() const {
 
 Status TableBuilder::Finish() {
   Rep* r = rep_;
+  if (r->writer != NULL) {
+    assert(!r->closed);
+    r->closed = true;
+    return r->writer->Finish();
+  }
   Flush();      //把最后一个Data Block Flush到文件上
   assert(!r->closed);
   r->closed = true;
@@ -400,10 +495,16 @@ void TableBuilder::Abandon() {
 }
 
 uint64_t TableBuilder::NumEntries() const {
+  if (rep_->writer != NULL) {
+    return rep_->writer->NumEntries();
+  }
   return rep_->num_entries;
 }
 
 uint64_t TableBuilder::FileSize() const {
+  if (rep_->writer != NULL) {
+    return rep_->writer->FileSize();
+  }
   return rep_->offset;
 }
 
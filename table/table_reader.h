@@ -0,0 +1,58 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_TABLE_READER_H_
+#define STORAGE_LEVELDB_TABLE_TABLE_READER_H_
+
+#include <stdint.h>
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Arena;
+class Iterator;
+struct ReadOptions;
+
+// Reads a table in a format other than the block-based one.  Table::Open()
+// creates a TableReader when it finds the magic number of such a format
+// in the footer, and the Table passes its calls on to it.  The contents
+// of these formats are held in memory for the lifetime of the reader.
+class TableReader {
+ public:
+  TableReader() { }
+  virtual ~TableReader();
+
+  // Like Table::NewIterator(), but places the iterator in *arena, if
+  // non-NULL.
+  virtual Iterator* NewIterator(const ReadOptions& options,
+                                Arena* arena) const = 0;
+
+  // Find the first entry at or after key.  If there is one, set
+  // *found to true and point *found_key and *found_value at it; they stay
+  // valid for the lifetime of the reader.  Otherwise set *found to false.
+  // The reader may also set *found to false when that entry has a
+  // different key than "key", or a different user key if the table holds
+  // internal keys.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     bool* found, Slice* found_key,
+                     Slice* found_value) const = 0;
+
+  // Returns an iterator like Table::NewIndexIterator(): its keys split the
+  // table into ranges in order, and its values are encoded BlockHandles
+  // of the ranges.
+  virtual Iterator* NewIndexIterator() const = 0;
+
+  // See Table::ApproximateOffsetOf().
+  virtual uint64_t ApproximateOffsetOf(const Slice& key) const = 0;
+
+ private:
+  // No copying allowed
+  TableReader(const TableReader&);
+  void operator=(const TableReader&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_TABLE_READER_H_
@@ -13,6 +13,7 @@
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "leveldb/table_builder.h"
+#include "leveldb/table_factory.h"
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
@@ -398,6 +399,8 @@ class DBConstructor: public Constructor {
 
 enum TestType {
   TABLE_TEST,
+  PLAIN_TABLE_TEST,
+  CUCKOO_TABLE_TEST,
   BLOCK_TEST,
   MEMTABLE_TEST,
   DB_TEST
@@ -406,7 +409,7 @@ enum TestType {
 struct TestArgs {
   TestType type;
   bool reverse_compare;
-  int restart_interval;
+  int restart_interval;   // Index interval for plain tables
 };
 
 static const TestArgs kTestArgList[] = {
@@ -417,6 +420,14 @@ static const TestArgs kTestArgList[] = {
   { TABLE_TEST, true, 1 },
   { TABLE_TEST, true, 1024 },
 
+  { PLAIN_TABLE_TEST, false, 16 },
+  { PLAIN_TABLE_TEST, false, 1 },
+  { PLAIN_TABLE_TEST, true, 16 },
+
+  // Cuckoo tables have no restart points or samples
+  { CUCKOO_TABLE_TEST, false, 16 },
+  { CUCKOO_TABLE_TEST, true, 16 },
+
   { BLOCK_TEST, false, 16 },
   { BLOCK_TEST, false, 1 },
   { BLOCK_TEST, false, 1024 },
@@ -436,11 +447,13 @@ static const int kNumTestArgs = sizeof(kTestArgList) / sizeof(kTestArgList[0]);
 
 class Harness {
  public:
-  Harness() : constructor_(NULL) { }
+  Harness() : constructor_(NULL), table_factory_(NULL) { }
 
   void Init(const TestArgs& args) {
     delete constructor_;
     constructor_ = NULL;
+    delete table_factory_;
+    table_factory_ = NULL;
     options_ = Options();
 
     options_.block_restart_interval = args.restart_interval;
@@ -454,6 +467,16 @@ class Harness {
       case TABLE_TEST:
         constructor_ = new TableConstructor(options_.comparator);
         break;
+      case PLAIN_TABLE_TEST:
+        table_factory_ = NewPlainTableFactory(args.restart_interval);
+        options_.table_factory = table_factory_;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
+      case CUCKOO_TABLE_TEST:
+        table_factory_ = NewCuckooTableFactory();
+        options_.table_factory = table_factory_;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
       case BLOCK_TEST:
         constructor_ = new BlockConstructor(options_.comparator);
         break;
@@ -468,6 +491,7 @@ class Harness {
 
   ~Harness() {
     delete constructor_;
+    delete table_factory_;
   }
 
   void Add(const std::string& key, const std::string& value) {
@@ -642,6 +666,7 @@ class Harness {
  private:
   Options options_;
   Constructor* constructor_;
+  TableFactory* table_factory_;
 };
 
 // Test empty table/block.
@@ -827,6 +852,37 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
 
 }
 
+TEST(TableTest, ApproximateOffsetOfPlainTable) {
+  TableConstructor c(BytewiseComparator());
+  c.Add("k01", "hello");
+  c.Add("k02", "hello2");
+  c.Add("k03", std::string(10000, 'x'));
+  c.Add("k04", std::string(200000, 'x'));
+  c.Add("k05", std::string(300000, 'x'));
+  c.Add("k06", "hello3");
+  c.Add("k07", std::string(100000, 'x'));
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  TableFactory* factory = NewPlainTableFactory(2);
+  options.table_factory = factory;
+  c.Finish(options, &keys, &kvmap);
+
+  // Offsets are exact: entries are stored one after the other
+  ASSERT_EQ(0u, c.ApproximateOffsetOf("abc"));
+  ASSERT_EQ(0u, c.ApproximateOffsetOf("k01"));
+  ASSERT_EQ(10u, c.ApproximateOffsetOf("k01a"));
+  ASSERT_EQ(10u, c.ApproximateOffsetOf("k02"));
+  ASSERT_EQ(21u, c.ApproximateOffsetOf("k03"));
+  ASSERT_EQ(10027u, c.ApproximateOffsetOf("k04"));
+  ASSERT_EQ(210034u, c.ApproximateOffsetOf("k04a"));
+  ASSERT_EQ(210034u, c.ApproximateOffsetOf("k05"));
+  ASSERT_EQ(510041u, c.ApproximateOffsetOf("k06"));
+  ASSERT_EQ(510052u, c.ApproximateOffsetOf("k07"));
+  ASSERT_EQ(610059u, c.ApproximateOffsetOf("xyz"));
+  delete factory;
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
@@ -869,6 +925,65 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 2 * min_z, 2 * max_z));
 }
 
+TEST(TableTest, BlockAlign) {
+  Options options;
+  options.block_align = true;
+  options.compression = kNoCompression;
+  options.block_size = 8192;    // Capped at a page by block_align
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  Random rnd(301);
+  KVMap kvmap;
+  for (int i = 0; i < 2000; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "k%06d", i);
+    std::string value;
+    test::RandomString(&rnd, 1 + rnd.Uniform(300), &value);
+    builder.Add(key, value);
+    kvmap[key] = value;
+  }
+  ASSERT_OK(builder.Finish());
+
+  // Check that no data block crosses a page boundary
+  StringSource source(sink.contents());
+  Slice footer_input;
+  char footer_space[Footer::kEncodedLength];
+  ASSERT_OK(source.Read(source.Size() - Footer::kEncodedLength,
+                        Footer::kEncodedLength, &footer_input, footer_space));
+  Footer footer;
+  ASSERT_OK(footer.DecodeFrom(&footer_input));
+  BlockContents contents;
+  ASSERT_OK(ReadBlock(&source, ReadOptions(), footer.index_handle(), NULL,
+                      false, &contents));
+  Block index_block(contents);
+  Iterator* index_iter = index_block.NewIterator(BytewiseComparator());
+  int blocks = 0;
+  for (index_iter->SeekToFirst(); index_iter->Valid(); index_iter->Next()) {
+    Slice input = index_iter->value();
+    BlockHandle handle;
+    ASSERT_OK(handle.DecodeFrom(&input));
+    const uint64_t end = handle.offset() + handle.size() + kBlockTrailerSize;
+    ASSERT_EQ(handle.offset() / kBlockAlignment, (end - 1) / kBlockAlignment);
+    blocks++;
+  }
+  delete index_iter;
+  ASSERT_GT(blocks, 50);
+
+  // Check that the padding leaves the contents readable
+  Table* table;
+  ASSERT_OK(Table::Open(options, &source, source.Size(), &table));
+  Iterator* iter = table->NewIterator(ReadOptions());
+  KVMap::const_iterator model = kvmap.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++model) {
+    ASSERT_TRUE(model != kvmap.end());
+    ASSERT_EQ(model->first, iter->key().ToString());
+    ASSERT_EQ(model->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(model == kvmap.end());
+  delete iter;
+  delete table;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -0,0 +1,37 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_TABLE_WRITER_H_
+#define STORAGE_LEVELDB_TABLE_TABLE_WRITER_H_
+
+#include <stdint.h>
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+// Writes a table in a format other than the block-based one.  A
+// TableBuilder created with Options::table_factory passes its calls on
+// to the TableWriter of the factory; see TableBuilder for the contract
+// of each method.
+class TableWriter {
+ public:
+  TableWriter() { }
+  virtual ~TableWriter();
+
+  virtual void Add(const Slice& key, const Slice& value) = 0;
+  virtual Status status() const = 0;
+  virtual Status Finish() = 0;
+  virtual uint64_t NumEntries() const = 0;
+  virtual uint64_t FileSize() const = 0;
+
+ private:
+  // No copying allowed
+  TableWriter(const TableWriter&);
+  void operator=(const TableWriter&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_TABLE_WRITER_H_
@@ -4,10 +4,13 @@
 
 #include "table/two_level_iterator.h"
 
+#include <new>
+#include <vector>
 #include "leveldb/table.h"
 #include "table/block.h"
 #include "table/format.h"
 #include "table/iterator_wrapper.h"
+#include "util/arena.h"
 
 namespace leveldb {
 
@@ -21,7 +24,8 @@ class TwoLevelIterator: public Iterator {
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    bool arena_mode);
 
   virtual ~TwoLevelIterator();
 
@@ -42,6 +46,10 @@ class TwoLevelIterator: public Iterator {
     assert(Valid());
     return data_iter_.value();
   }
+  virtual bool IsKeyPinned() const {
+    assert(Valid());
+    return options_.pin_data && data_iter_.IsKeyPinned();
+  }
   virtual Status status() const {
     // It'd be nice if status() returned a const Status& instead of a Status
     if (!index_iter_.status().ok()) {
@@ -57,6 +65,14 @@ class TwoLevelIterator: public Iterator {
   void SaveError(const Status& s) {
     if (status_.ok() && !s.ok()) status_ = s;
   }
+  // True if the current block was not read because ReadOptions::read_tier
+  // ruled out I/O or ReadOptions::deadline passed.  Its entries must not
+  // be skipped silently.
+  bool DataBlockSkipped() const {
+    if (data_iter_.iter() == NULL) return false;
+    const Status s = data_iter_.status();
+    return s.IsIncomplete() || s.IsTimedOut();
+  }
   void SkipEmptyDataBlocksForward();
   void SkipEmptyDataBlocksBackward();
   void SetDataIterator(Iterator* data_iter);
@@ -71,21 +87,28 @@ class TwoLevelIterator: public Iterator {
   // If data_iter_ is non-NULL, then "data_block_handle_" holds the
   // "index_value" passed to block_function_ to create the data_iter_.
   std::string data_block_handle_;
+  // Earlier data iterators, kept with ReadOptions::pin_data
+  std::vector<Iterator*> pinned_iters_;
 };
 
 TwoLevelIterator::TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options)
+    const ReadOptions& options,
+    bool arena_mode)
     : block_function_(block_function),
       arg_(arg),
       options_(options),
       index_iter_(index_iter),
       data_iter_(NULL) {
+  index_iter_.SetArenaMode(arena_mode);
 }
 
 TwoLevelIterator::~TwoLevelIterator() {
+  for (size_t i = 0; i < pinned_iters_.size(); i++) {
+    delete pinned_iters_[i];
+  }
 }
 
 void TwoLevelIterator::Seek(const Slice& target) {
@@ -125,7 +148,7 @@ void TwoLevelIterator::Prev() {
 void TwoLevelIterator::SkipEmptyDataBlocksForward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
-    if (!index_iter_.Valid()) {
+    if (!index_iter_.Valid() || DataBlockSkipped()) {
       SetDataIterator(NULL);
       return;
     }
@@ -138,7 +161,7 @@ void TwoLevelIterator::SkipEmptyDataBlocksForward() {
 void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
-    if (!index_iter_.Valid()) {
+    if (!index_iter_.Valid() || DataBlockSkipped()) {
       SetDataIterator(NULL);
       return;
     }
@@ -149,7 +172,13 @@ void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
 }
 
 void TwoLevelIterator::SetDataIterator(Iterator* data_iter) {
-  if (data_iter_.iter() != NULL) SaveError(data_iter_.status());
+  if (data_iter_.iter() != NULL) {
+    SaveError(data_iter_.status());
+    if (options_.pin_data) {
+      // Keys and values handed out may point into its block
+      pinned_iters_.push_back(data_iter_.Release());
+    }
+  }
   data_iter_.Set(data_iter);
 }
 
@@ -178,8 +207,15 @@ Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+    const ReadOptions& options,
+    Arena* arena) {
+  if (arena != NULL) {
+    void* mem = arena->AllocateAligned(sizeof(TwoLevelIterator));
+    return new (mem) TwoLevelIterator(index_iter, block_function, arg,
+                                      options, true);
+  }
+  return new TwoLevelIterator(index_iter, block_function, arg, options,
+                              false);
 }
 
 }  // namespace leveldb
@@ -9,6 +9,7 @@
 
 namespace leveldb {
 
+class Arena;
 struct ReadOptions;
 
 // Return a new two level iterator.  A two-level iterator contains an
@@ -20,6 +21,11 @@ struct ReadOptions;
 //
 // Uses a supplied function to convert an index_iter value into
 // an iterator over the contents of the corresponding block.
+//
+// If "arena" is non-NULL, "index_iter" must have been placed in *arena
+// too; the result is placed there and must be released with
+// iter->~Iterator() instead of delete.  The per-block iterators are
+// still allocated on the heap.
 extern Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     Iterator* (*block_function)(
@@ -27,7 +33,8 @@ extern Iterator* NewTwoLevelIterator(
         const ReadOptions& options,
         const Slice& index_value),
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    Arena* arena = NULL);
 
 }  // namespace leveldb
 
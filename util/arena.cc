@@ -9,7 +9,7 @@ namespace leveldb {
 
 static const int kBlockSize = 4096;
 
-Arena::Arena() : memory_usage_(0) {
+Arena::Arena() : first_block_bytes_(0), memory_usage_(0) {
   alloc_ptr_ = NULL;  // First allocation will allocate a block
   alloc_bytes_remaining_ = 0;
 }
@@ -20,6 +20,20 @@ Arena::~Arena() {
   }
 }
 
+void Arena::Reset() {
+  if (blocks_.empty()) {
+    return;
+  }
+  for (size_t i = 1; i < blocks_.size(); i++) {
+    delete[] blocks_[i];
+  }
+  blocks_.resize(1);
+  alloc_ptr_ = blocks_[0];
+  alloc_bytes_remaining_ = first_block_bytes_;
+  memory_usage_.NoBarrier_Store(
+      reinterpret_cast<void*>(first_block_bytes_ + sizeof(char*)));
+}
+
 char* Arena::AllocateFallback(size_t bytes) {
   if (bytes > kBlockSize / 4) {
     // Object is more than a quarter of our block size.  Allocate it separately
@@ -59,6 +73,9 @@ char* Arena::AllocateAligned(size_t bytes) {
 
 char* Arena::AllocateNewBlock(size_t block_bytes) {
   char* result = new char[block_bytes];
+  if (blocks_.empty()) {
+    first_block_bytes_ = block_bytes;
+  }
   blocks_.push_back(result);
   memory_usage_.NoBarrier_Store(
       reinterpret_cast<void*>(MemoryUsage() + block_bytes + sizeof(char*)));
@@ -24,6 +24,11 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc
   char* AllocateAligned(size_t bytes);
 
+  // Free all memory except the first block, which is kept for the next
+  // allocations.
+  // REQUIRES: nothing allocated from this arena is still in use.
+  void Reset();
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena.
   size_t MemoryUsage() const {
@@ -40,6 +45,7 @@ class Arena {
 
   // Array of new[] allocated memory blocks
   std::vector<char*> blocks_;
+  size_t first_block_bytes_;  // Size of blocks_[0]
 
   // Total memory usage of the arena.
   port::AtomicPointer memory_usage_;
@@ -61,6 +61,20 @@ TEST(ArenaTest, Simple) {
   }
 }
 
+TEST(ArenaTest, Reset) {
+  Arena arena;
+  arena.Reset();  // No-op on an empty arena
+  char* first = arena.AllocateAligned(16);
+  for (int i = 0; i < 100; i++) {
+    arena.Allocate(1000);
+  }
+  ASSERT_GT(arena.MemoryUsage(), 100000);
+  arena.Reset();
+  ASSERT_LT(arena.MemoryUsage(), 8192);
+  // The first block is reused
+  ASSERT_EQ(first, arena.AllocateAligned(16));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
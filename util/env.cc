@@ -13,6 +13,10 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+Status Env::TruncateFile(const std::string& fname, uint64_t size) {
+  return Status::NotSupported("TruncateFile", fname);
+}
+
 SequentialFile::~SequentialFile() {
 }
 
@@ -533,6 +533,14 @@ class PosixEnv : public Env {
     return result;
   }
 
+  virtual Status TruncateFile(const std::string& fname, uint64_t size) {
+    Status result;
+    if (truncate(fname.c_str(), size) != 0) {
+      result = PosixError(fname, errno);
+    }
+    return result;
+  }
+
   virtual Status LockFile(const std::string& fname, FileLock** lock) {
     *lock = NULL;
     Status result;
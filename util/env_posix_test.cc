@@ -56,6 +56,34 @@ TEST(EnvPosixTest, TestOpenOnRead) {
   ASSERT_OK(env_->DeleteFile(test_file));
 }
 
+TEST(EnvPosixTest, LoggerWritesAllLines) {
+  std::string test_dir;
+  ASSERT_OK(env_->GetTestDirectory(&test_dir));
+  std::string log_file = test_dir + "/logger_test.txt";
+
+  // Lines are written by a background thread; all of them must be in
+  // the file once the logger is gone.
+  const int kNumLines = 1000;
+  Logger* logger;
+  ASSERT_OK(env_->NewLogger(log_file, &logger));
+  for (int i = 0; i < kNumLines; i++) {
+    Log(logger, "line %d", i);
+  }
+  delete logger;
+
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env_, log_file, &contents));
+  int lines = 0;
+  for (size_t i = 0; i < contents.size(); i++) {
+    if (contents[i] == '\n') {
+      lines++;
+    }
+  }
+  ASSERT_EQ(kNumLines, lines);
+  ASSERT_TRUE(contents.find("line 999\n") != std::string::npos);
+  ASSERT_OK(env_->DeleteFile(log_file));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
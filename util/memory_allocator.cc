@@ -0,0 +1,228 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/memory_allocator.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+#if defined(LEVELDB_PLATFORM_POSIX)
+#include <sys/mman.h>
+#endif
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+MemoryAllocator::~MemoryAllocator() {
+}
+
+size_t MemoryAllocator::UsableSize(const char* p, size_t size) const {
+  return size;
+}
+
+bool MemoryAllocator::GetStats(MemoryAllocatorStats* stats) const {
+  return false;
+}
+
+namespace {
+
+// Each chunk starts with a header holding its size class (fixed32) and
+// the size it was requested with (fixed64, at offset 8).  Its size keeps
+// the memory handed out 16-byte aligned.
+static const size_t kHeaderSize = 16;
+
+// Slabs are the size of an x86-64 huge page
+static const size_t kSlabSize = 2 << 20;
+
+// Chunk sizes, including the header, run from kMinClassSize to
+// kMaxClassSize in four steps per power of two, so that rounding up
+// wastes at most a fifth of a chunk.
+static const size_t kMinClassSize = 64;
+static const size_t kMaxClassSize = kSlabSize / 8;
+
+// Size class recorded for chunks from the system allocator
+static const uint32_t kLargeChunk = 0xffffffffu;
+
+class SizeClassAllocator : public MemoryAllocator {
+ public:
+  explicit SizeClassAllocator(bool use_huge_pages);
+  virtual ~SizeClassAllocator();
+
+  virtual const char* Name() const { return "leveldb.SizeClassAllocator"; }
+  virtual char* Allocate(size_t size);
+  virtual void Deallocate(char* p);
+  virtual size_t UsableSize(const char* p, size_t size) const;
+  virtual bool GetStats(MemoryAllocatorStats* stats) const;
+
+ private:
+  // A free chunk holds a link to the next chunk on its free list
+  struct FreeChunk {
+    FreeChunk* next;
+  };
+
+  char* NewSlab();
+  void CarveRemainder() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const bool use_huge_pages_;
+  std::vector<size_t> class_sizes_;     // Ascending
+
+  // State below is protected by mu_
+  mutable port::Mutex mu_;
+  std::vector<FreeChunk*> free_lists_;  // One per size class
+  std::vector<char*> slabs_;
+  char* slab_ptr_;                      // Unused part of the newest slab
+  size_t slab_remaining_;
+  MemoryAllocatorStats stats_;
+};
+
+SizeClassAllocator::SizeClassAllocator(bool use_huge_pages)
+    : use_huge_pages_(use_huge_pages),
+      slab_ptr_(NULL),
+      slab_remaining_(0) {
+  stats_.requested = 0;
+  stats_.allocated = 0;
+  stats_.free = 0;
+  stats_.reserved = 0;
+  for (size_t base = kMinClassSize; base < kMaxClassSize; base *= 2) {
+    for (size_t step = 0; step < 4; step++) {
+      class_sizes_.push_back(base + step * (base / 4));
+    }
+  }
+  class_sizes_.push_back(kMaxClassSize);
+  free_lists_.resize(class_sizes_.size(), NULL);
+}
+
+SizeClassAllocator::~SizeClassAllocator() {
+  for (size_t i = 0; i < slabs_.size(); i++) {
+    free(slabs_[i]);
+  }
+}
+
+char* SizeClassAllocator::NewSlab() {
+  void* slab = NULL;
+#if defined(LEVELDB_PLATFORM_POSIX)
+  if (use_huge_pages_ && posix_memalign(&slab, kSlabSize, kSlabSize) == 0) {
+#if defined(MADV_HUGEPAGE)
+    madvise(slab, kSlabSize, MADV_HUGEPAGE);  // Only a hint
+#endif
+    return reinterpret_cast<char*>(slab);
+  }
+#endif
+  slab = malloc(kSlabSize);
+  if (slab == NULL) {
+    throw std::bad_alloc();
+  }
+  return reinterpret_cast<char*>(slab);
+}
+
+// Hand the unused end of the current slab to the free lists, largest
+// classes first, before moving on to a new slab.
+void SizeClassAllocator::CarveRemainder() {
+  size_t c = class_sizes_.size();
+  while (c > 0 && slab_remaining_ >= kMinClassSize) {
+    c--;
+    while (class_sizes_[c] <= slab_remaining_) {
+      FreeChunk* f = reinterpret_cast<FreeChunk*>(slab_ptr_);
+      f->next = free_lists_[c];
+      free_lists_[c] = f;
+      stats_.free += class_sizes_[c];
+      slab_ptr_ += class_sizes_[c];
+      slab_remaining_ -= class_sizes_[c];
+    }
+  }
+}
+
+char* SizeClassAllocator::Allocate(size_t size) {
+  const size_t needed = size + kHeaderSize;
+  char* chunk;
+  if (needed > kMaxClassSize) {
+    chunk = new char[needed];
+    EncodeFixed32(chunk, kLargeChunk);
+    EncodeFixed64(chunk + 8, size);
+    MutexLock l(&mu_);
+    stats_.requested += size;
+    stats_.allocated += needed;
+    stats_.reserved += needed;
+    return chunk + kHeaderSize;
+  }
+
+  const uint32_t c = static_cast<uint32_t>(
+      std::lower_bound(class_sizes_.begin(), class_sizes_.end(), needed) -
+      class_sizes_.begin());
+  {
+    MutexLock l(&mu_);
+    if (free_lists_[c] != NULL) {
+      FreeChunk* f = free_lists_[c];
+      free_lists_[c] = f->next;
+      chunk = reinterpret_cast<char*>(f);
+      stats_.free -= class_sizes_[c];
+    } else {
+      if (class_sizes_[c] > slab_remaining_) {
+        CarveRemainder();
+        slab_ptr_ = NewSlab();
+        slab_remaining_ = kSlabSize;
+        slabs_.push_back(slab_ptr_);
+        stats_.reserved += kSlabSize;
+      }
+      chunk = slab_ptr_;
+      slab_ptr_ += class_sizes_[c];
+      slab_remaining_ -= class_sizes_[c];
+    }
+    stats_.requested += size;
+    stats_.allocated += class_sizes_[c];
+  }
+  EncodeFixed32(chunk, c);
+  EncodeFixed64(chunk + 8, size);
+  return chunk + kHeaderSize;
+}
+
+void SizeClassAllocator::Deallocate(char* p) {
+  char* chunk = p - kHeaderSize;
+  const uint32_t c = DecodeFixed32(chunk);
+  const uint64_t size = DecodeFixed64(chunk + 8);
+  if (c == kLargeChunk) {
+    delete[] chunk;
+    MutexLock l(&mu_);
+    stats_.requested -= size;
+    stats_.allocated -= size + kHeaderSize;
+    stats_.reserved -= size + kHeaderSize;
+    return;
+  }
+  assert(c < class_sizes_.size());
+  MutexLock l(&mu_);
+  FreeChunk* f = reinterpret_cast<FreeChunk*>(chunk);
+  f->next = free_lists_[c];
+  free_lists_[c] = f;
+  stats_.requested -= size;
+  stats_.allocated -= class_sizes_[c];
+  stats_.free += class_sizes_[c];
+}
+
+size_t SizeClassAllocator::UsableSize(const char* p, size_t size) const {
+  const uint32_t c = DecodeFixed32(p - kHeaderSize);
+  if (c == kLargeChunk) {
+    return static_cast<size_t>(DecodeFixed64(p - kHeaderSize + 8));
+  }
+  return class_sizes_[c] - kHeaderSize;
+}
+
+bool SizeClassAllocator::GetStats(MemoryAllocatorStats* stats) const {
+  MutexLock l(&mu_);
+  *stats = stats_;
+  return true;
+}
+
+}  // namespace
+
+MemoryAllocator* NewSizeClassAllocator(bool use_huge_pages) {
+  return new SizeClassAllocator(use_huge_pages);
+}
+
+}  // namespace leveldb
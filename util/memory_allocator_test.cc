@@ -0,0 +1,112 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/memory_allocator.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class MemoryAllocatorTest {
+ public:
+  MemoryAllocator* allocator_;
+
+  MemoryAllocatorTest() : allocator_(NewSizeClassAllocator(false)) { }
+  ~MemoryAllocatorTest() { delete allocator_; }
+};
+
+TEST(MemoryAllocatorTest, Simple) {
+  std::vector<std::pair<size_t, char*> > allocated;
+  Random rnd(301);
+  for (int i = 0; i < 5000; i++) {
+    size_t s;
+    if (rnd.OneIn(100)) {
+      s = 1 + rnd.Uniform(1 << 20);   // Some above the largest size class
+    } else {
+      s = 1 + rnd.Uniform(8192);
+    }
+    char* p = allocator_->Allocate(s);
+    ASSERT_EQ(0, reinterpret_cast<uintptr_t>(p) % 8);
+    memset(p, i % 256, s);
+    allocated.push_back(std::make_pair(s, p));
+
+    // Free some allocations as we go, to exercise reuse
+    if (rnd.OneIn(3)) {
+      const size_t victim = rnd.Uniform(allocated.size());
+      allocator_->Deallocate(allocated[victim].second);
+      allocated[victim] = allocated.back();
+      allocated.pop_back();
+    }
+  }
+  // Check that no allocation overlapped another
+  for (size_t i = 0; i < allocated.size(); i++) {
+    size_t s = allocated[i].first;
+    const char* p = allocated[i].second;
+    const char expected = p[0];
+    for (size_t b = 0; b < s; b++) {
+      ASSERT_EQ(static_cast<int>(expected), static_cast<int>(p[b]));
+    }
+  }
+  for (size_t i = 0; i < allocated.size(); i++) {
+    allocator_->Deallocate(allocated[i].second);
+  }
+}
+
+TEST(MemoryAllocatorTest, Reuse) {
+  char* p = allocator_->Allocate(4000);
+  allocator_->Deallocate(p);
+  // Requests of the same size class get the freed memory back
+  char* q = allocator_->Allocate(3900);
+  ASSERT_TRUE(p == q);
+  allocator_->Deallocate(q);
+}
+
+TEST(MemoryAllocatorTest, Stats) {
+  MemoryAllocatorStats stats;
+  ASSERT_TRUE(allocator_->GetStats(&stats));
+  ASSERT_EQ(0u, stats.requested);
+  ASSERT_EQ(0u, stats.reserved);
+
+  char* small = allocator_->Allocate(1000);
+  char* large = allocator_->Allocate(1u << 20);
+  ASSERT_GE(allocator_->UsableSize(small, 1000), 1000u);
+  ASSERT_LT(allocator_->UsableSize(small, 1000), 1250u);
+  ASSERT_EQ(1u << 20, allocator_->UsableSize(large, 1u << 20));
+  ASSERT_TRUE(allocator_->GetStats(&stats));
+  ASSERT_EQ(1000u + (1u << 20), stats.requested);
+  ASSERT_GT(stats.allocated, stats.requested);
+  ASSERT_GE(stats.reserved, stats.allocated + stats.free);
+
+  allocator_->Deallocate(large);
+  allocator_->Deallocate(small);
+  ASSERT_TRUE(allocator_->GetStats(&stats));
+  ASSERT_EQ(0u, stats.requested);
+  ASSERT_EQ(0u, stats.allocated);
+  ASSERT_GT(stats.free, 1000u);    // Kept for reuse
+  ASSERT_GE(stats.reserved, stats.free);
+}
+
+TEST(MemoryAllocatorTest, HugePages) {
+  MemoryAllocator* allocator = NewSizeClassAllocator(true);
+  std::vector<char*> allocated;
+  for (int i = 0; i < 1000; i++) {
+    char* p = allocator->Allocate(4096 + i);
+    memset(p, 'x', 4096 + i);
+    allocated.push_back(p);
+  }
+  for (size_t i = 0; i < allocated.size(); i++) {
+    allocator->Deallocate(allocated[i]);
+  }
+  delete allocator;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
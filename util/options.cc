@@ -19,12 +19,22 @@ Options::Options()
       write_buffer_size(4<<20),
       max_open_files(1000),
       block_cache(NULL),
+      memory_allocator(NULL),
       block_size(4096),
       block_restart_interval(16),
+      large_value_threshold(0),
+      block_align(false),
+      table_factory(NULL),
       max_file_size(2<<20),
       compression(kSnappyCompression),
       reuse_logs(false),
-      filter_policy(NULL) {
+      partition_memtable_output(false),
+      pipelined_compaction(false),
+      filter_policy(NULL),
+      delete_rate_bytes_per_sec(0),
+      delete_truncate_step(0),
+      compaction_service(NULL),
+      async_read_threads(4) {
 }
 
 }  // namespace leveldb
@@ -9,20 +9,90 @@
 #define STORAGE_LEVELDB_UTIL_POSIX_LOGGER_H_
 
 #include <algorithm>
+#include <deque>
+#include <string>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/time.h>
 #include <time.h>
 #include "leveldb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
+// Lines are formatted on the calling thread and handed to a background
+// thread that writes them, so a slow log device never blocks the caller.
+// If more than kMaxQueuedBytes are waiting to be written, new lines are
+// dropped and a count of them is written once the writer catches up.
 class PosixLogger : public Logger {
  private:
+  static const size_t kMaxQueuedBytes = 1 << 20;
+
   FILE* file_;
   uint64_t (*gettid_)();  // Return the thread id for the current thread
+  pthread_t writer_;
+
+  // State below is protected by mu_; it is never held while writing
+  port::Mutex mu_;
+  port::CondVar cv_;                 // Signalled when lines are queued
+  std::deque<std::string> queue_;
+  size_t queued_bytes_;
+  uint64_t dropped_;                 // Lines dropped since the last report
+  bool closing_;
+
+  static void* WriterMain(void* arg) {
+    reinterpret_cast<PosixLogger*>(arg)->WriteLines();
+    return NULL;
+  }
+
+  void WriteLines() {
+    std::deque<std::string> lines;
+    mu_.Lock();
+    while (true) {
+      while (queue_.empty() && dropped_ == 0 && !closing_) {
+        cv_.Wait();
+      }
+      if (queue_.empty() && dropped_ == 0) {
+        break;  // Closing and nothing left to write
+      }
+      lines.swap(queue_);
+      queued_bytes_ = 0;
+      const uint64_t dropped = dropped_;
+      dropped_ = 0;
+      mu_.Unlock();
+
+      for (size_t i = 0; i < lines.size(); i++) {
+        fwrite(lines[i].data(), 1, lines[i].size(), file_);
+      }
+      if (dropped > 0) {
+        fprintf(file_, "... %llu log lines dropped\n",
+                static_cast<unsigned long long>(dropped));
+      }
+      // One flush per batch of lines
+      fflush(file_);
+      lines.clear();
+
+      mu_.Lock();
+    }
+    mu_.Unlock();
+  }
+
  public:
-  PosixLogger(FILE* f, uint64_t (*gettid)()) : file_(f), gettid_(gettid) { }
+  PosixLogger(FILE* f, uint64_t (*gettid)())
+      : file_(f), gettid_(gettid), cv_(&mu_),
+        queued_bytes_(0), dropped_(0), closing_(false) {
+    if (pthread_create(&writer_, NULL, &PosixLogger::WriterMain, this) != 0) {
+      abort();
+    }
+  }
   virtual ~PosixLogger() {
+    mu_.Lock();
+    closing_ = true;
+    cv_.Signal();
+    mu_.Unlock();
+    pthread_join(writer_, NULL);
     fclose(file_);
   }
   virtual void Logv(const char* format, va_list ap) {
@@ -83,8 +153,16 @@ class PosixLogger : public Logger {
       }
 
       assert(p <= limit);
-      fwrite(base, 1, p - base, file_);
-      fflush(file_);
+      {
+        MutexLock l(&mu_);
+        if (queued_bytes_ + (p - base) > kMaxQueuedBytes) {
+          dropped_++;
+        } else {
+          queue_.push_back(std::string(base, p - base));
+          queued_bytes_ += p - base;
+          cv_.Signal();
+        }
+      }
       if (base != buffer) {
         delete[] base;
       }
@@ -58,6 +58,12 @@ std::string Status::ToString() const {
       case kIOError:
         type = "IO error: ";
         break;
+      case kIncomplete:
+        type = "Incomplete: ";
+        break;
+      case kTimedOut:
+        type = "Timed out: ";
+        break;
       default:
         snprintf(tmp, sizeof(tmp), "Unknown code(%d): ",
                  static_cast<int>(code()));
@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_pool.h"
+
+#include <assert.h>
+#include "leveldb/env.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+ThreadPool::ThreadPool(Env* env, int max_threads)
+    : env_(env),
+      max_threads_(max_threads),
+      cv_(&mu_),
+      num_threads_(0),
+      idle_threads_(0),
+      shutting_down_(false) {
+  assert(max_threads_ > 0);
+}
+
+ThreadPool::~ThreadPool() {
+  MutexLock l(&mu_);
+  shutting_down_ = true;
+  cv_.SignalAll();
+  while (num_threads_ > 0) {
+    cv_.Wait();
+  }
+}
+
+void ThreadPool::Schedule(void (*function)(void*), void* arg) {
+  MutexLock l(&mu_);
+  assert(!shutting_down_);
+  Item item;
+  item.function = function;
+  item.arg = arg;
+  queue_.push_back(item);
+  if (idle_threads_ < static_cast<int>(queue_.size()) &&
+      num_threads_ < max_threads_) {
+    num_threads_++;
+    env_->StartThread(&ThreadPool::BGThreadMain, this);
+  } else {
+    cv_.Signal();
+  }
+}
+
+void ThreadPool::BGThreadMain(void* pool) {
+  reinterpret_cast<ThreadPool*>(pool)->BGThread();
+}
+
+void ThreadPool::BGThread() {
+  MutexLock l(&mu_);
+  while (true) {
+    while (queue_.empty() && !shutting_down_) {
+      idle_threads_++;
+      cv_.Wait();
+      idle_threads_--;
+    }
+    if (queue_.empty()) {
+      break;  // Shutting down and no work left
+    }
+    Item item = queue_.front();
+    queue_.pop_front();
+    mu_.Unlock();
+    (*item.function)(item.arg);
+    mu_.Lock();
+  }
+  num_threads_--;
+  cv_.SignalAll();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,57 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_THREAD_POOL_H_
+#define STORAGE_LEVELDB_UTIL_THREAD_POOL_H_
+
+#include <deque>
+#include "port/port.h"
+
+namespace leveldb {
+
+class Env;
+
+// Runs scheduled functions in FIFO order on up to a fixed number of
+// threads.  Threads are started the first time they are needed.
+//
+// Thread-safe.
+class ThreadPool {
+ public:
+  // max_threads must be positive.
+  ThreadPool(Env* env, int max_threads);
+
+  // Waits until every scheduled function has returned.
+  ~ThreadPool();
+
+  // Arrange to run "(*function)(arg)" on one of the pool's threads.
+  void Schedule(void (*function)(void* arg), void* arg);
+
+ private:
+  struct Item {
+    void (*function)(void*);
+    void* arg;
+  };
+
+  static void BGThreadMain(void* pool);
+  void BGThread();
+
+  Env* const env_;
+  const int max_threads_;
+
+  // State below is protected by mu_
+  port::Mutex mu_;
+  port::CondVar cv_;       // Signalled when work is queued or a thread exits
+  std::deque<Item> queue_;
+  int num_threads_;        // Threads started and not yet exited
+  int idle_threads_;       // Threads waiting for work
+  bool shutting_down_;
+
+  // No copying allowed
+  ThreadPool(const ThreadPool&);
+  void operator=(const ThreadPool&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_THREAD_POOL_H_